@@ -53,20 +53,20 @@ uniform_sample_sphere(float u1, float u2)
  * normal direction N
  *
  * Parameters:
- * - data: RenderData for access to random number generator
+ * - u: point of a sample set, e.g. data.tld->sample_set_2d(n)[i]
  * - N: main direction of the hemisphere
  */
 glm::vec3
-uniform_sample_hemisphere(RenderData & data, glm::vec3 const& N)
+uniform_sample_hemisphere(glm::vec2 const& u, glm::vec3 const& N)
 {
 	// TODO AmbientOcclusion/IndirectIllumination: 
 	// implement uniform sampling on a unit hemisphere.
-	// data.tld->rand() creates uniform [0, 1] random numbers
 	// TIP: use uniform_sample_sphere 
-    glm::vec3 dir;
-	do {
-        dir = uniform_sample_sphere(data.tld->rand(), data.tld->rand());
-    } while (glm::dot(N, dir) < FLT_EPSILON);
+	// Mirror directions below the horizon instead of rejecting them, so
+	// that every direction uses exactly one point of the sample set.
+    glm::vec3 dir = uniform_sample_sphere(u.x, u.y);
+    if (glm::dot(N, dir) < 0.f)
+        dir = -dir;
 
     return dir;
 }
@@ -95,10 +95,11 @@ glm::vec3 trace_recursive_with_lens(RenderData & data, Ray const& ray, int depth
 
 		// TODO DOF: sample random points on the lens
 		glm::mat4 ivm = data.context.scene->camera->get_inverse_view_matrix(data.camera_mode);
+		SampleSet2D const lens_samples = data.tld->sample_set_2d(data.context.params.dof_rays);
 
         for (int i = 0; i < data.context.params.dof_rays; i++)
         {
-            glm::vec2 p = uniform_sample_disk(data.tld->rand(), data.tld->rand());
+            glm::vec2 p = uniform_sample_disk(lens_samples[i].x, lens_samples[i].y);
             p = p * data.context.params.lens_radius;
 
 			// TODO DOF: generate ray from the sampled point on the
@@ -111,13 +112,13 @@ glm::vec3 trace_recursive_with_lens(RenderData & data, Ray const& ray, int depth
             glm::vec3 dir = glm::normalize(focus - pos);
             Ray dofRay = Ray(pos, dir);
 			// TODO DOF: start ray tracing with the new lens ray
-            contrib += trace_recursive(data, dofRay, depth);
+            contrib += trace_camera_ray(data, dofRay, depth);
 		}
 		// TODO DOF: compute average contribution of all lens rays
         contrib = contrib / ((float)data.context.params.dof_rays);
 	}
 	else
-        contrib = trace_recursive(data, ray, depth);
+        contrib = trace_camera_ray(data, ray, depth);
 
     return contrib;
 }
@@ -130,31 +131,35 @@ float evaluate_ambient_occlusion(
 	// TODO AmbientOcclusion: compute ambient occlusion
 	float ambient_occlusion = 0.f;
 
+	// occluders further away than this reduce V by less than 1/256
+	const float ao_max_distance = 16.f * data.context.params.half_ao_radius;
+	const bool importance = data.context.params.sampling != RaytracingParameters::SAMPLE_UNIFORM;
+	SampleSet2D const samples = data.tld->sample_set_2d(data.context.params.ao_rays);
+
     for (int i = 0; i < data.context.params.ao_rays; ++i)
     {
-        glm::vec3 p = uniform_sample_hemisphere(data, N);
-        float cos_theta = glm::dot(glm::normalize(p), N);
-
-        float dist = max_unobstructed_distance(data, P, glm::normalize(p));
-		
-		float V = 0.f;
+        glm::vec3 p = importance ? cosine_sample_hemisphere(samples[i], N) : uniform_sample_hemisphere(samples[i], N);
+        // a cosine-weighted density cancels the cosine of the integrand
+        float weight = importance ? 1.f : 2.f * glm::dot(glm::normalize(p), N);
 
-        if (dist < FLT_MAX)
-        {
-			float c = 1.f / data.context.params.half_ao_radius / data.context.params.half_ao_radius;
-            V = 1.f - 1.f / (1.f + c * std::pow(dist, 2));
-		}
-        else
-        {
-			V = 1.f;
-		}
-        ambient_occlusion += V * cos_theta;
+        ambient_occlusion += ambient_occlusion_ray(data, P, glm::normalize(p), ao_max_distance,
+            weight / ((float)data.context.params.ao_rays));
 	}
-	ambient_occlusion *= 2.f / ((float)data.context.params.ao_rays);
 
 	return ambient_occlusion;
 }
 
+float ambient_occlusion_falloff(
+	RenderData const& data,     // class containing raytracing information
+	float dist)                 // distance to the closest occluder
+{
+	if (dist == FLT_MAX)
+		return 1.f;
+
+	float c = 1.f / data.context.params.half_ao_radius / data.context.params.half_ao_radius;
+	return 1.f - 1.f / (1.f + c * std::pow(dist, 2));
+}
+
 glm::vec3 evaluate_illumination_from_light(
 	RenderData &data,           // class containing raytracing information
 	MaterialSample const& mat,  // the material at position
@@ -162,30 +167,98 @@ glm::vec3 evaluate_illumination_from_light(
 	glm::vec3 const& LP,        // a point on the light source
 	glm::vec3 const& P,         // world space position
 	glm::vec3 const& N,         // normal at the position (already normalized)
-	glm::vec3 const& V)         // view vector (already normalized)
+	glm::vec3 const& V,         // view vector (already normalized)
+	float weight)               // the share of the light in the estimate
 {
     glm::vec3 dir_to_light = LP - P;                       // direction to the light
     const float squared_dtl = glm::dot(dir_to_light, dir_to_light);         // compute squared distance to light point
     dir_to_light /= sqrt(squared_dtl);                           // normalize direction
 
-	float visibility = 1.f;
-	if (data.context.params.shadows) {
-		if (!visible(data, P, LP)) {
-			visibility = 0.f;
+    auto incoming_light = weight * light.getEmission(-dir_to_light) / squared_dtl;
+    const glm::vec3 illumination = evaluate_phong_BRDF(data, mat, dir_to_light, N, V) * incoming_light;
+
+	if (data.context.params.shadows)
+		return visible_contribution(data, P, LP, illumination);
+	return illumination;
+}
+
+/*
+ * Direct illumination from an area light with samples that are uniform in
+ * the solid angle of the light. With MIS, one of the shadow rays samples the
+ * specular lobe instead and shares the specular term with the light samples,
+ * which finds the highlights of sharp lobes on large lights. Light samples
+ * are better for everything else, so they keep the diffuse term and all
+ * other rays.
+ */
+static glm::vec3
+evaluate_area_light_importance(
+	RenderData &data,           // class containing raytracing information
+	MaterialSample const& mat,  // the material at position
+	AreaLight const& light,     // the light source
+	glm::vec3 const& P,         // world space position
+	glm::vec3 const& N,         // normal at the position (already normalized)
+	glm::vec3 const& V)         // view vector (already normalized)
+{
+	const int num_rays  = data.context.params.shadow_rays;
+	const float p_specular = 1.f - diffuse_lobe_probability(data, mat);
+	int num_brdf = 0;
+	if (data.context.params.sampling == RaytracingParameters::SAMPLE_MIS && p_specular > 0.f && num_rays > 1)
+		num_brdf = 1;
+	const int num_light = num_rays - num_brdf;
+	glm::vec3 illumination(0.f);
+
+	SampleSet2D const light_samples = data.tld->sample_set_2d(num_light);
+	for (int i = 0; i < num_light; i++)
+	{
+		glm::vec3 light_point;
+		float pdf_light;
+		if (!light.sample_solid_angle(P, light_samples[i].x, light_samples[i].y, &light_point, &pdf_light))
+			continue;
+
+		const glm::vec3 L = glm::normalize(light_point - P);
+		const glm::vec3 brdf = evaluate_phong_BRDF(data, mat, L, N, V);
+		if (brdf == glm::vec3(0.f))
+			continue;
+
+		/* only the specular part is shared with the BRDF samples */
+		glm::vec3 weighted = brdf;
+		if (num_brdf > 0) {
+			const glm::vec3 diffuse = evaluate_phong_diffuse_BRDF(data, mat, L, N);
+			weighted = diffuse + (brdf - diffuse)
+				* power_heuristic(num_light, pdf_light, num_brdf, phong_specular_lobe_pdf(mat, L, N, V));
 		}
-	}	
+		illumination += visible_contribution(data, P, light_point,
+			weighted * light.get_radiance(-L) / (num_light * pdf_light));
+	}
+
+	SampleSet2D const brdf_samples = data.tld->sample_set_2d(num_brdf);
+	for (int i = 0; i < num_brdf; i++)
+	{
+		glm::vec3 L;
+		const float pdf_brdf = sample_phong_specular_lobe(mat, brdf_samples[i], N, V, &L);
+		float t;
+		if (pdf_brdf <= 0.f || glm::dot(L, N) <= 0.f || !light.intersect(P, L, &t))
+			continue;
+
+		const glm::vec3 light_point = P + t * L;
+		const glm::vec3 specular = evaluate_phong_BRDF(data, mat, L, N, V) - evaluate_phong_diffuse_BRDF(data, mat, L, N);
+		if (specular == glm::vec3(0.f))
+			continue;
+
+		const float weight = power_heuristic(num_brdf, pdf_brdf, num_light, light.solid_angle_pdf(P, light_point));
+		illumination += visible_contribution(data, P, light_point,
+			specular * light.get_radiance(-L) * weight / (num_brdf * pdf_brdf));
+	}
 
-    auto incoming_light = visibility * light.getEmission(-dir_to_light) / squared_dtl;
-    return evaluate_phong_BRDF(data, mat, dir_to_light, N, V) * incoming_light;
+	return illumination;
 }
 
-glm::vec3 evaluate_illumination(
+glm::vec3 evaluate_direct_illumination(
 	RenderData &data,           // class containing raytracing information
 	MaterialSample const& mat,  // the material at position
 	glm::vec3 const& P,         // world space position
 	glm::vec3 const& N,         // normal at the position (already normalized)
-	glm::vec3 const& V,         // view vector (already normalized)
-	int depth)                  // the current recursion depth
+	glm::vec3 const& V)         // view vector (already normalized)
 {
 	glm::vec3 direct_illumination(0.f);
 
@@ -193,24 +266,30 @@ glm::vec3 evaluate_illumination(
 	{
 		for (auto& light : data.context.scene->area_lights)
 		{
+			AreaLight const* area_light = dynamic_cast<AreaLight const*>(light.get());
+			if (area_light && data.context.params.sampling != RaytracingParameters::SAMPLE_UNIFORM)
+			{
+				direct_illumination += evaluate_area_light_importance(data, mat, *area_light, P, N, V);
+				continue;
+			}
+
 			// TODO SoftShadow: sample point on light source for soft shadows
 			glm::vec3 current_direct_illumination(0.f);
+			SampleSet2D const light_samples = data.tld->sample_set_2d(data.context.params.shadow_rays);
 
             for (int i = 0; i < data.context.params.shadow_rays; i++)
             {
-                glm::vec3 light_point = light->uniform_sample_point(data.tld->rand(), data.tld->rand());
-
-                if (visible(data, P, light_point))
-                {
-                    glm::vec3 p_coeff = evaluate_phong_BRDF(data, mat, glm::normalize(light_point - P), N, V); //f(iz) * cos(theta(i))
-                    glm::vec3 dir_to_light = light->getEmission(glm::normalize(P - light_point));
-                    float cos_thetha0 = 1.f;
-                    current_direct_illumination += p_coeff * dir_to_light * cos_thetha0/ glm::dot(P - light_point, P - light_point);
-					//current_direct_illumination += glm::vec3(1.f);
-				}
+                glm::vec3 light_point = light->uniform_sample_point(light_samples[i].x, light_samples[i].y);
+
+                glm::vec3 p_coeff = evaluate_phong_BRDF(data, mat, glm::normalize(light_point - P), N, V); //f(iz) * cos(theta(i))
+                glm::vec3 dir_to_light = light->getEmission(glm::normalize(P - light_point));
+                float cos_thetha0 = 1.f;
+                current_direct_illumination += visible_contribution(data, P, light_point,
+                    p_coeff * dir_to_light * cos_thetha0 / glm::dot(P - light_point, P - light_point)
+                    * (light->get_area() / data.context.params.shadow_rays));
+				//current_direct_illumination += glm::vec3(1.f);
 			}
 
-			current_direct_illumination *= light->get_area() / data.context.params.shadow_rays;
 			direct_illumination += current_direct_illumination;
 			(void)light; // prevent unused warning*/
 		}
@@ -218,31 +297,58 @@ glm::vec3 evaluate_illumination(
 	}
     else
     {
+        // every light gets its share before the visibility test, which
+        // may be deferred
+        const float share = 1.f / data.context.scene->lights.size();
         for (auto& l : data.context.scene->lights)
         {
             const glm::vec3 light_position = l->getPosition();
 			direct_illumination += evaluate_illumination_from_light(
-                    data, mat, *l, light_position, P, N, V);
+                    data, mat, *l, light_position, P, N, V, share);
 		}
-
-		direct_illumination /= data.context.scene->lights.size();
 	}
 
+	return direct_illumination;
+}
+
+glm::vec3 evaluate_illumination(
+	RenderData &data,           // class containing raytracing information
+	MaterialSample const& mat,  // the material at position
+	glm::vec3 const& P,         // world space position
+	glm::vec3 const& N,         // normal at the position (already normalized)
+	glm::vec3 const& V,         // view vector (already normalized)
+	int depth)                  // the current recursion depth
+{
+	const glm::vec3 direct_illumination = evaluate_direct_illumination(data, mat, P, N, V);
+
 	glm::vec3 indirect_illumination(0.f);
 
 	if (data.context.params.indirect) 
 	{
 		// TODO IndirectIllumination: compute indirect illumination
+		const bool importance = data.context.params.sampling != RaytracingParameters::SAMPLE_UNIFORM;
+		SampleSet2D const samples = data.tld->sample_set_2d(data.context.params.indirect_rays);
         for (int i = 0; i < data.context.params.indirect_rays; i++)
         {
-            glm::vec3 ray_dir = uniform_sample_hemisphere(data, N);
+            glm::vec3 ray_dir;
+            float weight = 2.f * float(M_PI);
+            if (importance)
+            {
+                // directions in proportion to the BRDF, weighted by 1 / density
+                const float pdf = sample_phong_BRDF(data, mat, samples[i], N, V, &ray_dir);
+                if (pdf <= 0.f || glm::dot(ray_dir, N) <= 0.f)
+                    continue;
+                weight = 1.f / pdf;
+            }
+            else
+                ray_dir = uniform_sample_hemisphere(samples[i], N);
             glm::vec3 trace_rec = trace_recursive(data, Ray(P, ray_dir), depth+1);
             glm::vec3 p_coeff = evaluate_phong_BRDF(data, mat, ray_dir, N, V);
 
-            indirect_illumination += p_coeff * trace_rec;
+            indirect_illumination += p_coeff * trace_rec * weight;
 		}
 
-		indirect_illumination *= 2 * M_PI / (float)data.context.params.indirect_rays;
+		indirect_illumination /= (float)data.context.params.indirect_rays;
 	}
 
 	return direct_illumination + indirect_illumination;
@@ -39,29 +39,29 @@ glm::vec3 render_pixel(int x, int y, RaytracingContext const& context, RenderDat
 {
 	cg_assert(data.tld);
 	
-	std::vector<glm::vec2> samples;
 	int spp = data.context.params.spp;
 
 	if(spp > 1) {
-		int grid_size = int(sqrtf(static_cast<float>(spp)));
-		if(data.context.params.stratified)
-			generate_stratified_samples(&samples, grid_size, grid_size, data.tld);
-		else
-			generate_random_samples(&samples, grid_size, grid_size, data.tld);
+		// The samples live in the scratch memory of the thread until the
+		// pixel is done, so that pixels do not allocate.
+		ScratchArena::Scope scope(data.tld->scratch);
+		glm::vec2* samples = data.tld->scratch.allocate<glm::vec2>(spp);
+		generate_pixel_samples(samples, spp, data.context.params.stratified, data.tld);
 		glm::vec3 accum(0.0f);
 
-		for(size_t i = 0; i < samples.size(); i++) {
+		for(int i = 0; i < spp; i++) {
 			float fx = float(x) + samples[i].x;
 			float fy = float(y) + samples[i].y;
 
 			data.x = fx;
 			data.y = fy;
+			data.tld->random.begin_sample(i);
 
 			Ray ray = createPrimaryRay(data, fx, fy);
 			accum += trace_recursive_with_lens(data, ray, 0/*depth*/);
 		}
 
-		return accum / float(samples.size());
+		return accum / float(spp);
 	}
 	else {
 		float fx = float(x) + 0.5f;
@@ -0,0 +1,23 @@
+#pragma once
+
+/*
+ * Counting of heap allocations, to check that the inner loops of the
+ * renderer allocate nothing.
+ *
+ * If cglib is built with CGLIB_COUNT_ALLOCATIONS, see the CMake option of
+ * the same name, allocation_counter.cpp replaces the global operator new
+ * with one that counts the allocations of every thread. That costs an
+ * increment per allocation, so it is meant for debug and benchmark
+ * builds; other builds count nothing.
+ */
+
+/*
+ * Are heap allocations counted in this build?
+ */
+bool counting_allocations();
+
+/*
+ * Allocations by operator new on the calling thread so far, or 0 if they
+ * are not counted.
+ */
+long long thread_allocations();
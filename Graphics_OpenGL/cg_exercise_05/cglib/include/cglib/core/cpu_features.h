@@ -0,0 +1,40 @@
+#pragma once
+
+/*
+ * Compile time detection of the instruction sets the SIMD code paths may
+ * use. CG_HAVE_SSE2 code can be used unconditionally, CG_HAVE_AVX code
+ * must only be called if cpu_features().avx is set.
+ */
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) \
+	|| (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CG_HAVE_SSE2 1
+#else
+#define CG_HAVE_SSE2 0
+#endif
+
+#if CG_HAVE_SSE2 && (defined(__GNUC__) || defined(_MSC_VER))
+#define CG_HAVE_AVX 1
+#else
+#define CG_HAVE_AVX 0
+#endif
+
+/*
+ * Functions using AVX intrinsics are compiled for AVX individually, the
+ * rest of the library does not require it.
+ */
+#if CG_HAVE_AVX && defined(__GNUC__)
+#define CG_TARGET_AVX __attribute__((target("avx")))
+#else
+#define CG_TARGET_AVX
+#endif
+
+struct CPUFeatures
+{
+	bool sse2 = false;
+	bool avx  = false;
+};
+
+/*
+ * The features of the CPU we are running on, detected once.
+ */
+CPUFeatures const& cpu_features();
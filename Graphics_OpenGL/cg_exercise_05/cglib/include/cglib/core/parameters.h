@@ -40,6 +40,13 @@ public:
 	// Output filename (used for noninteractive renders).
 	std::string output_file_name = "output.tga";
 
+	// Name of a benchmark to run instead of rendering, empty to render.
+	std::string benchmark;
+
+	// Comma separated output variables to save along with the output file
+	// (used for noninteractive renders).
+	std::string aovs;
+
 	// The size of a render tile.
 	std::uint32_t tile_size = 32;
 
@@ -49,6 +56,9 @@ public:
 	// Run in interactive mode?
 	bool interactive = true;
 
+	// Print statistics, such as of acceleration structure builds, to stdout.
+	bool verbose = false;
+
 	float exposure = 1.0f;
 	float gamma = 2.2f;
 
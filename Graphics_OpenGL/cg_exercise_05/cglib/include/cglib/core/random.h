@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Counter-based random numbers for Monte Carlo sampling.
+ *
+ * Every number is a hash of (pixel x, pixel y, sample, dimension), using
+ * the pcg4d hash from Jarzynski and Olano, "Hash Functions for GPU
+ * Rendering", JCGT 2020. One hash yields four consecutive dimensions.
+ * There is no state besides these counters, so the numbers of a pixel do
+ * not depend on the thread that renders it or on the order of the tiles,
+ * and images can be compared across runs, thread counts and machines.
+ *
+ * Dimensions below FIRST_DIMENSION are reserved for the subpixel position
+ * of the sample and are only available through get().
+ */
+class RandomStream
+{
+public:
+	enum { FIRST_DIMENSION = 2 };
+
+	/*
+	 * Start sample 0 of pixel (x, y). The seed selects an independent set
+	 * of streams, e.g. for successive frames.
+	 */
+	void begin_pixel(int x, int y, std::uint32_t seed = 0)
+	{
+		m_x = std::uint32_t(x);
+		m_y = std::uint32_t(y);
+		m_seed = seed * 0x9e3779b9u;
+		begin_sample(0);
+	}
+
+	/*
+	 * Continue with the first free dimension of the given sample.
+	 */
+	void begin_sample(int sample)
+	{
+		m_index     = std::uint32_t(sample);
+		m_sample    = std::uint32_t(sample) ^ m_seed;
+		m_dimension = FIRST_DIMENSION;
+		m_block     = ~0u;
+	}
+
+	/*
+	 * The next dimension of the current sample, uniform in [0, 1).
+	 */
+	float next()
+	{
+		const std::uint32_t block = m_dimension >> 2;
+		if (block != m_block) {
+			hash(m_x, m_y, m_sample, block, m_cache);
+			m_block = block;
+		}
+		return to_float(m_cache[m_dimension++ & 3]);
+	}
+
+	/*
+	 * The next n dimensions of the current sample. Whole blocks are
+	 * hashed in one loop without dependencies between iterations, which
+	 * the compiler can vectorize.
+	 */
+	void next(float* out, int n)
+	{
+		int i = 0;
+		for (; i < n && (m_dimension & 3) != 0; ++i)
+			out[i] = next();
+
+		const int num_blocks = (n - i) / 4;
+		const std::uint32_t first_block = m_dimension >> 2;
+		for (int b = 0; b < num_blocks; ++b) {
+			std::uint32_t v[4];
+			hash(m_x, m_y, m_sample, first_block + std::uint32_t(b), v);
+			for (int j = 0; j < 4; ++j)
+				out[i + 4 * b + j] = to_float(v[j]);
+		}
+		i += 4 * num_blocks;
+		m_dimension += 4 * std::uint32_t(num_blocks);
+
+		for (; i < n; ++i)
+			out[i] = next();
+	}
+
+	/*
+	 * Skip n dimensions of the current sample and return the first one,
+	 * for samplers that derive their own numbers from it.
+	 */
+	std::uint32_t reserve(int n)
+	{
+		const std::uint32_t first = m_dimension;
+		m_dimension += std::uint32_t(n);
+		return first;
+	}
+
+	std::uint32_t pixel_x() const { return m_x; }
+	std::uint32_t pixel_y() const { return m_y; }
+	std::uint32_t seed() const { return m_seed; }
+	std::uint32_t sample() const { return m_index; }
+
+	/*
+	 * A given dimension of a given sample of the current pixel, without
+	 * changing the current position in the stream.
+	 */
+	float get(int sample, int dimension) const
+	{
+		std::uint32_t v[4];
+		hash(m_x, m_y, std::uint32_t(sample) ^ m_seed, std::uint32_t(dimension) >> 2, v);
+		return to_float(v[dimension & 3]);
+	}
+
+	static void hash(std::uint32_t x, std::uint32_t y, std::uint32_t z, std::uint32_t w, std::uint32_t v[4])
+	{
+		v[0] = x * 1664525u + 1013904223u;
+		v[1] = y * 1664525u + 1013904223u;
+		v[2] = z * 1664525u + 1013904223u;
+		v[3] = w * 1664525u + 1013904223u;
+
+		v[0] += v[1] * v[3];
+		v[1] += v[2] * v[0];
+		v[2] += v[0] * v[1];
+		v[3] += v[1] * v[2];
+
+		v[0] ^= v[0] >> 16;
+		v[1] ^= v[1] >> 16;
+		v[2] ^= v[2] >> 16;
+		v[3] ^= v[3] >> 16;
+
+		v[0] += v[1] * v[3];
+		v[1] += v[2] * v[0];
+		v[2] += v[0] * v[1];
+		v[3] += v[1] * v[2];
+	}
+
+	/*
+	 * The upper 24 bits as a float in [0, 1).
+	 */
+	static float to_float(std::uint32_t v)
+	{
+		return float(v >> 8) * (1.f / 16777216.f);
+	}
+
+private:
+	std::uint32_t m_x = 0;
+	std::uint32_t m_y = 0;
+	std::uint32_t m_seed = 0;
+	std::uint32_t m_index = 0;
+	std::uint32_t m_sample = 0;
+	std::uint32_t m_dimension = FIRST_DIMENSION;
+	std::uint32_t m_block = ~0u;
+	std::uint32_t m_cache[4];
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cglib/core/random.h>
+
+#include <glm/glm.hpp>
+#include <cstdint>
+
+/*
+ * Samplers for Monte Carlo integration.
+ *
+ * A sampler maps (pixel, dimension pair, index) to a point in [0, 1)^2.
+ * Every 2D decision of a sample, such as the position on the lens, on a
+ * light or on the hemisphere, takes a new pair of dimensions from the
+ * RandomStream of the pixel and loops over the points of that pair: point
+ * i of n in pixel sample s has the index s * n + i, so the points of all
+ * samples of a pixel form one prefix of the sequence. Each pair is
+ * scrambled with its own seed, which decorrelates the pairs of successive
+ * bounces and effects.
+ *
+ * Dimension pair 0 holds the subpixel positions of the samples.
+ */
+class Sampler
+{
+public:
+	enum Type {
+		RANDOM,     /* independent random numbers */
+		HALTON,     /* Owen-scrambled Halton, two new primes per pair */
+		SOBOL,      /* Owen-scrambled, shuffled Sobol (0,2)-sequence */
+		BLUE_NOISE, /* one Sobol sequence, shifted per pixel by blue noise */
+	};
+
+	virtual ~Sampler() {}
+
+	virtual Type type() const = 0;
+
+	/*
+	 * Point index of the dimension pair (dimension, dimension + 1) in the
+	 * current pixel of the stream.
+	 */
+	virtual glm::vec2 get_2d(RandomStream const& stream, std::uint32_t dimension, std::uint32_t index) const = 0;
+
+	/*
+	 * The shared instance of the given type.
+	 */
+	static Sampler const& get(Type type);
+};
+
+/*
+ * The n points of one dimension pair of the current sample.
+ */
+class SampleSet2D
+{
+public:
+	SampleSet2D(Sampler const& sampler, RandomStream const& stream, std::uint32_t dimension, int n) :
+		m_sampler(&sampler),
+		m_stream(&stream),
+		m_dimension(dimension),
+		m_first(stream.sample() * std::uint32_t(n)),
+		m_size(n)
+	{}
+
+	glm::vec2 operator[](int i) const
+	{
+		return m_sampler->get_2d(*m_stream, m_dimension, m_first + std::uint32_t(i));
+	}
+
+	int size() const { return m_size; }
+
+private:
+	Sampler const*      m_sampler;
+	RandomStream const* m_stream;
+	std::uint32_t       m_dimension;
+	std::uint32_t       m_first;
+	int                 m_size;
+};
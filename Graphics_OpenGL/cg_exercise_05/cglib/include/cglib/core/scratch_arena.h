@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+/*
+ * Scratch memory of one thread, such as the pixel samples or the buffers
+ * of a tile.
+ *
+ * A bump allocator: allocating moves a pointer through blocks of memory,
+ * and the memory is given back all at once, by a reset or by releasing
+ * everything allocated after a mark. Blocks are kept, so once the arena
+ * has grown to the most memory a pixel or tile needs, allocations no
+ * longer touch the heap, and threads do not contend in malloc.
+ *
+ * Only for types without destructors; the memory is never destroyed, only
+ * reused.
+ */
+class ScratchArena
+{
+public:
+	struct Mark
+	{
+		std::size_t block;
+		std::size_t offset;
+	};
+
+	/*
+	 * Releases everything allocated since it was created.
+	 */
+	class Scope
+	{
+	public:
+		explicit Scope(ScratchArena& arena) :
+			m_arena(arena), m_mark(arena.mark())
+		{}
+		~Scope() { m_arena.release(m_mark); }
+
+		Scope(Scope const&) = delete;
+		Scope& operator=(Scope const&) = delete;
+
+	private:
+		ScratchArena& m_arena;
+		Mark m_mark;
+	};
+
+	/*
+	 * n default constructed elements of type T, valid until they are
+	 * released.
+	 */
+	template <class T>
+	T* allocate(std::size_t n)
+	{
+		static_assert(std::is_trivially_destructible<T>::value,
+			"ScratchArena does not run destructors.");
+		T* p = static_cast<T*>(allocate_bytes(n * sizeof(T), alignof(T)));
+		for (std::size_t i = 0; i < n; ++i)
+			new (p + i) T;
+		return p;
+	}
+
+	Mark mark() const { return Mark{ m_block, m_offset }; }
+	void release(Mark const& mark);
+
+	/*
+	 * Release everything. If the memory had spread over several blocks, it
+	 * is merged into one block as large as all of them.
+	 */
+	void reset();
+
+private:
+	struct Block
+	{
+		std::unique_ptr<unsigned char[]> data;
+		std::size_t size;
+	};
+
+	void* allocate_bytes(std::size_t size, std::size_t alignment);
+
+	std::vector<Block> m_blocks;
+	std::size_t m_block    = 0;
+	std::size_t m_offset   = 0;
+};
@@ -1,6 +1,8 @@
 #pragma once
 
-#include <random>
+#include <cglib/core/random.h>
+#include <cglib/core/sampler.h>
+#include <cglib/core/scratch_arena.h>
 
 /*
  * Thread-local data.
@@ -13,22 +15,36 @@
  */
 struct ThreadLocalData
 {
-	// Random number generation.
-	std::mt19937                          rng;
-	std::uniform_real_distribution<float> dist;
+	// Random number generation. The renderer positions the stream at
+	// the pixel and sample being rendered, see RandomStream.
+	RandomStream random;
+
+	// The sampler for sets of 2D points, selected by the renderer.
+	Sampler const* sampler = &Sampler::get(Sampler::RANDOM);
 	
 	bool distributed_recursion = false;
 
+	// Temporary memory, e.g. for the buffers of a tile or the samples of
+	// a pixel. The renderer resets it for every tile.
+	ScratchArena scratch;
+
 	ThreadLocalData() {}
 
 	virtual void initialize(int threadId) final
 	{
-		rng.seed(8890 + threadId);
+		random.begin_pixel(0, 0);
 	}
 
 	inline float rand()
 	{
-		return dist(rng);
+		return random.next();
+	}
+
+	// n 2D points for one decision of the current sample, e.g. the
+	// directions of n ambient occlusion rays.
+	inline SampleSet2D sample_set_2d(int n)
+	{
+		return SampleSet2D(*sampler, random, random.reserve(2), n);
 	}
 };
 
@@ -1,12 +1,27 @@
 #pragma once
 
 /*
- * A very simple thread pool. It runs a given number of jobs concurrently with a fixed thread budget.
+ * A thread pool with a fixed number of persistent worker threads.
+ *
+ * Workers are started once and sleep on a condition variable while there
+ * is no work. Every worker owns a deque of job ranges: it takes jobs from
+ * the front of its own deque and, when that runs dry, steals half of the
+ * last range of another worker's deque.
+ *
+ * Work is submitted through task groups, which can be waited for and
+ * cancelled. run() starts one group of jobs asynchronously, in the order
+ * of their ids as far as the number of threads allows; parallel_for and
+ * parallel_reduce block until a range has been processed.
  */
 
 #include <cglib/core/thread_local_data.h>
 
+#include <cglib/core/assert.h>
+#include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -17,12 +32,80 @@
 class ThreadPool
 {
 	public:
+		/*
+		 * A set of tasks that is waited for and cancelled together.
+		 * Tasks are run by the pool's workers; a group must outlive its
+		 * tasks, so the destructor waits for them.
+		 */
+		class TaskGroup
+		{
+			public:
+				explicit TaskGroup(ThreadPool& pool);
+				~TaskGroup();
+
+				/*
+				 * Run task() on some worker.
+				 */
+				void run(std::function<void()> task);
+
+				/*
+				 * Run kernel(job, worker) for all jobs in [0, num_jobs). The
+				 * jobs are spread over the workers round robin, and every
+				 * worker runs its jobs in increasing order.
+				 */
+				void run_jobs(int num_jobs, std::function<void(int, int)> kernel);
+
+				/*
+				 * Block until all tasks have finished or were cancelled.
+				 * Called on a worker thread, the worker keeps running tasks
+				 * while it waits. Rethrows the first exception of a task.
+				 */
+				void wait();
+
+				/*
+				 * Drop all tasks that have not started yet. Running tasks
+				 * can poll cancelled() to stop early.
+				 */
+				void cancel();
+
+				bool cancelled() const { return m_cancelled.load(); }
+				std::atomic<bool>& cancel_flag() { return m_cancelled; }
+				bool done() const { return m_outstanding.load() == 0; }
+
+			private:
+				friend class ThreadPool;
+
+				struct Job {
+					std::function<void(int, int)> kernel;
+				};
+
+				void finish(int num_jobs);
+				void wait_for_tasks();
+
+				ThreadPool&                    m_pool;
+				std::deque<Job>                m_jobs; /* stable addresses */
+				std::atomic<int>               m_outstanding;
+				std::atomic<bool>              m_cancelled;
+				std::exception_ptr             m_exception;
+
+				/* m_complete is only set under m_mutex, so that a waiter
+				 * cannot destroy the group while finish() still uses it */
+				bool                           m_complete;
+				std::mutex                     m_mutex;
+				std::condition_variable        m_finished;
+		};
+
 		ThreadPool(unsigned max_threads = -1);
 		~ThreadPool();
 		bool done() const;
 		void terminate();
 		void force_kill();
 
+		inline int num_threads() const
+		{
+			return static_cast<int>(m_workers.size());
+		}
+
 		inline int num_jobs() const
 		{
 			return m_numJobs.load();
@@ -36,7 +119,7 @@ class ThreadPool
 		template <class TLD = void>
 		void run(
 			// Number of instances to run.
-			int num_jobs, 
+			int num_jobs,
 			// The kernel to run.
 			// Parameters for the kernel are jobId, thread local data.
 			std::function<void(int, ThreadLocalData* tld, std::atomic<bool>&)> kernel
@@ -46,15 +129,10 @@ class ThreadPool
             return (num_jobs() == 0 || float(jobs_done())/num_jobs() > 0.1);
         }
 
-		void
-		wait()
-		{
-			for(auto &i: m_threads) {
-				if(i->joinable()) {
-						i->join();
-				}
-			}
-		}
+		/*
+		 * Wait for all jobs started by run().
+		 */
+		void wait();
 
 		void poll_exceptions()
 		{
@@ -74,21 +152,66 @@ class ThreadPool
 
 		bool kill_at_timeout(int timeout);
 
+		/*
+		 * Call f(begin, end) on chunks of at most grain_size indices that
+		 * cover [begin, end), and wait for all of them.
+		 */
+		template <class F>
+		void parallel_for(int begin, int end, int grain_size, F const& f);
+
+		/*
+		 * Compute f(begin, end) on chunks of at most grain_size indices and
+		 * combine the results with reduce, in chunk order. The result does
+		 * not depend on the number of threads for an associative reduce.
+		 */
+		template <class T, class F, class R>
+		T parallel_reduce(int begin, int end, int grain_size, T const& identity, F const& f, R const& reduce);
+
 	private:
+		/*
+		 * Jobs begin, begin + stride, ... below end of a group job.
+		 */
+		struct Range {
+			TaskGroup*      group;
+			TaskGroup::Job* job;
+			int             begin;
+			int             end;
+			int             stride;
+
+			int size() const { return (end - begin + stride - 1) / stride; }
+		};
+
+		struct Worker {
+			std::mutex                       mutex;
+			std::deque<Range>                queue;
+			std::unique_ptr<ThreadLocalData> tld;
+			std::thread                      thread;
+		};
+
 		void run_internal(
 			int num_jobs,
 			std::function<void(int, ThreadLocalData* tld, std::atomic<bool>&)> kernel,
 			std::function<void(int, std::unique_ptr<ThreadLocalData>& tld)> tldAlloc
 		);
 
+		void worker_main(int worker);
+		void push(int worker, Range const& range);
+		bool pop(int worker, Range* job);
+		bool steal(int worker, Range* job);
+		void execute(int worker, Range const& job);
+		void discard(TaskGroup* group);
+		static int current_worker(ThreadPool const* pool);
+
 	private:
-		std::vector<std::unique_ptr<std::thread>>     m_threads;
-		std::function<void(int, ThreadLocalData*, std::atomic<bool>&)>    m_kernel;
-		std::vector<std::unique_ptr<ThreadLocalData>> m_tld;
+		std::vector<std::unique_ptr<Worker>>          m_workers;
+		std::atomic<int>                              m_queued;
+		bool                                          m_shutdown;
+		std::mutex                                    m_sleepMutex;
+		std::condition_variable                       m_wake;
+
+		std::unique_ptr<TaskGroup>                    m_group;
 		std::atomic<int>                              m_numJobs;
-		std::atomic<int>                              m_currentJob;
 		std::atomic<int>                              m_jobsDone;
-		std::atomic<bool>                             m_terminate;
 		std::atomic<bool>                             m_hasException;
 		std::vector<std::string>                      m_exceptionMsg;
 		std::mutex                                    m_exceptionMutex;
@@ -96,14 +219,14 @@ class ThreadPool
 
 template <class TLD>
 inline void ThreadPool::run(
-	int num_jobs, 
+	int num_jobs,
 	std::function<void(int, ThreadLocalData* tld, std::atomic<bool>&)> kernel
 )
 {
 	static_assert(std::is_base_of<ThreadLocalData, TLD>::value,
 		"The template argument to ThreadPool::run must be void or be derived from ThreadLocalData.");
 
-	run_internal(num_jobs, kernel, [](int threadId, std::unique_ptr<ThreadLocalData>& tld) 
+	run_internal(num_jobs, kernel, [](int threadId, std::unique_ptr<ThreadLocalData>& tld)
 		{
 			tld.reset(new TLD());
 			tld->initialize(threadId);
@@ -113,13 +236,51 @@ inline void ThreadPool::run(
 
 template <>
 inline void ThreadPool::run<void>(
-	int num_jobs, 
+	int num_jobs,
 	std::function<void(int, ThreadLocalData* tld, std::atomic<bool>&)> kernel
 )
 {
-	run_internal(num_jobs, kernel, [](int, std::unique_ptr<ThreadLocalData>& tld) 
+	run_internal(num_jobs, kernel, [](int, std::unique_ptr<ThreadLocalData>& tld)
 		{
 			tld.reset();
 		}
 	);
 }
+
+template <class F>
+inline void ThreadPool::parallel_for(int begin, int end, int grain_size, F const& f)
+{
+	cg_assert(grain_size > 0);
+	const int num_chunks = (end - begin + grain_size - 1) / grain_size;
+	if (num_chunks <= 1) {
+		if (end > begin)
+			f(begin, end);
+		return;
+	}
+
+	TaskGroup group(*this);
+	group.run_jobs(num_chunks, [&](int chunk, int) {
+		const int chunk_begin = begin + chunk * grain_size;
+		f(chunk_begin, std::min(end, chunk_begin + grain_size));
+	});
+	group.wait();
+}
+
+template <class T, class F, class R>
+inline T ThreadPool::parallel_reduce(int begin, int end, int grain_size, T const& identity, F const& f, R const& reduce)
+{
+	cg_assert(grain_size > 0);
+	const int num_chunks = std::max(0, (end - begin + grain_size - 1) / grain_size);
+	std::vector<T> partial(num_chunks, identity);
+	parallel_for(0, num_chunks, 1, [&](int chunk_begin, int chunk_end) {
+		for (int chunk = chunk_begin; chunk < chunk_end; ++chunk) {
+			const int b = begin + chunk * grain_size;
+			partial[chunk] = f(b, std::min(end, b + grain_size));
+		}
+	});
+
+	T result = identity;
+	for (auto const& p : partial)
+		result = reduce(result, p);
+	return result;
+}
@@ -15,6 +15,18 @@ struct AABB
 		this->max = glm::max(this->max, v + glm::vec3(1e-4f));
 	}
 
+	void extend(AABB const& other)
+	{
+		this->min = glm::min(this->min, other.min);
+		this->max = glm::max(this->max, other.max);
+	}
+
+	float surface_area() const
+	{
+		const glm::vec3 d = glm::max(this->max - this->min, glm::vec3(0.f));
+		return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
 	bool
 	intersect(const Ray &ray, float &t_min, float &t_max) const
 	{
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+
+struct RaytracingContext;
+struct ThreadLocalData;
+class RaytracingParameters;
+
+/*
+ * Adaptive sampling of image tiles.
+ *
+ * A tile may take spp samples per pixel on average. Every pixel first
+ * takes a small batch; then, pass after pass, the pixels whose error is
+ * still above the threshold take another batch, the noisiest ones first,
+ * until no pixel is left or the budget of the tile is spent. Converged
+ * pixels stop early, and the samples they leave go to the noisy ones, up
+ * to ADAPTIVE_MAX_SAMPLE_FACTOR times spp per pixel.
+ *
+ * The error of a pixel is the standard error of its mean luminance,
+ * estimated from the running variance of its samples, relative to that
+ * mean. A pixel counts as converged only when its 3x3 neighborhood is: the
+ * first samples of a pixel in a penumbra may well agree, and without its
+ * neighbors it would stop with a variance of zero.
+ *
+ * Sample s of a pixel is trace_pixel_sample s, so the samples of a pixel
+ * are always a prefix of its sequence. The first spp of them are the
+ * samples render_pixel takes; a pixel that stops early has only part of
+ * a stratified pattern, and the samples past spp are not stratified.
+ */
+
+const int ADAPTIVE_MAX_SAMPLE_FACTOR = 4;
+
+/*
+ * Can these parameters be rendered adaptively? Only the recursive and path
+ * tracing modes, and the heatmap of their sample counts, without stereo.
+ */
+bool adaptive_supported(RaytracingParameters const& params);
+
+/*
+ * Render the pixels [x0, x1) x [y0, y1) into color, row by row, and store
+ * the number of samples taken per pixel in num_samples. Returns false if
+ * terminate was set before the tile was done.
+ */
+bool render_tile_adaptive(
+	RaytracingContext const& context,
+	ThreadLocalData* tld,
+	int x0, int y0,
+	int x1, int y1,
+	glm::vec3* color,
+	int* num_samples,
+	std::atomic<bool> const& terminate);
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+struct RaytracingContext;
+struct RenderData;
+class RaytracingParameters;
+
+/*
+ * Arbitrary output variables: images of the primary hits and the cost of
+ * every pixel, recorded while the beauty image is rendered, so that one
+ * traversal yields what would otherwise take one render per render mode.
+ *
+ * The images are those of the matching render modes, saved next to the
+ * output file with the name of the variable appended, e.g. --output a.tga
+ * --aovs normal,time writes a.tga, a_normal.tga and a_time.tga. Depth has
+ * no render mode; it is the distance to the camera, relative to the 95th
+ * percentile of the hits.
+ */
+class AOVBuffers
+{
+public:
+	enum AOV {
+		NORMAL,
+		DEPTH,
+		ALBEDO,
+		DUDV,
+		NUM_RAYS,
+		TIME,
+		NUM_AOVS
+	};
+
+	static char const* name(AOV aov);
+
+	/*
+	 * Parse a comma separated list of names. Returns false, with an
+	 * error message, for an unknown name.
+	 */
+	bool parse(std::string const& list);
+
+	bool enabled() const { return m_mask != 0; }
+	bool enabled(AOV aov) const { return (m_mask & (1u << aov)) != 0; }
+
+	/*
+	 * Can these parameters record the variables? Only the recursive and
+	 * path tracing modes, without stereo.
+	 */
+	static bool supported(RaytracingParameters const& params);
+
+	void resize(int width, int height);
+
+	/*
+	 * Record the variables of pixel (x, y) after render_pixel traced it
+	 * with data, in time_ms. As in the render modes, the hit is that of the
+	 * last sample. Pixels may be recorded concurrently.
+	 */
+	void record(int x, int y, RenderData const& data, float time_ms);
+
+	/*
+	 * Save all enabled variables next to output_file_name.
+	 */
+	void save(RaytracingContext const& context, std::string const& output_file_name) const;
+
+private:
+	unsigned m_mask = 0;
+	int m_width     = 0;
+	int m_height    = 0;
+	std::vector<glm::vec3> m_values[NUM_AOVS];
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cglib/rt/host_render.h>
+
+/*
+ * Micro benchmarks, selected with --benchmark NAME. They print their
+ * results to stdout instead of rendering an image.
+ *
+ *   threadpool  restart latency and per-job overhead of the thread pool
+ *   convergence RMSE against a high-spp reference over the ray count,
+ *               for every sampler
+ *   wavefront   rays per second of the per-pixel and the wavefront
+ *               renderer, for ambient occlusion and soft shadows
+ *   shading     time of the generic and the specialized shading kernel,
+ *               see shading_kernel.h
+ *   materials   share of the frame spent shading the camera hits, with
+ *               the evaluation of their materials
+ *
+ * Returns the process exit code, nonzero for unknown names.
+ */
+int run_benchmark(RaytracingContext& context, HostRender::PixelFunc const& render_pixel);
@@ -9,17 +9,29 @@
 
 class Intersection;
 class TriangleSoup;
+class ThreadPool;
 
 class BVH : public Object
 {
 public:
 	/*
-	 * The maximum number of triangles allowed in one leaf node.
-	 * Never use "magic numbers" in your code. If you need to know how many
-	 * triangles are allowed in leaf node, use this enum.
+	 * The default maximum number of triangles allowed in one leaf node.
+	 * The limit actually used by a BVH is max_triangles_in_leaf, which
+	 * can be configured through the raytracing parameters.
 	 */
 	enum { MAX_TRIANGLES_IN_LEAF = 4 };
 
+	/*
+	 * Number of bins per axis used by the binned SAH builder.
+	 */
+	enum { SAH_NUM_BINS = 16 };
+
+	/*
+	 * Below this depth, the SAH builder falls back to median splits so that
+	 * the traversal stack cannot overflow for degenerate inputs.
+	 */
+	enum { SAH_MAX_DEPTH = 32 };
+
 	/*
 	 * A BVH node.
 	 *
@@ -34,6 +46,8 @@ public:
 		int right         = -1;
 		int triangle_idx  = -1;
 		int num_triangles = 0;
+		/* SAH cost of the subtree relative to its bounds when it was built */
+		float reference_cost = 0.f;
 	};
 
 	/*
@@ -51,16 +65,163 @@ public:
 	 */
 	std::vector<Node> nodes;
 
+	/*
+	 * Compact node used for traversal, 32 bytes.
+	 * Nodes are stored in depth-first order, so the left child of an inner
+	 * node directly follows its parent and offset is the index of the right
+	 * child. For leaves, offset is the index of the first triangle in
+	 * flat_triangles.
+	 */
+	struct FlatNode {
+		glm::vec3 aabb_min;
+		int offset;
+		glm::vec3 aabb_max;
+		int num_triangles; /* 0 for inner nodes */
+	};
+
+	/*
+	 * Triangle stored as one vertex and the two edges leaving it.
+	 */
+	struct FlatTriangle {
+		glm::vec3 v0;
+		glm::vec3 edge1;
+		glm::vec3 edge2;
+	};
+
+	/*
+	 * The traversal representation of nodes, created by flatten().
+	 * flat_triangles[i] is the triangle triangle_indices[i], so the
+	 * triangles of a leaf are contiguous.
+	 */
+	std::vector<FlatNode> flat_nodes;
+	std::vector<FlatTriangle> flat_triangles;
+
+	/*
+	 * Node of a wide BVH with N children. The child bounds are stored as
+	 * structure of arrays, so that all children can be tested with one
+	 * SIMD slab test. child[i] is the index of a wide inner node if
+	 * num_triangles[i] is 0, otherwise the first triangle of a leaf in
+	 * flat_triangles.
+	 */
+	template <int N>
+	struct WideNode {
+		float min_x[N], min_y[N], min_z[N];
+		float max_x[N], max_y[N], max_z[N];
+		int child[N];
+		int num_triangles[N];
+		int num_children;
+	};
+
+	/*
+	 * The number of children per node during traversal. 2 traverses
+	 * flat_nodes, 4 and 8 traverse the wide nodes that flatten()
+	 * collapses from flat_nodes.
+	 */
+	int traversal_width = 2;
+	std::vector<WideNode<4>> wide4_nodes;
+	std::vector<WideNode<8>> wide8_nodes;
+
+	/*
+	 * The settings this BVH was built with.
+	 */
+	RaytracingParameters::BVHBuildMethod build_method;
+	int max_triangles_in_leaf;
+
+	/*
+	 * Statistics of the last build.
+	 */
+	double build_time_ms = 0.0;
+	float sah_cost       = 0.f;
+
+	/*
+	 * Log the statistics to stdout, see Parameters::verbose.
+	 */
+	bool verbose = false;
+
+	/*
+	 * Statistics of the last update().
+	 */
+	double update_time_ms     = 0.0;
+	int num_rebuilt_subtrees  = 0;
+	int num_rebuilt_triangles = 0;
+
 	/* 
 	 * Construct (and build) a new BVH for the given triangle soup.
 	 */
-	BVH(const TriangleSoup &triangle_soup_);
+	BVH(const TriangleSoup &triangle_soup_,
+		RaytracingParameters::BVHBuildMethod build_method_ = RaytracingParameters::BVH_BINNED_SAH,
+		int max_triangles_in_leaf_ = MAX_TRIANGLES_IN_LEAF);
+
+	/*
+	 * Construct (and build) a new BVH using the settings from params.
+	 */
+	BVH(const TriangleSoup &triangle_soup_, RaytracingParameters const& params);
+
+	/*
+	 * Rebuild the BVH from scratch with the given settings. With more than
+	 * one thread, subtrees are built in parallel on a pool that all builds
+	 * share; the resulting tree is identical to the serial one.
+	 */
+	void build(RaytracingParameters::BVHBuildMethod build_method_, int max_triangles_in_leaf_,
+		int num_threads = 1);
+
+	/*
+	 * Create flat_nodes and flat_triangles from nodes. Called at the end of
+	 * build(), must be called again whenever nodes change.
+	 */
+	void flatten();
+
+	/*
+	 * Switch the traversal to the given width. BVH_WIDTH_AUTO selects the
+	 * widest layout the CPU has SIMD support for.
+	 */
+	void set_traversal_width(RaytracingParameters::BVHWidth width);
+	static int resolve_traversal_width(RaytracingParameters::BVHWidth width);
+
+	/*
+	 * Does this BVH have to be rebuilt because its build settings changed?
+	 */
+	bool requires_rebuild(RaytracingParameters const& params) const;
+
+	/*
+	 * Recompute the bounds of all nodes bottom-up after the vertices of
+	 * triangle_soup moved. The number of triangles must not change. The
+	 * tree topology is kept, so its quality degrades for large deformations.
+	 */
+	void refit();
+
+	/*
+	 * Refit, then rebuild only the subtrees that degraded: those whose SAH
+	 * cost relative to their own bounds grew too much since they were
+	 * built. If the root degraded, or most of the triangles lie in degraded
+	 * subtrees, the whole BVH is rebuilt.
+	 */
+	void update(int num_threads = 1);
     
 	/*
-	 * Intersect the given ray with this bvh.
+	 * Intersect the given ray with this bvh. Subtrees behind t_max or
+	 * behind the closest hit found so far are skipped. The hit record
+	 * stores the triangle and its barycentric coordinates.
+	 */
+	bool intersect_hit(Ray const& ray, float t_min, float t_max, HitRecord* hit) const override;
+	void fill_intersection(Ray const& ray, HitRecord const& hit, Intersection* isect) const override;
+
+	/*
+	 * Any-hit query, traversal stops at the first triangle closer than t_max.
 	 */
-    bool intersect(Ray const& ray, Intersection* isect) const override;
+	bool occluded(Ray const& ray, float t_max) const override;
+
+	/*
+	 * Intersect a packet of rays. Rays are traversed together while
+	 * enough of them hit the same nodes, and on their own after that.
+	 */
+	void intersect_packet(RayPacket const& packet, Intersection isects[], bool hits[]) const override;
     
+	/*
+	 * The bounds of the root node, transformed to world space.
+	 */
+	bool get_world_bounds(AABB* aabb) const override;
+
 	/*
 	 * For the given intersection, compute additional information needed
 	 * for shading.
@@ -76,6 +237,17 @@ public:
 
 	void build_bvh(int node_idx, int first_triangle_idx, int num_triangles, int depth);
 
+	/*
+	 * Build the subtree for the given triangle range using a binned
+	 * surface area heuristic to choose the split axis and position.
+	 */
+	void build_bvh_sah(int node_idx, int first_triangle_idx, int num_triangles, int depth);
+
+	/*
+	 * The SAH cost of the whole tree, relative to the root's surface area.
+	 */
+	float compute_sah_cost() const;
+
 	/*
 	 * Used for debug visualization. Maps the number of AABBs that can be
 	 * encountered along the given ray to a color.
@@ -83,6 +255,71 @@ public:
 	glm::vec3 intersect_count(const Ray &ray, int idx, int depth);
 
 private:
-	bool intersect_local(Ray const& ray, Intersection* isect) const;
+	bool occluded_local(Ray const& ray, float t_max) const;
+
+	/*
+	 * Find the nearest triangle hit in [t_min, t_max), or with any_hit the
+	 * first one found. Returns an index into flat_triangles, or -1.
+	 */
+	int traverse_binary(Ray const& ray, float t_min, float t_max, bool any_hit, float* dist, glm::vec3* bary) const;
+	int traverse_wide(Ray const& ray, float t_min, float t_max, bool any_hit, float* dist, glm::vec3* bary) const;
+	void intersect_packet_local(RayPacket const& packet, int nearest[], float dist[], glm::vec3 bary[]) const;
+	void build_wide();
+
+	struct SAHBin {
+		AABB aabb;
+		int count = 0;
+	};
+
+	/*
+	 * A subtree whose construction was deferred to a worker thread.
+	 */
+	struct SubtreeTask {
+		int node_idx;
+		int first_triangle_idx;
+		int num_triangles;
+		int depth;
+	};
+
+	/*
+	 * The builders write the subtree rooted at node_idx into out, which is
+	 * either nodes or the private node array of a parallel subtree task.
+	 */
+	void build_median(std::vector<Node>& out, int node_idx, int first_triangle_idx, int num_triangles, int depth);
+	void build_sah(std::vector<Node>& out, int node_idx, int first_triangle_idx, int num_triangles, int depth);
+	void make_leaf(Node& node, int first_triangle_idx, int num_triangles);
+	void split_median(std::vector<Node>& out, int node_idx, int first_triangle_idx, int num_triangles, int axis, int depth);
+
+	void compute_range_bounds(int first_triangle_idx, int num_triangles, AABB* bounds, AABB* centroid_bounds);
+	void bin_range(int first_triangle_idx, int num_triangles, AABB const& centroid_bounds, SAHBin bins[3][SAH_NUM_BINS]);
+	static int sah_bin(float centroid, float centroid_min, float scale);
+
+	bool defer_subtree(std::vector<Node>& out, int node_idx, int first_triangle_idx, int num_triangles, int depth);
+	void build_subtrees_parallel();
+	void splice_subtree(int node_idx, std::vector<Node> const& subtree);
+	void reorder_nodes_depth_first();
+	void refit_internal_nodes();
+	void refit_nodes();
+	void rebuild_subtrees(std::vector<std::pair<int, int>> const& subtrees);
+
+	/*
+	 * The SAH cost of every subtree, relative to the subtree's own bounds.
+	 * cost[0] is the cost of the whole tree.
+	 */
+	void compute_subtree_costs(std::vector<float>* cost) const;
+	int flatten_subtree(int node_idx);
+
+	/*
+	 * Per-triangle bounds and centroids, only valid during the build.
+	 */
+	std::vector<AABB> triangle_bounds;
+	std::vector<glm::vec3> triangle_centroids;
+
+	/*
+	 * Parallel build state, only valid during the build.
+	 */
+	ThreadPool* build_pool = nullptr;
+	int subtree_task_size  = 0;
+	std::vector<SubtreeTask> subtree_tasks;
 };
 
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <vector>
+
+struct RaytracingContext;
+class RaytracingParameters;
+class Image;
+class ThreadPool;
+
+/*
+ * Edge-aware denoising of a rendered image, after Dammertz et al.,
+ * "Edge-Avoiding A-Trous Wavelet Transform for fast Global Illumination
+ * Filtering", 2010, with the variance guided color weight of Schied et
+ * al., "Spatiotemporal Variance-Guided Filtering", 2017.
+ *
+ * The guides are the normal, position and albedo of the primary hit at
+ * the center of every pixel. The filter runs a few iterations of a 5x5 B3
+ * spline kernel whose taps lie 1, 2, 4, ... pixels apart. A tap counts
+ * less the more its normal or albedo differs, the farther it lies from
+ * the tangent plane of the pixel, and the more its luminance differs,
+ * relative to the standard deviation of the noise, which is estimated
+ * from the 5x5 neighborhood and filtered along with the image. Pixels
+ * that see the environment are left as they are.
+ */
+
+/*
+ * The primary hits of all pixels.
+ */
+struct GuideBuffers
+{
+	int width  = 0;
+	int height = 0;
+	std::vector<glm::vec3> normal;
+	std::vector<glm::vec3> position;
+	std::vector<glm::vec3> albedo;
+	std::vector<float> depth; /* distance from the camera, 0 where nothing was hit */
+};
+
+/*
+ * Can images rendered with these parameters be denoised? Only those of
+ * the recursive and path tracing modes, without stereo or depth of field,
+ * whose primary hits are not those of the pinhole camera.
+ */
+bool denoise_supported(RaytracingParameters const& params);
+
+/*
+ * Trace the primary rays through the pixel centers and record their hits.
+ * Returns false if it stopped early because terminate was set.
+ */
+bool capture_guides(RaytracingContext const& context, ThreadPool& thread_pool, GuideBuffers* guides,
+	std::atomic<bool> const* terminate = nullptr);
+
+/*
+ * Denoise image in place with denoise_iterations iterations, guided by
+ * guides of the same size. If terminate is set before it is done, image
+ * is left as it is and false is returned.
+ */
+bool denoise(RaytracingContext const& context, ThreadPool& thread_pool, GuideBuffers const& guides, Image* image,
+	std::atomic<bool> const* terminate = nullptr);
@@ -8,17 +8,18 @@
 
 #include <cglib/rt/raytracing_context.h>
 #include <cglib/rt/scene.h>
+#include <cglib/rt/aov.h>
 #include <cglib/rt/render_data.h>
+#include <cglib/rt/reprojection.h>
+#include <cglib/rt/tile_scheduler.h>
 
 #include <cglib/core/assert.h>
 #include <chrono>
 #include <functional>
 #include <iostream>
-#include <mutex>
-
-static std::mutex mutex;
 
 struct RenderData;
+struct PacketHit;
 
 /*
  * Use this class to render on the host (so not primarily with OpenGL), in an image order fashion.
@@ -40,12 +41,39 @@ class HostRender
 					   std::function<void()> const& render_overlay = []() {} );
 
 	private:
-		typedef std::function<glm::vec3(int, int, RaytracingContext const&, ThreadLocalData*)> PixelFuncRaw;
+		typedef std::function<glm::vec3(int, int, RaytracingContext const&, ThreadLocalData*, PacketHit const*)> PixelFuncRaw;
+		static bool use_aovs(RaytracingParameters const& params);
+		static bool use_ray_packets(RaytracingParameters const& params);
+		static bool use_wavefront(RaytracingParameters const& params);
+		static bool use_adaptive(RaytracingParameters const& params);
+		static bool use_progressive(RaytracingParameters const& params);
+		static bool use_reprojection(RaytracingParameters const& params);
+		static bool use_denoiser(RaytracingParameters const& params);
+		/*
+		 * Capture the guides and denoise fb in a job of thread_pool, if the
+		 * denoiser is enabled. The job spreads the work over the pool.
+		 */
+		static void launch_denoiser(Image* fb, ThreadPool& thread_pool, RaytracingContext const* context);
 		static void generate_tile_idx(int num_tiles_x, int num_tiles_y, std::vector<glm::ivec2>* tile_idx);
 		static int run_interactive(RaytracingContext& context, PixelFuncRaw const& render_pixel, 
 			std::function<void()> const& render_overlay = []() {} );
 		static int run_noninteractive(RaytracingContext& context, 
 			PixelFuncRaw const& render_pixel,
-			int kill_timeout_seconds);
-		static void launch(Image* fb, ThreadPool& thread_pool, RaytracingContext const* context, std::vector<glm::ivec2>* tile_idx, PixelFuncRaw render_pixel);
+			int kill_timeout_seconds,
+			AOVBuffers* aovs);
+		static void launch(Image* fb, ThreadPool& thread_pool, RaytracingContext const* context, TileScheduler* tiles, PixelFuncRaw render_pixel);
+		/*
+		 * One pass of progressive rendering. Pass -1 is the preview, one
+		 * sample per block of preview_scale x preview_scale pixels. Pass s
+		 * adds sample first_sample + s of every pixel to history and shows
+		 * the mean; pass 0 also records the primary hits. The preview
+		 * is not timed by tiles.
+		 */
+		static void launch_progressive(Image* fb, FrameHistory* history, int pass, ThreadPool& thread_pool, RaytracingContext const* context, TileScheduler* tiles);
+		/*
+		 * Pass 0 of progressive rendering after a camera move: reuse the
+		 * samples of previous where they are still valid, see reprojection.h.
+		 * Adds the number of reused pixels to num_reused.
+		 */
+		static void launch_reprojection(Image* fb, FrameHistory const* previous, FrameHistory* history, std::atomic<int>* num_reused, ThreadPool& thread_pool, RaytracingContext const* context, std::vector<glm::ivec2>* tile_idx);
 };
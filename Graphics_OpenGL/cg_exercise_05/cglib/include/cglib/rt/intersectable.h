@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cglib/rt/aabb.h>
 #include <cglib/rt/ray.h>
 #include <cglib/rt/intersection.h>
 #include <cglib/rt/intersection_tests.h>
@@ -7,7 +8,29 @@
 class Intersectable
 {
 public:
-    virtual bool intersect(Ray const& ray, Intersection* isect) const = 0;
+    /*
+     * Find the closest intersection with a distance in [t_min, t_max).
+     */
+    virtual bool intersect(Ray const& ray, float t_min, float t_max, Intersection* isect) const = 0;
+
+    bool intersect(Ray const& ray, Intersection* isect) const
+    {
+        return intersect(ray, 0.f, std::numeric_limits<float>::max(), isect);
+    }
+
+    /*
+     * Is there any intersection closer than t_max?
+     */
+    virtual bool occluded(Ray const& ray, float t_max) const
+    {
+        Intersection isect;
+        return intersect(ray, 0.f, t_max, &isect);
+    }
+
+    /*
+     * Object space bounds. Returns false for unbounded geometry (planes).
+     */
+    virtual bool get_bounds(AABB* aabb) const { return false; }
 };
 
 class Sphere : public Intersectable
@@ -20,10 +43,11 @@ public:
     {
     }
 
-    bool intersect(Ray const& ray, Intersection* isect) const
+    using Intersectable::intersect;
+    bool intersect(Ray const& ray, float t_min, float t_max, Intersection* isect) const
     {
         float t;
-        if (intersect_sphere(ray.origin, ray.direction, center, radius, &t))
+        if (intersect_sphere(ray.origin, ray.direction, center, radius, t_min, t_max, &t))
         {
             isect->t = t;
             isect->position  = ray.origin + t * ray.direction;
@@ -34,6 +58,13 @@ public:
         return false;
     }
 
+    bool get_bounds(AABB* aabb) const
+    {
+        aabb->extend(center - glm::vec3(radius));
+        aabb->extend(center + glm::vec3(radius));
+        return true;
+    }
+
 private:
     const glm::vec3 center;
     const float radius;
@@ -49,10 +80,12 @@ public:
     {
     }
 
-    bool intersect(Ray const& ray, Intersection* isect) const
+    using Intersectable::intersect;
+    bool intersect(Ray const& ray, float t_min, float t_max, Intersection* isect) const
     {
         float t;
-        if (intersect_plane(ray.origin, ray.direction, center, normal, &t))
+        if (intersect_plane(ray.origin, ray.direction, center, normal, &t)
+         && t >= t_min && t < t_max)
         {
             isect->t = t;
             isect->position = ray.origin + t * ray.direction;
@@ -85,10 +118,12 @@ public:
     {
     }
 
-    bool intersect(Ray const& ray, Intersection* isect) const
+    using Intersectable::intersect;
+    bool intersect(Ray const& ray, float t_min, float t_max, Intersection* isect) const
     {
         float t;
-        if (intersect_plane(ray.origin, ray.direction, center, normal, &t))
+        if (intersect_plane(ray.origin, ray.direction, center, normal, &t)
+         && t >= t_min && t < t_max)
         {
             isect->t = t;
             isect->position = ray.origin + t * ray.direction;
@@ -109,6 +144,15 @@ public:
         return false;
     }
 
+    bool get_bounds(AABB* aabb) const
+    {
+        aabb->extend(p);
+        aabb->extend(p + e0);
+        aabb->extend(p + e1);
+        aabb->extend(p + e0 + e1);
+        return true;
+    }
+
 private:
     const glm::vec3 e0;
     const glm::vec3 e1;
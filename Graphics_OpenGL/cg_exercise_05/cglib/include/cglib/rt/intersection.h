@@ -6,6 +6,8 @@
 
 #include <cglib/rt/material.h>
 
+class Object;
+
 class Intersection
 {
 public:
@@ -36,3 +38,17 @@ public:
     uint32_t primitive_id;          // only used for triangle meshes
     float t;
 };
+
+/*
+ * Compact record of a hit that is carried through traversal instead of a
+ * full Intersection. Only the closest hit is expanded into an Intersection,
+ * by Object::fill_intersection.
+ */
+struct HitRecord
+{
+	Object* object        = nullptr; // the scene object that was hit, set by the TLAS
+	uint32_t primitive_id = 0;       // only used for triangle meshes
+	float t               = std::numeric_limits<float>::max(); // world space distance along the ray
+	float t_local         = 0.f;     // distance along the ray in the space of the primitive
+	glm::vec2 bary        = glm::vec2(0.f); // barycentric coordinates of vertices 1 and 2 for triangles
+};
@@ -3,20 +3,21 @@
 #include <glm/glm.hpp>
 #include <cglib/core/assert.h>
 
+/*
+ * Ray-triangle intersection for a triangle given by one vertex and the
+ * two edges leaving it, as stored in precomputed triangle arrays.
+ */
 template<bool enable_early_out = true>
 inline bool
-intersect_triangle(
+intersect_triangle_precomputed(
         glm::vec3 const& ray_origin,
         glm::vec3 const& ray_direction,
 		glm::vec3 const& v0, 
-		glm::vec3 const& v1, 
-		glm::vec3 const& v2, 
+		glm::vec3 const& edge1, 
+		glm::vec3 const& edge2, 
         glm::vec3 & bary,
 		float &dist)
 {
-	const glm::vec3 edge1 = v1 - v0;
-	const glm::vec3 edge2 = v2 - v0;
-
 	const glm::vec3 pvec = glm::cross(ray_direction, edge2);
 
 	const float det = glm::dot(edge1, pvec);
@@ -53,6 +54,21 @@ intersect_triangle(
 	}
 }
 
+template<bool enable_early_out = true>
+inline bool
+intersect_triangle(
+        glm::vec3 const& ray_origin,
+        glm::vec3 const& ray_direction,
+		glm::vec3 const& v0, 
+		glm::vec3 const& v1, 
+		glm::vec3 const& v2, 
+        glm::vec3 & bary,
+		float &dist)
+{
+	return intersect_triangle_precomputed<enable_early_out>(ray_origin, ray_direction,
+		v0, v1 - v0, v2 - v0, bary, dist);
+}
+
 inline bool 
 intersect_sphere(
     glm::vec3 const& ray_origin,    // starting point of the ray
@@ -91,6 +107,48 @@ intersect_sphere(
     return false;
 }
 
+/*
+ * Nearest intersection with the sphere at a distance in [t_min, t_max).
+ */
+inline bool 
+intersect_sphere(
+    glm::vec3 const& ray_origin,
+    glm::vec3 const& ray_direction,
+    glm::vec3 const& center,
+    float radius,
+    float t_min,
+    float t_max,
+    float* t)
+{
+    cg_assert(t);
+
+    const glm::vec3 e_c = ray_origin - center;
+    const float c = glm::dot(e_c, e_c) - radius * radius;
+    const float b = glm::dot(ray_direction, e_c);
+    const float a = glm::dot(ray_direction, ray_direction);
+
+    const float d = b * b - a * c;
+    if (d >= 0.0f)
+    {
+        const float e = sqrt(d);
+        const float f = 1.0f / a;
+        const float t1 = (-b + e) * f;
+        const float t2 = (-b - e) * f;
+
+        const float t_near = glm::min(t1, t2);
+        const float t_far  = glm::max(t1, t2);
+        if (t_near >= t_min && t_near < t_max) {
+            *t = t_near;
+            return true;
+        }
+        if (t_far >= t_min && t_far < t_max) {
+            *t = t_far;
+            return true;
+        }
+    }
+    return false;
+}
+
 inline bool 
 intersect_plane(
     glm::vec3 const& ray_origin,
@@ -51,12 +51,29 @@ public:
 
 	virtual float get_area() const 
 	{ 
-		return glm::length(tangent)*glm::length(bitangent); 
+		return glm::length(glm::cross(tangent, bitangent)); 
 	}
 	virtual glm::vec3 getEmission(glm::vec3 const& omega) const { 
 		return power * std::max(0.f, glm::dot(normal, omega)) / 
 			(2.f*float(M_PI)*get_area()); 
 	}
+
+	// the radiance in direction omega (pointing away from the light),
+	// i.e. the emission without the cosine at the light.
+	glm::vec3 get_radiance(glm::vec3 const& omega) const {
+		return glm::dot(normal, omega) > 0.f ? power / (2.f*float(M_PI)*get_area()) : glm::vec3(0.f);
+	}
+
+	// samples a point that is uniformly distributed in the solid angle
+	// the light subtends at P, and returns its density with respect to
+	// solid angle at P. Returns false if P does not see the lit side.
+	bool sample_solid_angle(glm::vec3 const& P, float x0, float x1, glm::vec3* point, float* pdf) const;
+
+	// the density of sample_solid_angle for the given point on the light
+	float solid_angle_pdf(glm::vec3 const& P, glm::vec3 const& point) const;
+
+	// distance from P along dir to the light, false if the ray misses it
+	bool intersect(glm::vec3 const& P, glm::vec3 const& dir, float* t) const;
 	
 	glm::vec3 normal;
 	glm::vec3 tangent;
@@ -4,6 +4,7 @@
 #include <cglib/rt/texture_mapping.h>
 
 class Intersection;
+class FlatMaterial;
 
 class Material
 {
@@ -33,6 +34,7 @@ class MaterialSample
 {
 public:
     void evaluate(Material const& material, Intersection const& isect);
+    void evaluate(FlatMaterial const& material, Intersection const& isect);
     
     glm::vec3 k_a; // ambient reflectance
     glm::vec3 k_d; // diffuse reflectance
@@ -44,3 +46,31 @@ public:
     float n;       // phong exponent
 };
 
+/*
+ * A Material as the renderer shades it, rebuilt from the Material by
+ * Scene::update_bvhs before every frame.
+ *
+ * Most channels of most materials are ConstTextures. Evaluating them
+ * through the Texture interface costs a virtual call each, and the
+ * normal of a constant normal map is decoded and normalized again on
+ * every hit. Here, every channel is either its constant value, read
+ * directly, or the texture to evaluate. A material without any texture
+ * keeps its whole MaterialSample, so that evaluating it is a copy.
+ *
+ * The textures are not owned, they live as long as the Material holds
+ * them.
+ */
+class FlatMaterial
+{
+public:
+    enum Channel { K_D, K_S, K_R, K_T, NORMAL, NUM_CHANNELS };
+
+    FlatMaterial() = default;
+    explicit FlatMaterial(Material const& material);
+
+    glm::vec3 value[NUM_CHANNELS];             // the constant channels
+    Texture const* texture[NUM_CHANNELS] = {}; // nullptr if constant
+    bool textured = false;                     // any channel has a texture
+    MaterialSample sample;                     // the constant channels, evaluated
+};
+
@@ -8,18 +8,60 @@
 
 #include <cglib/rt/transform.h>
 
+struct RayPacket;
+
 class Object
 {
 public:
     Object();
     virtual ~Object() {}
 
-    virtual bool intersect(Ray const& ray, Intersection* isect) const;
+    /*
+     * Find the closest intersection whose world space distance along the
+     * ray lies in [t_min, t_max). Same as intersect_hit followed by
+     * fill_intersection.
+     */
+    bool intersect(Ray const& ray, float t_min, float t_max, Intersection* isect) const;
+
+    bool intersect(Ray const& ray, Intersection* isect) const
+    {
+        return intersect(ray, 0.f, std::numeric_limits<float>::max(), isect);
+    }
+
+    /*
+     * Is there any intersection closer than t_max? Does not need to find
+     * the closest one or compute intersection details.
+     */
+    virtual bool occluded(Ray const& ray, float t_max) const;
+
+    /*
+     * Find the closest hit in [t_min, t_max), but only record what is
+     * needed to build the intersection later. hit is left untouched if
+     * nothing is found.
+     */
+    virtual bool intersect_hit(Ray const& ray, float t_min, float t_max, HitRecord* hit) const;
+
+    /*
+     * Build the world space intersection for a hit that intersect_hit
+     * found for the same ray.
+     */
+    virtual void fill_intersection(Ray const& ray, HitRecord const& hit, Intersection* isect) const;
+
+    /*
+     * Intersect all rays of the packet, hits[i] and isects[i] are what
+     * intersect() returns for packet.rays[i].
+     */
+    virtual void intersect_packet(RayPacket const& packet, Intersection isects[], bool hits[]) const;
 
     virtual void compute_shading_info(Intersection* isect);
 
     virtual void compute_shading_info(const Ray rays[4], Intersection* isect);
 
+    /*
+     * Rebuild flat_material from material, and those of prototypes.
+     */
+    virtual void update_materials();
+
 	void get_intersection_uvs(glm::vec3 const positions[4], Intersection const& isect, glm::vec2 uvs[4]);
 
 	// compute texel footprint in uv-space
@@ -27,10 +69,17 @@ public:
 
     virtual glm::vec2 get_uv(Intersection const& isect);
 
+    /*
+     * World space bounds of the object, used to build the top-level
+     * acceleration structure. Returns false if the object is unbounded.
+     */
+    virtual bool get_world_bounds(AABB* aabb) const;
+
 	void set_transform_object_to_world(glm::mat4 const& T);
 
     std::shared_ptr<Intersectable> geo;
     std::shared_ptr<Material> material;
+    FlatMaterial flat_material; // material, as compute_shading_info evaluates it
     std::shared_ptr<TextureMapping> texture_mapping;
 	glm::mat4 transform_object_to_world;
 	glm::mat4 transform_world_to_object;
@@ -38,6 +87,33 @@ public:
 	glm::mat4 transform_world_to_object_normal;
 };
 
+/*
+ * An instance places a shared prototype object (e.g. the BVH of a mesh)
+ * into the scene with its own transformation, so that repeated geometry
+ * is stored and built only once. The prototype's transformation is
+ * applied first, and its materials are used for shading. Prototypes are
+ * not part of Scene::objects themselves.
+ */
+class Instance : public Object
+{
+public:
+    explicit Instance(std::shared_ptr<Object> const& prototype_);
+
+    bool occluded(Ray const& ray, float t_max) const override;
+    bool intersect_hit(Ray const& ray, float t_min, float t_max, HitRecord* hit) const override;
+    void fill_intersection(Ray const& ray, HitRecord const& hit, Intersection* isect) const override;
+    void compute_shading_info(Intersection* isect) override;
+    void compute_shading_info(const Ray rays[4], Intersection* isect) override;
+    void update_materials() override;
+    bool get_world_bounds(AABB* aabb) const override;
+
+    std::shared_ptr<Object> prototype;
+};
+
+std::unique_ptr<Object> create_instance(
+		std::shared_ptr<Object> const& prototype,
+		glm::mat4 const& transform_object_to_world);
+
 std::unique_ptr<Object> create_sphere(
 		glm::vec3 const& center,
 		float radius,
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cglib/rt/intersection.h>
+#include <cglib/rt/ray.h>
+
+/*
+ * A small group of coherent rays that is traced through the scene at once.
+ */
+struct RayPacket
+{
+	enum { MAX_SIZE = 16 };
+
+	int size = 0;
+	Ray rays[MAX_SIZE];
+};
+
+/*
+ * The result of a packet traced for one pixel of a block: the primary ray
+ * through its center and the visibility of the point lights from the hit.
+ * shoot_ray() and visible() return these results instead of tracing when
+ * they are asked for exactly the same ray, so using them never changes
+ * the image.
+ */
+struct PacketHit
+{
+	enum { MAX_LIGHTS = 8 };
+
+	Ray ray;                      // the primary ray, before the epsilon offset
+	bool has_corner_rays = false; // isect was shaded with the pixel footprint
+	Ray corner_rays[4];
+	bool hit = false;
+	Intersection isect;           // including shading information
+	int num_lights = 0;           // lights with precomputed visibility
+	glm::vec3 light_position[MAX_LIGHTS];
+	bool light_visible[MAX_LIGHTS];
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cglib/rt/raytracing_parameters.h>
+#include <cglib/rt/shading_kernel.h>
 #include <cglib/core/assert.h>
 
 #include <memory>
@@ -17,6 +18,10 @@ struct RaytracingContext
     std::shared_ptr<Scene> scene;
 	std::unordered_map<std::string, std::shared_ptr<Scene>> scenes;
 
+	/* trace_recursive specialized for params, selected per frame, or
+	 * nullptr for the generic one */
+	ShadingKernel shading_kernel = nullptr;
+
 private:
 	static RaytracingContext *current_context;
 	static RaytracingContext *old_context;
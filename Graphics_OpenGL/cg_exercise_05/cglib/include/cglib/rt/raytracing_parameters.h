@@ -4,6 +4,7 @@
 #include <cglib/rt/epsilon.h>
 
 #include <cglib/core/parameters.h>
+#include <cglib/core/sampler.h>
 
 struct CTwBar;
 
@@ -19,8 +20,10 @@ class RaytracingParameters : public Parameters
 public:
 	enum RenderMode {
 		RECURSIVE,
+		PATH_TRACE, /* one path per camera ray, see trace_path */
 		DESATURATE,
 		NUM_RAYS,
+		SAMPLES, /* heatmap of the samples taken per pixel */
 		NORMAL,
 		TIME,
 		DUDV,
@@ -36,6 +39,30 @@ public:
 //			GO_BOARD,
 	};
 
+	enum BVHBuildMethod {
+		BVH_MEDIAN_SPLIT,
+		BVH_BINNED_SAH,
+	};
+
+	enum BVHWidth {
+		BVH_WIDTH_AUTO, /* widest layout the CPU supports */
+		BVH_WIDTH_2,
+		BVH_WIDTH_4,
+		BVH_WIDTH_8,
+	};
+
+	enum SamplingStrategy {
+		SAMPLE_UNIFORM,    /* uniform hemisphere, uniform on the light's area */
+		SAMPLE_IMPORTANCE, /* cosine-weighted hemisphere and BRDF, light's solid angle */
+		SAMPLE_MIS,        /* as above, light and BRDF samples for direct light */
+	};
+
+	enum RayPacketSize {
+		RAY_PACKET_4  = 4,  /* 2x2 pixels */
+		RAY_PACKET_8  = 8,  /* 4x2 pixels */
+		RAY_PACKET_16 = 16, /* 4x4 pixels */
+	};
+
 	RenderMode render_mode  = RECURSIVE;
 	bool diffuse_white_mode = false;
 	int max_depth           = 1;
@@ -51,12 +78,50 @@ public:
 	float ray_epsilon       = 7.f*1e-3f;
 	float fovy              = 45.0f;
 
-	bool stratified = true;
+	bool stratified = true; // stratify the pixel samples of the random sampler
+	Sampler::Type sampler = Sampler::SOBOL;
 
 	bool normal_mapping = false;
 	bool transform_objects = true;
 	std::uint32_t spp = 1; // number of samples per pixel
 
+	/*
+	 * Take spp samples per pixel on average, more where the estimated
+	 * error is above the threshold and fewer where it is not, see
+	 * adaptive.h. Takes precedence over wavefront and ray packets.
+	 */
+	bool adaptive            = false;
+	float adaptive_threshold = 0.05f; // relative standard error of a converged pixel
+
+	/*
+	 * Show a coarse preview first, then add one sample per pixel and pass
+	 * until spp are taken, see HostRender::launch_progressive. Takes
+	 * precedence over adaptive sampling, wavefront and ray packets.
+	 */
+	bool progressive         = false;
+	int preview_scale        = 4; // the preview takes one sample per block of preview_scale^2 pixels
+	bool reprojection        = false; // on camera moves, reuse the samples of the previous view, see reprojection.h
+
+	/*
+	 * Filter the finished image, guided by the primary hits, see
+	 * denoiser.h.
+	 */
+	bool denoise             = false;
+	int denoise_iterations   = 5; // the taps of iteration i lie 2^i pixels apart
+
+	/*
+	 * Render the tiles that were expensive in the last frame first, and
+	 * split them, see tile_scheduler.h. Otherwise, tiles come in spiral
+	 * order.
+	 */
+	bool tile_scheduling     = true;
+
+	/*
+	 * Shade with trace_recursive compiled for the switches in use, see
+	 * shading_kernel.h.
+	 */
+	bool specialize_shading  = false;
+
 	bool filtered_envmap = false;
 	int num_triangles = 5;
 
@@ -72,12 +137,36 @@ public:
 	float focal_length   = 7.5f;
 	int shadow_rays      = 32;
 	bool disable_direct  = false;
+	SamplingStrategy sampling = SAMPLE_IMPORTANCE;
 
 	TextureFilterMode tex_filter_mode = TextureFilterMode::TRILINEAR;
 	TextureWrapMode tex_wrap_mode = TextureWrapMode::REPEAT;
 
 	Scene scene = MONKEY;
 
+	BVHBuildMethod bvh_build_method = BVH_BINNED_SAH;
+	int bvh_max_triangles_in_leaf   = 4;
+	BVHWidth bvh_width              = BVH_WIDTH_AUTO;
+
+	/*
+	 * Deform the scene every frame in interactive mode, if it animates;
+	 * the changed BVHs are refit, see Scene::animate.
+	 */
+	bool animate_scene = false;
+
+	/*
+	 * Trace the primary rays of a pixel block, and their shadow rays to
+	 * point lights, as packets.
+	 */
+	bool ray_packets                = false;
+	RayPacketSize ray_packet_size   = RAY_PACKET_16;
+
+	/*
+	 * Render tiles in stages over queues of rays instead of pixel by
+	 * pixel, see wavefront.h. Takes precedence over ray packets.
+	 */
+	bool wavefront                  = false;
+
 	virtual bool derived_change_requires_restart(Parameters const& old_) const final;
 	virtual void derived_gui_setup(CTwBar *main_bar) override final;
 };
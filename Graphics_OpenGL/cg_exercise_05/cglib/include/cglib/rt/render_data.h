@@ -5,6 +5,8 @@
 
 struct ThreadLocalData;
 struct RaytracingContext;
+struct PacketHit;
+struct DeferredRays;
 
 /*
  * Rendering data that will be passed to the raytracer for each pixel
@@ -25,4 +27,6 @@ struct RenderData
 	float x = 0.0f;	// x-Coordinate of (Sub-)Pixel
 	float y = 0.0f;	// y-Coordinate of (Sub-)Pixel
 	Camera::Mode camera_mode = Camera::Mono;
+	PacketHit const* packet_hit = nullptr; // precomputed primary ray results, may be null
+	DeferredRays* deferred_rays = nullptr; // takes the visibility rays instead of tracing them, may be null
 };
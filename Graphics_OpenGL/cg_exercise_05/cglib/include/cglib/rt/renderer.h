@@ -2,12 +2,15 @@
 
 #include <glm/glm.hpp>
 
+#include <limits>
+
 class Object;
 class Ray;
 struct RenderData;
 class Intersection;
 struct ThreadLocalData;
 class MaterialSample;
+struct PacketHit;
 
 /*
  * reflect the vector v at the normal vector n. v points "away from n"
@@ -49,10 +52,56 @@ bool visible(
 	glm::vec3 const& from,
 	glm::vec3 const& to);
 
+/*
+ * distance to the closest hit along dir, or FLT_MAX if nothing is hit
+ * closer than max_distance
+ */
 float max_unobstructed_distance(
 	RenderData &data,
 	glm::vec3 const& from,
-	glm::vec3 const& dir);
+	glm::vec3 const& dir,
+	float max_distance = std::numeric_limits<float>::max());
+
+/*
+ * Where the estimators send their visibility rays if they are not traced
+ * right away, see RenderData::deferred_rays. The wavefront renderer
+ * queues them, traces them later and adds what they see.
+ */
+struct DeferredRays
+{
+	virtual ~DeferredRays() {}
+
+	/* contribution, if "to" is visible from "from" */
+	virtual void shadow_ray(glm::vec3 const& from, glm::vec3 const& to,
+		glm::vec3 const& contribution) = 0;
+
+	/* weight times ambient_occlusion_falloff of the closest hit along dir */
+	virtual void occlusion_ray(glm::vec3 const& from, glm::vec3 const& dir,
+		float max_distance, float weight) = 0;
+};
+
+/*
+ * contribution if "to" is visible from "from", and zero otherwise. Zero
+ * as well if the ray is deferred to data.deferred_rays, which adds the
+ * contribution later.
+ */
+glm::vec3 visible_contribution(
+	RenderData &data,
+	glm::vec3 const& from,
+	glm::vec3 const& to,
+	glm::vec3 const& contribution);
+
+/*
+ * weight times the ambient_occlusion_falloff of the closest hit along dir
+ * within max_distance. Zero if the ray is deferred to data.deferred_rays,
+ * which adds it later.
+ */
+float ambient_occlusion_ray(
+	RenderData &data,
+	glm::vec3 const& from,
+	glm::vec3 const& dir,
+	float max_distance,
+	float weight);
 
 /*
  * Shoot a ray and return intersection information
@@ -71,6 +120,29 @@ bool shoot_ray(
 	const Ray corner_rays[4],
 	Intersection* isect);
 
+/*
+ * Shoot a ray of the given depth, with the pixel footprint for the camera
+ * ray if the texture filter needs it.
+ */
+bool shoot_ray_at_depth(
+	RenderData &data,
+	Ray const& ray,
+	int depth,
+	Intersection* isect);
+
+/*
+ * Trace the primary rays through the pixel centers of the w x h block at
+ * (x0, y0) as one packet, followed by one packet of shadow rays per point
+ * light from the front facing hits. hits must have room for w * h entries,
+ * in row major order. Setting data.packet_hit to the entry of a pixel lets
+ * shoot_ray and visible reuse these results.
+ */
+void trace_primary_packet(
+	RenderData &data,
+	int x0, int y0,
+	int w, int h,
+	PacketHit hits[]);
+
 /*
  *  Loops over all lights and evaluates a simple ambient lighting model
  *
@@ -114,6 +186,85 @@ glm::vec3 evaluate_phong_BRDF(
 	glm::vec3 const& L,			// world space direction to light (already normalized)
 	glm::vec3 const& N,			// normal at the position (already normalized)
 	glm::vec3 const& V);		// view vector (already normalized)
+
+/*
+ * Direction on the hemisphere around N with density cos(theta) / pi, for
+ * a point u of a sample set.
+ */
+glm::vec3 cosine_sample_hemisphere(
+	glm::vec2 const& u,
+	glm::vec3 const& N);
+
+/*
+ * The probability with which sample_phong_BRDF samples the diffuse part,
+ * it samples the specular part otherwise.
+ */
+float diffuse_lobe_probability(
+	RenderData const& data,		// class containing raytracing information
+	MaterialSample const& mat);	// the material at position
+
+/*
+ * Sample a direction L in proportion to the phong BRDF: a cosine-weighted
+ * direction for the diffuse part or a direction around the mirror
+ * direction of V for the specular part, chosen in proportion to their
+ * reflectances. Returns the density of L with respect to solid angle,
+ * 0 if nothing can be sampled.
+ */
+float sample_phong_BRDF(
+	RenderData &data,			// class containing raytracing information
+	MaterialSample const& mat,	// the material at position
+	glm::vec2 const& u,			// point of a sample set
+	glm::vec3 const& N,			// normal at the position (already normalized)
+	glm::vec3 const& V,			// view vector (already normalized)
+	glm::vec3* L);				// sampled direction
+
+/*
+ * The density of sample_phong_BRDF for the direction L.
+ */
+float phong_BRDF_pdf(
+	RenderData &data,			// class containing raytracing information
+	MaterialSample const& mat,	// the material at position
+	glm::vec3 const& L,			// world space direction (already normalized)
+	glm::vec3 const& N,			// normal at the position (already normalized)
+	glm::vec3 const& V);		// view vector (already normalized)
+
+/*
+ * Sample a direction L with density (n + 1) / (2 pi) cos^n around the
+ * mirror direction of V, the specular part of sample_phong_BRDF. Returns
+ * the density of L.
+ */
+float sample_phong_specular_lobe(
+	MaterialSample const& mat,	// the material at position
+	glm::vec2 const& u,			// point of a sample set
+	glm::vec3 const& N,			// normal at the position (already normalized)
+	glm::vec3 const& V,			// view vector (already normalized)
+	glm::vec3* L);				// sampled direction
+
+/*
+ * The density of sample_phong_specular_lobe for the direction L.
+ */
+float phong_specular_lobe_pdf(
+	MaterialSample const& mat,	// the material at position
+	glm::vec3 const& L,			// world space direction (already normalized)
+	glm::vec3 const& N,			// normal at the position (already normalized)
+	glm::vec3 const& V);		// view vector (already normalized)
+
+/*
+ * The diffuse term of evaluate_phong_BRDF.
+ */
+glm::vec3 evaluate_phong_diffuse_BRDF(
+	RenderData const& data,		// class containing raytracing information
+	MaterialSample const& mat,	// the material at position
+	glm::vec3 const& L,			// world space direction to light (already normalized)
+	glm::vec3 const& N);		// normal at the position (already normalized)
+
+/*
+ * Power heuristic weight of n_a samples of density pdf_a, combined with
+ * n_b samples of density pdf_b, see Veach and Guibas, "Optimally
+ * Combining Sampling Techniques for Monte Carlo Rendering", 1995.
+ */
+float power_heuristic(int n_a, float pdf_a, int n_b, float pdf_b);
+
 glm::vec3 evaluate_illumination_from_light(
 	RenderData &data,           // class containing raytracing information
 	MaterialSample const& mat,  // the material at position
@@ -121,6 +272,17 @@ glm::vec3 evaluate_illumination_from_light(
 	glm::vec3 const& LP,        // a point on the light source
 	glm::vec3 const& P,         // world space position
 	glm::vec3 const& N,         // normal at the position (already normalized)
+	glm::vec3 const& V,         // view vector (already normalized)
+	float weight = 1.f);        // the share of the light in the estimate
+/*
+ * Light arriving directly from the light sources, the part of
+ * evaluate_illumination that does not recurse.
+ */
+glm::vec3 evaluate_direct_illumination(
+	RenderData &data,           // class containing raytracing information
+	MaterialSample const& mat,  // the material at position
+	glm::vec3 const& P,         // world space position
+	glm::vec3 const& N,         // normal at the position (already normalized)
 	glm::vec3 const& V);        // view vector (already normalized)
 glm::vec3 evaluate_illumination(
 	RenderData &data,           // class containing raytracing information
@@ -130,11 +292,27 @@ glm::vec3 evaluate_illumination(
 	glm::vec3 const& V,         // view vector (already normalized)
 	int depth);                  // the current recursion depth
 
+/*
+ * Uniform direction on the hemisphere around N, for a point u of a sample
+ * set.
+ */
+glm::vec3 uniform_sample_hemisphere(
+	glm::vec2 const& u,
+	glm::vec3 const& N);
+
 float evaluate_ambient_occlusion(
 	RenderData &data,           // class containing raytracing information
 	glm::vec3 const& P,         // world space position
 	glm::vec3 const& N);        // normal at the position (already normalized)
 
+/*
+ * The visibility an occluder at distance dist leaves for ambient
+ * occlusion, 1 if dist is FLT_MAX.
+ */
+float ambient_occlusion_falloff(
+	RenderData const& data,     // class containing raytracing information
+	float dist);                // distance to the closest occluder
+
 glm::vec3 evaluate_reflection(
 	RenderData &data,			// class containing raytracing information
 	int depth,					// the current recursion depth
@@ -166,6 +344,20 @@ glm::vec3 handle_transmissive_material(
 	glm::vec3 const& V,					// view vector (already normalized)
 	glm::vec3 const& eta_of_channel);	// relative refraction index of red, green and blue color channel
 
+/*
+ * Radiance from the environment map in direction dir, black without one.
+ */
+glm::vec3 env_map_lookup(
+	RenderData &data,
+	glm::vec3 const& dir);
+
+/*
+ * The material of a hit, replaced by white diffuse in diffuse white mode.
+ */
+MaterialSample shading_material(
+	RenderData const& data,
+	Intersection const& isect);
+
 /*
  * Call this function to start recursive ray tracing through a lens
  */
@@ -182,3 +374,59 @@ glm::vec3 trace_recursive(
 	Ray const& ray,
 	int depth);
 
+/*
+ * Trace one path from the camera ray instead of a tree of rays. Every hit
+ * adds its direct light and continues with a single ray: a BRDF sample for
+ * indirect light, the mirror or the refracted direction, chosen at random
+ * in proportion to their weights. Russian roulette ends paths of low
+ * throughput, so the cost is linear in max_depth, and the mean of many
+ * paths converges to the image of trace_recursive.
+ *
+ * At the first dispersive refraction, the path picks one color channel
+ * as its hero wavelength and follows it alone from then on.
+ */
+glm::vec3 trace_path(
+	RenderData & data,
+	Ray const& ray);
+
+/*
+ * One step of trace_path after the hit at P has been shaded: choose the
+ * next ray, multiply *throughput by its weight and play Russian roulette.
+ * *hero is the color channel the path follows, -1 until the first
+ * dispersive refraction. Returns false if the path ends at this hit.
+ */
+bool continue_path(
+	RenderData & data,
+	MaterialSample const& mat,	// the material at position
+	glm::vec3 const& P,			// world space position
+	glm::vec3 const& N,			// normal at the position (already normalized)
+	glm::vec3 const& V,			// view vector (already normalized)
+	bool hit_backside,			// the ray hit the back of the surface
+	int depth,					// the depth of the hit
+	glm::vec3* throughput,
+	int* hero,
+	Ray* ray);
+
+/*
+ * Trace a camera ray with the integrator of the render mode, trace_path
+ * for PATH_TRACE and trace_recursive otherwise, or the shading kernel of
+ * the context if it has one.
+ */
+glm::vec3 trace_camera_ray(
+	RenderData & data,
+	Ray const& ray,
+	int depth);
+
+/*
+ * Sample s of the pixel (x, y), with sample s of the random stream, which
+ * must have begun the pixel. For s below spp, this is the sample that
+ * render_pixel takes: the pixel center at 1 spp, otherwise position s of
+ * generate_pixel_samples. Later samples, as adaptive sampling and
+ * progressive rendering may take, continue the sequence of the sampler,
+ * unstratified for the random sampler.
+ */
+glm::vec3 trace_pixel_sample(
+	RenderData & data,
+	int x, int y,
+	int sample);
+
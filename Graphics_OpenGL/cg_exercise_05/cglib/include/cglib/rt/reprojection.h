@@ -0,0 +1,84 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <vector>
+
+struct RaytracingContext;
+struct RenderData;
+struct ThreadLocalData;
+class RaytracingParameters;
+
+/*
+ * Reuse of the previous frame when only the camera moves.
+ *
+ * Progressive rendering keeps the sum and number of the samples of every
+ * pixel, and where its primary ray hit, see HostRender::launch_progressive.
+ * When the camera moves, every pixel of the new view traces only its
+ * primary ray and projects the hit into the previous view. If the pixels
+ * it lands between saw the same surface, the hit lying in their tangent
+ * planes, the pixel takes over their bilinearly weighted means; otherwise
+ * it was disoccluded or is invalid, and is traced in full. The following
+ * passes add new samples to all pixels, so the reused ones blend into the
+ * new view.
+ *
+ * Shading that depends on the view, such as reflections, lags behind by
+ * the reused samples, so at most REPROJECTION_MAX_HISTORY are taken over.
+ */
+
+const int REPROJECTION_MAX_HISTORY = 8;
+
+struct HistoryPixel
+{
+	glm::vec3 sum      = glm::vec3(0.f);
+	int n              = 0;
+	glm::vec3 position = glm::vec3(0.f); /* of the primary hit, or the ray direction on a miss */
+	glm::vec3 normal   = glm::vec3(0.f); /* geometric normal of the primary hit */
+	bool hit           = false;
+};
+
+/*
+ * The history of all pixels, and the camera they were rendered from.
+ */
+struct FrameHistory
+{
+	int width  = 0;
+	int height = 0;
+	glm::mat4 view = glm::mat4(1.f);
+	glm::vec3 eye  = glm::vec3(0.f);
+	int first_sample = 0; // the sample index of pass 0, continued across reprojections
+	std::vector<HistoryPixel> pixels;
+
+	/*
+	 * Empty history for the current camera of the context.
+	 */
+	void begin(RaytracingContext const& context, int width, int height);
+};
+
+/*
+ * Can the history be reprojected with these parameters? Not with depth of
+ * field, whose primary rays do not start at the camera, nor in stereo.
+ */
+bool reprojection_supported(RaytracingParameters const& params);
+
+/*
+ * Remember where the primary ray of the sample just traced in data went.
+ */
+void record_primary_hit(RenderData& data, HistoryPixel* pixel);
+
+/*
+ * Fill the pixels [x0, x1) x [y0, y1) of current, from previous where it
+ * is valid and with its first sample otherwise. Adds the number of reused
+ * pixels to *num_reused if it is not null. Returns false if terminate was
+ * set before the tile was done.
+ */
+bool reproject_tile(
+	RaytracingContext const& context,
+	ThreadLocalData* tld,
+	FrameHistory const& previous,
+	FrameHistory* current,
+	int x0, int y0,
+	int x1, int y1,
+	std::atomic<bool> const& terminate,
+	int* num_reused = nullptr);
@@ -18,3 +18,38 @@ generate_random_samples(
 		int grid_x,
 		int grid_y,
 		ThreadLocalData *tld);
+
+/*
+ * The subpixel positions of spp samples, from dimension pair 0 of the
+ * sampler of tld. The random sampler stratifies them on the grid of
+ * spp cells that is closest to square if stratified is set.
+ */
+void
+generate_pixel_samples(
+		std::vector<glm::vec2> *generated_samples,
+		int spp,
+		bool stratified,
+		ThreadLocalData *tld);
+
+/*
+ * The same, into spp elements of generated_samples, e.g. from the
+ * scratch memory of tld, without allocating.
+ */
+void
+generate_pixel_samples(
+		glm::vec2 *generated_samples,
+		int spp,
+		bool stratified,
+		ThreadLocalData *tld);
+
+/*
+ * Sample i of generate_pixel_samples for spp samples, on its own, for
+ * renderers that take the samples of a pixel one at a time. Samples from
+ * spp on are not stratified.
+ */
+glm::vec2
+pixel_sample(
+		int i,
+		int spp,
+		bool stratified,
+		ThreadLocalData *tld);
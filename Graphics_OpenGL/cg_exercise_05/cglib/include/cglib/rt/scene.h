@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cglib/rt/texture.h>
+#include <cglib/rt/tlas.h>
 
 #include <vector>
 #include <memory>
@@ -32,12 +33,41 @@ public:
 	std::vector<std::shared_ptr<TriangleSoup>> soups;
 	std::vector<std::unique_ptr<Light>> area_lights;
 
+	/*
+	 * Acceleration structure over objects, rebuilt by update_bvhs.
+	 */
+	TLAS tlas;
+
     virtual ~Scene();
 
 	virtual void init_scene(RaytracingParameters const& params) = 0;
     virtual void refresh_scene(RaytracingParameters const& params) = 0;
 	virtual void init_camera(RaytracingParameters& params) = 0;
 	virtual void set_active_camera();
+
+	// move the objects that animate to time, in seconds, and mark them as
+	// changed; returns whether any moved. Scenes are static by default.
+	virtual bool animate(float /*time*/) { return false; }
+
+	// flatten the materials of the objects and soups, rebuild all BVHs
+	// whose build settings differ from params, update the ones marked as
+	// changed, then rebuild the top-level acceleration structure if the
+	// objects were replaced, or refit it if some changed
+	void update_bvhs(RaytracingParameters const& params);
+
+	// bumped by init_scene and refresh_scene whenever they replace the
+	// objects, so that update_bvhs rebuilds the top-level acceleration
+	// structure; new objects may reuse the addresses of the old ones
+	unsigned generation = 0;
+
+	// mark an object whose vertices or transformation changed since the
+	// last update_bvhs; only marked objects are refit
+	void mark_changed(Object* object);
+
+private:
+	std::vector<Object*> changed_objects;
+	bool tlas_transform_objects = true;
+	unsigned tlas_generation = ~0u;
 };
 
 
@@ -119,5 +149,11 @@ public:
 	void init_scene(RaytracingParameters const& params);
     void refresh_scene(RaytracingParameters const& params);
 	void init_camera(RaytracingParameters& params);
+
+	// every triangle circles in its plane
+	bool animate(float time);
+
+private:
+	std::vector<glm::vec3> rest_vertices;	// vertices before animate
 };
 
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+struct RenderData;
+class Ray;
+class RaytracingParameters;
+
+/*
+ * trace_recursive, specialized for the switches of the renderer.
+ *
+ * trace_recursive and the functions it recurses through are templates on
+ * their switches, ambient occlusion, normal mapping, reflection,
+ * transmission, fresnel and dispersion. The generic trace_recursive reads
+ * them from the parameters on every hit; a kernel is the same code with
+ * the switches fixed at compile time, one for every combination. The
+ * renderer selects the kernel once per frame, see
+ * RaytracingContext::shading_kernel. Illumination is evaluate_illumination
+ * in both, so the kernels compute the same images and cast the same rays.
+ *
+ * The shadows, diffuse and specular switches stay run-time checks. They
+ * are read below evaluate_illumination, by the exercise's light
+ * estimators and evaluate_phong_BRDF, whose signatures the exercise
+ * implements and which are therefore not templates. Each is a branch on a
+ * value that is constant for the frame, which the processor predicts.
+ */
+typedef glm::vec3 (*ShadingKernel)(RenderData& data, Ray const& ray, int depth);
+
+/*
+ * The kernel for params, or nullptr if specialize_shading is off.
+ */
+ShadingKernel select_shading_kernel(RaytracingParameters const& params);
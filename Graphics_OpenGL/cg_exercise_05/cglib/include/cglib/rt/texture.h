@@ -34,6 +34,8 @@ public:
         return glm::vec4(value, 0.0f);
     }
 
+    glm::vec3 const& get_value() const { return value; }
+
 private:
     glm::vec3 value;
 };
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+/*
+ * Cost aware order of the render tiles.
+ *
+ * Every job records how long it took, and the next frame predicts that a
+ * tile costs what it cost in the last frame that finished it. The first
+ * frame, and any frame after the image or tile size changed, renders the
+ * tiles in spiral order. Later frames render the most expensive tiles
+ * first, so that the cheap ones fill the gaps at the end, and split a tile
+ * into quadrants while it is predicted to cost more than a small share of
+ * the frame per thread, so that no thread is left with a large tile while
+ * the others run idle.
+ *
+ * When the last job of a frame finishes, the frame reports its tail
+ * latency with --verbose: the time from when the first thread ran out of jobs to when
+ * the last one finished.
+ */
+class TileScheduler
+{
+public:
+	struct Job
+	{
+		glm::ivec2 begin;
+		glm::ivec2 end;
+		int tile;   /* the index of the tile in the grid the job is part of */
+		float cost; /* predicted, in milliseconds */
+	};
+
+	/*
+	 * Plan the jobs of a new frame. The costs of the jobs of the previous
+	 * one are taken over if it finished them all. Tiles are ordered by
+	 * cost and split only if cost_aware is set, and the costs of the
+	 * previous frame are known; otherwise they come in order of tile_idx.
+	 * The frame is logged only if verbose is set, see Parameters::verbose.
+	 * Jobs must not be running.
+	 */
+	void plan(int width, int height, int tile_size,
+	          std::vector<glm::ivec2> const& tile_idx,
+	          int num_threads, bool cost_aware, bool split,
+	          bool verbose = false);
+
+	int num_jobs() const { return int(m_jobs.size()); }
+	Job const& job(int i) const { return m_jobs[i]; }
+
+	/*
+	 * Start the clock of job i, on the thread that runs it.
+	 */
+	void begin_job(int i);
+
+	/*
+	 * Stop the clock of job i, which worker rendered in full with
+	 * num_allocations heap allocations, see allocation_counter.h. Jobs that
+	 * were terminated are not recorded. Logs the tail latency, and the
+	 * allocations if they are counted, once all jobs of the frame are
+	 * recorded, if the frame was planned verbose.
+	 */
+	void end_job(int i, void const* worker, int num_allocations = 0);
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Record
+	{
+		Clock::time_point begin;
+		Clock::time_point end;
+		void const* worker = nullptr;
+		int num_allocations = 0;
+		bool done = false;
+	};
+
+	void report() const;
+
+	int m_width       = 0;
+	int m_height      = 0;
+	int m_tile_size   = 0;
+	int m_num_threads = 1;
+	int m_num_split   = 0;
+	bool m_verbose    = false;
+	std::vector<float> m_tile_cost; /* per tile, negative if unknown */
+	std::vector<Job> m_jobs;
+	std::vector<Record> m_records;
+	std::atomic<int> m_num_done{0};
+};
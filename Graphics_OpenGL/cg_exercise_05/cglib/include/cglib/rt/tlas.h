@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cglib/rt/aabb.h>
+
+#include <memory>
+#include <vector>
+
+class Object;
+struct HitRecord;
+
+/*
+ * Top-level acceleration structure.
+ *
+ * A BVH over the world space bounds of the objects of a scene. The
+ * objects themselves (spheres, quads, instances and the BVHs of triangle
+ * meshes) form the bottom level. Objects without finite bounds, such as
+ * planes, cannot be put into the tree and are tested for every ray.
+ */
+class TLAS
+{
+public:
+	/*
+	 * Median splits stop at this many objects per leaf.
+	 */
+	enum { MAX_OBJECTS_IN_LEAF = 2 };
+
+	/*
+	 * Nodes are stored in depth-first order: the left child of an inner
+	 * node directly follows its parent and offset is the index of the
+	 * right child. For leaves, offset is the first entry in object_indices.
+	 */
+	struct Node {
+		AABB aabb;
+		int offset;
+		int num_objects; /* 0 for inner nodes */
+		int axis;        /* split axis of inner nodes */
+	};
+
+	/*
+	 * The scene objects, in scene order. Not owned by the TLAS.
+	 */
+	std::vector<Object*> objects;
+
+	std::vector<Node> nodes;
+	std::vector<int> object_indices;
+
+	/*
+	 * Indices of objects that are not part of the tree.
+	 */
+	std::vector<int> unbounded;
+
+	/*
+	 * Rebuild over the given objects. Must be called again whenever
+	 * objects are added, removed or moved.
+	 */
+	void build(std::vector<std::unique_ptr<Object>> const& objects_);
+
+	/*
+	 * Was the tree built over exactly these objects?
+	 */
+	bool is_built_for(std::vector<std::unique_ptr<Object>> const& objects_) const;
+
+	/*
+	 * Recompute the node bounds bottom-up after objects moved or deformed,
+	 * keeping the tree topology. Objects that had no or empty bounds when
+	 * the tree was built stay out of it, and objects that report no bounds
+	 * now add none.
+	 */
+	void refit();
+
+	/*
+	 * Find the closest hit with any object that is closer than hit->t.
+	 * Objects are queried only for hits in front of the closest one found
+	 * so far. hit->object is set to the object that was hit.
+	 */
+	bool intersect(Ray const& ray, HitRecord* hit) const;
+
+	/*
+	 * Is there any intersection closer than max_t? Uses the any-hit
+	 * query of the objects and stops at the first one found.
+	 */
+	bool occluded(Ray const& ray, float max_t) const;
+
+private:
+	void build_recursive(std::vector<AABB> const& bounds, std::vector<glm::vec3> const& centroids,
+		int first, int num);
+};
@@ -4,6 +4,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/transform.hpp>
 
+#include <cglib/rt/aabb.h>
 #include <cglib/rt/raytracing_context.h>
 #include <cglib/rt/intersection.h>
 #include <cglib/rt/ray.h>
@@ -22,6 +23,52 @@ inline Ray transform_ray(Ray const& ray, glm::mat4 const& transform)
 	return ray;
 }
 
+/*
+ * Distances along ray correspond to distances along
+ * transform_ray(ray, transform) multiplied by this factor.
+ */
+inline float transform_ray_scale(Ray const& ray, glm::mat4 const& transform)
+{
+	if (RaytracingContext::get_active()->params.transform_objects) {
+		return glm::length(glm::vec3(transform*glm::vec4(ray.direction, 0.f)));
+	}
+	return 1.f;
+}
+
+/*
+ * Map the distance range [t_min, t_max) along ray to the range along
+ * transform_ray(ray, transform) and return the scale factor used. The
+ * result is slightly widened to account for rounding, so callers must
+ * check the world space distances against the original range again.
+ */
+inline float transform_ray_range(Ray const& ray, glm::mat4 const& transform,
+	float t_min, float t_max, float* t_min_local, float* t_max_local)
+{
+	const float scale = transform_ray_scale(ray, transform);
+	*t_min_local = t_min * scale * (1.f - 1e-5f);
+	*t_max_local = t_max * scale * (1.f + 1e-5f);
+	return scale;
+}
+
+/*
+ * Bounds of the transformed box, built from its eight transformed corners.
+ */
+inline AABB transform_aabb(AABB const& aabb, glm::mat4 const& transform)
+{
+	if (RaytracingContext::get_active()->params.transform_objects) {
+		AABB aabb_t;
+		for (int i = 0; i < 8; ++i) {
+			const glm::vec3 corner(
+				(i & 1) ? aabb.max.x : aabb.min.x,
+				(i & 2) ? aabb.max.y : aabb.min.y,
+				(i & 4) ? aabb.max.z : aabb.min.z);
+			aabb_t.extend(transform_position(transform, corner));
+		}
+		return aabb_t;
+	}
+	return aabb;
+}
+
 inline Intersection transform_intersection(Intersection const& isect, glm::mat4 const& transform, glm::mat4 const& transform_normal)
 {
 	if (RaytracingContext::get_active()->params.transform_objects) {
@@ -9,6 +9,7 @@
 #include <memory>
 
 class Material;
+class FlatMaterial;
 class Intersection;
 class ImageTexture;
 
@@ -19,6 +20,7 @@ public:
 	std::vector<glm::vec2> tex_coordinates;
     std::vector<int> material_ids;
     std::vector<Material> materials;
+    std::vector<FlatMaterial> flat_materials; // materials, as the BVH evaluates them
 	int num_triangles = 0;
 
 	TriangleSoup();
@@ -32,5 +34,10 @@ public:
 	TriangleSoup(const std::string &obj_path, TextureContainer *textures);
 
     void fill_intersection(Intersection* isect, int triangle_id, float min_dist, glm::vec3 const& bary) const;
+
+	/*
+	 * Rebuild flat_materials from materials.
+	 */
+	void update_materials();
 };
 
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+
+struct RaytracingContext;
+struct ThreadLocalData;
+class RaytracingParameters;
+
+/*
+ * Wavefront rendering of image tiles.
+ *
+ * Instead of following each pixel through the deep call stack of
+ * trace_recursive, a tile keeps all its paths in queues and runs them
+ * through one stage at a time:
+ *
+ *   generate  camera rays for all pixel samples of the tile
+ *   extend    find the closest hit of every ray in the queue
+ *   shade     evaluate the materials, queue shadow and occlusion rays
+ *             and the next ray of every path that continues
+ *   connect   trace the shadow and occlusion rays, add what they see
+ *
+ * Extend works on a queue sorted by ray direction, so that neighboring
+ * rays traverse the same BVH nodes, and shade works on a queue sorted by
+ * the object that was hit, so that it runs the code and touches the
+ * textures of one material at a time. Connect keeps the order in which
+ * the rays were queued: the rays of one hit point share their origin,
+ * which makes them more coherent than any order by direction.
+ *
+ * The integrator is trace_path's: the same camera rays, the same direct
+ * light and ambient occlusion estimators, which hand their visibility
+ * rays to the connect stage through RenderData::deferred_rays, and the
+ * same continuation rays, taken from the same random streams, so the
+ * result equals the path tracing render mode up to the order in which
+ * contributions are summed.
+ *
+ * The queues live in the thread's scratch arena. Connect runs whenever
+ * its queue is full, so its memory does not grow with the number of
+ * lights and rays per hit.
+ */
+
+/*
+ * Can these parameters be rendered in wavefront order? The path tracing
+ * mode can, and the recursive mode only if no ray branches into
+ * secondary rays, i.e. with max_depth 0 or without reflection,
+ * transmission and indirect light, as trace_path would otherwise follow
+ * one random branch where trace_recursive follows all. Other render
+ * modes, stereo and depth of field need the per-pixel renderer.
+ */
+bool wavefront_supported(RaytracingParameters const& params);
+
+/*
+ * Render the pixels [x0, x1) x [y0, y1) into color, row by row. Returns
+ * false if terminate was set before the tile was done. Adds the number
+ * of rays cast to *num_rays if it is not null.
+ */
+bool render_tile_wavefront(
+	RaytracingContext const& context,
+	ThreadLocalData* tld,
+	int x0, int y0,
+	int x1, int y1,
+	glm::vec3* color,
+	std::atomic<bool> const& terminate,
+	long long* num_rays = nullptr);
@@ -0,0 +1,65 @@
+#include <cglib/core/allocation_counter.h>
+
+#include <cstdlib>
+#include <new>
+
+#if defined(CGLIB_COUNT_ALLOCATIONS)
+
+namespace {
+
+thread_local long long num_thread_allocations = 0;
+
+}
+
+/*
+ * The array and nothrow forms of the standard library call these two.
+ */
+void*
+operator new(std::size_t size)
+{
+	num_thread_allocations++;
+	if (size == 0)
+		size = 1;
+	for (;;) {
+		if (void* p = std::malloc(size))
+			return p;
+		std::new_handler handler = std::get_new_handler();
+		if (!handler)
+			throw std::bad_alloc();
+		handler();
+	}
+}
+
+void
+operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+bool
+counting_allocations()
+{
+	return true;
+}
+
+long long
+thread_allocations()
+{
+	return num_thread_allocations;
+}
+
+#else
+
+bool
+counting_allocations()
+{
+	return false;
+}
+
+long long
+thread_allocations()
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,34 @@
+#include <cglib/core/cpu_features.h>
+
+#if CG_HAVE_SSE2 && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+static CPUFeatures
+detect_cpu_features()
+{
+	CPUFeatures features;
+#if CG_HAVE_SSE2
+	features.sse2 = true;
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	const bool osxsave = (info[2] & (1 << 27)) != 0;
+	const bool avx     = (info[2] & (1 << 28)) != 0;
+	/* the OS must also save the ymm registers on context switches */
+	features.avx = osxsave && avx && (_xgetbv(0) & 0x6) == 0x6;
+#elif defined(__GNUC__)
+	__builtin_cpu_init();
+	features.avx = __builtin_cpu_supports("avx") != 0;
+#endif
+#endif
+	return features;
+}
+
+CPUFeatures const&
+cpu_features()
+{
+	static const CPUFeatures features = detect_cpu_features();
+	return features;
+}
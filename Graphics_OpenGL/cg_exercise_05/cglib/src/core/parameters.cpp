@@ -33,10 +33,14 @@ bool Parameters::parse_command_line(int argc, char const** argv)
 				<< "Usage: " << argv[0] << " [OPTION]...\n"
 				<< "\n"
 				<< "--create-images      Create assignment images.\n"
+				<< "--verbose            Print statistics of acceleration structures and frames.\n"
 				<< "--noninteractive     Do not start in GUI mode.\n"
 				<< "--stereo             Render in stereo mode.\n"
 				<< "--eye-separation SEP Eye separation.\n"
 				<< "--output FILE        The output file name when rendering in noninteractive mode.\n"
+				<< "--aovs LIST          Also save these output variables next to the output file, LIST is\n"
+				<< "                     a comma separated subset of: normal, depth, albedo, dudv, num_rays, time.\n"
+				<< "--benchmark NAME     Run a benchmark instead of rendering, NAME is one of: threadpool, convergence, wavefront.\n"
 				<< "--width  N           The output image width.\n"
 				<< "--height N           The output image height.\n"
 				<< "--num-threads N      The number of threads to be used for rendering. Minimum 1.\n"
@@ -60,6 +64,10 @@ bool Parameters::parse_command_line(int argc, char const** argv)
 		{
 			create_images = true;
 		}
+		else if (arg == "--verbose")
+		{
+			verbose = true;
+		}
 
 		else
 		{
@@ -79,6 +87,16 @@ bool Parameters::parse_command_line(int argc, char const** argv)
 				is >> output_file_name;
 			}
 
+			else if (arg == "--benchmark")
+			{
+				success = bool(is >> benchmark);
+			}
+
+			else if (arg == "--aovs")
+			{
+				success = bool(is >> aovs);
+			}
+
 
 			else if (arg == "--width")
 			{
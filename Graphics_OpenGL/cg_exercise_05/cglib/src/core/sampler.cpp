@@ -0,0 +1,314 @@
+#include <cglib/core/sampler.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+/*
+ * Seeds of a dimension pair are hashed with the top bit of the dimension
+ * set, so that they never coincide with the blocks of RandomStream::next().
+ */
+const std::uint32_t PAIR_DOMAIN = 0x80000000u;
+
+const float ONE_MINUS_EPSILON = 0.99999994f;
+
+inline std::uint32_t
+reverse_bits(std::uint32_t x)
+{
+	x = (x << 16) | (x >> 16);
+	x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+	x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+	x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+	x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+	return x;
+}
+
+/*
+ * Every output bit depends only on the same and lower input bits, see
+ * Burley, "Practical Hash-based Owen Scrambling", JCGT 2020.
+ */
+inline std::uint32_t
+laine_karras_permutation(std::uint32_t x, std::uint32_t seed)
+{
+	x ^= x * 0x3d20adeau;
+	x += seed;
+	x *= (seed >> 16) | 1u;
+	x ^= x * 0x05526c56u;
+	x ^= x * 0x53a22864u;
+	return x;
+}
+
+/*
+ * Owen scrambling of a 0.32 fixed point number: every digit is flipped
+ * depending on the digits before it.
+ */
+inline std::uint32_t
+nested_uniform_scramble(std::uint32_t x, std::uint32_t seed)
+{
+	return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+}
+
+inline std::uint32_t
+mix(std::uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+/*
+ * The second dimension of the Sobol sequence, whose generator matrix is
+ * the upper triangular Pascal matrix mod 2.
+ */
+inline std::uint32_t
+sobol_1(std::uint32_t index)
+{
+	std::uint32_t result = 0;
+	for (std::uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+		if (index & 1u)
+			result ^= v;
+	return result;
+}
+
+/*
+ * Point index of the first two Sobol dimensions. The index is shuffled
+ * first: the shuffle maps aligned blocks of 2^k indices to aligned blocks,
+ * so every such block of a pair still forms a (0,k,2)-net.
+ */
+inline glm::vec2
+owen_scrambled_sobol(std::uint32_t index, std::uint32_t const seeds[4])
+{
+	index = nested_uniform_scramble(index, seeds[0]);
+	const std::uint32_t x = nested_uniform_scramble(reverse_bits(index), seeds[1]);
+	const std::uint32_t y = nested_uniform_scramble(sobol_1(index), seeds[2]);
+	return glm::vec2(RandomStream::to_float(x), RandomStream::to_float(y));
+}
+
+/*
+ * Radical inverse in the given base with nested random digit shifts: the
+ * shift of a digit is a hash of the seed and all digits before it.
+ */
+inline float
+owen_scrambled_radical_inverse(std::uint32_t base, std::uint32_t index, std::uint32_t seed)
+{
+	if (base == 2)
+		return RandomStream::to_float(nested_uniform_scramble(reverse_bits(index), seed));
+
+	const float inv_base = 1.f / float(base);
+	float weight = inv_base;
+	float result = 0.f;
+	std::uint32_t state = mix(seed);
+	/* stop below the float precision of the result */
+	while (weight > 6e-8f) {
+		const std::uint32_t digit = index % base;
+		index /= base;
+		result += float((digit + state % base) % base) * weight;
+		state = mix(state ^ ((digit + 1u) * 0x9e3779b9u));
+		weight *= inv_base;
+	}
+	return std::min(result, ONE_MINUS_EPSILON);
+}
+
+/*
+ * Ranks of a void-and-cluster blue-noise mask, see Ulichney, "The
+ * void-and-cluster method for dither array generation", 1993. With a
+ * shift-invariant filter, the tightest cluster of the minority zeros is
+ * the largest void of the ones, so a single energy serves all phases.
+ */
+std::vector<float>
+make_blue_noise_mask(int size)
+{
+	const int n = size * size;
+	const float sigma = 1.5f;
+
+	std::vector<float> filter(n);
+	for (int y = 0; y < size; ++y) {
+		for (int x = 0; x < size; ++x) {
+			const float dx = float(std::min(x, size - x));
+			const float dy = float(std::min(y, size - y));
+			filter[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.f * sigma * sigma));
+		}
+	}
+
+	std::vector<char>  bits(n, 0);
+	std::vector<float> energy(n, 0.f);
+	auto splat = [&](std::vector<float>& e, int p, float sign) {
+		const int px = p % size;
+		const int py = p / size;
+		for (int y = 0; y < size; ++y) {
+			const float* row = &filter[((y - py + size) % size) * size];
+			for (int x = 0; x < size; ++x)
+				e[y * size + x] += sign * row[(x - px + size) % size];
+		}
+	};
+	auto find = [&](std::vector<char> const& b, std::vector<float> const& e, char bit, bool largest) {
+		int best = -1;
+		for (int p = 0; p < n; ++p) {
+			if (b[p] != bit)
+				continue;
+			if (best < 0 || (largest ? e[p] > e[best] : e[p] < e[best]))
+				best = p;
+		}
+		return best;
+	};
+
+	/* random initial pattern with a tenth of the pixels set */
+	int num_ones = 0;
+	for (std::uint32_t i = 0; num_ones < n / 10; ++i) {
+		const int p = int(mix(i) % std::uint32_t(n));
+		if (bits[p])
+			continue;
+		bits[p] = 1;
+		splat(energy, p, 1.f);
+		++num_ones;
+	}
+
+	/* move points from the tightest clusters into the largest voids */
+	for (int i = 0; i < n; ++i) {
+		const int cluster = find(bits, energy, 1, true);
+		bits[cluster] = 0;
+		splat(energy, cluster, -1.f);
+		const int void_ = find(bits, energy, 0, false);
+		bits[void_] = 1;
+		splat(energy, void_, 1.f);
+		if (void_ == cluster)
+			break;
+	}
+
+	std::vector<int> rank(n, 0);
+	{
+		std::vector<char>  b = bits;
+		std::vector<float> e = energy;
+		for (int r = num_ones - 1; r >= 0; --r) {
+			const int cluster = find(b, e, 1, true);
+			b[cluster] = 0;
+			splat(e, cluster, -1.f);
+			rank[cluster] = r;
+		}
+	}
+	for (int r = num_ones; r < n; ++r) {
+		const int void_ = find(bits, energy, 0, false);
+		bits[void_] = 1;
+		splat(energy, void_, 1.f);
+		rank[void_] = r;
+	}
+
+	std::vector<float> mask(n);
+	for (int p = 0; p < n; ++p)
+		mask[p] = (float(rank[p]) + 0.5f) / float(n);
+	return mask;
+}
+
+class RandomSampler : public Sampler
+{
+public:
+	Type type() const override { return RANDOM; }
+
+	glm::vec2 get_2d(RandomStream const& stream, std::uint32_t dimension, std::uint32_t index) const override
+	{
+		std::uint32_t v[4];
+		RandomStream::hash(stream.pixel_x(), stream.pixel_y(), index ^ stream.seed(), dimension | PAIR_DOMAIN, v);
+		return glm::vec2(RandomStream::to_float(v[0]), RandomStream::to_float(v[1]));
+	}
+};
+
+class HaltonSampler : public Sampler
+{
+public:
+	Type type() const override { return HALTON; }
+
+	glm::vec2 get_2d(RandomStream const& stream, std::uint32_t dimension, std::uint32_t index) const override
+	{
+		/* pairs beyond the table reuse its primes with new seeds */
+		static const std::uint32_t primes[] = {
+			  2,   3,   5,   7,  11,  13,  17,  19,  23,  29,  31,  37,  41,  43,  47,  53,
+			 59,  61,  67,  71,  73,  79,  83,  89,  97, 101, 103, 107, 109, 113, 127, 131,
+		};
+		const std::uint32_t num_primes = sizeof(primes) / sizeof(primes[0]);
+		const std::uint32_t pair = (dimension / 2) % (num_primes / 2);
+
+		std::uint32_t seeds[4];
+		RandomStream::hash(stream.pixel_x(), stream.pixel_y(), stream.seed(), dimension | PAIR_DOMAIN, seeds);
+		return glm::vec2(
+			owen_scrambled_radical_inverse(primes[2 * pair + 0], index, seeds[0]),
+			owen_scrambled_radical_inverse(primes[2 * pair + 1], index, seeds[1]));
+	}
+};
+
+class SobolSampler : public Sampler
+{
+public:
+	Type type() const override { return SOBOL; }
+
+	glm::vec2 get_2d(RandomStream const& stream, std::uint32_t dimension, std::uint32_t index) const override
+	{
+		std::uint32_t seeds[4];
+		RandomStream::hash(stream.pixel_x(), stream.pixel_y(), stream.seed(), dimension | PAIR_DOMAIN, seeds);
+		return owen_scrambled_sobol(index, seeds);
+	}
+};
+
+/*
+ * All pixels share the points of a pair, shifted toroidally by the values
+ * of a blue-noise mask at the pixel. The error then varies between
+ * neighboring pixels like blue noise, which looks less noisy than white
+ * noise at the same sample count; see Georgiev and Fajardo, "Blue-noise
+ * Dithered Sampling", SIGGRAPH 2016 Talks.
+ */
+class BlueNoiseSampler : public Sampler
+{
+public:
+	enum { MASK_SIZE = 64 };
+
+	BlueNoiseSampler() : m_mask(make_blue_noise_mask(MASK_SIZE)) {}
+
+	Type type() const override { return BLUE_NOISE; }
+
+	glm::vec2 get_2d(RandomStream const& stream, std::uint32_t dimension, std::uint32_t index) const override
+	{
+		std::uint32_t seeds[4];
+		RandomStream::hash(0, 0, stream.seed(), dimension | PAIR_DOMAIN, seeds);
+		const glm::vec2 p = owen_scrambled_sobol(index, seeds);
+
+		/* every pair reads the mask at another offset, and the second
+		 * coordinate half a mask away from the first */
+		const std::uint32_t m = MASK_SIZE - 1;
+		const std::uint32_t x = stream.pixel_x() + seeds[3];
+		const std::uint32_t y = stream.pixel_y() + (seeds[3] >> 16);
+		const glm::vec2 shift(
+			m_mask[(y & m) * MASK_SIZE + (x & m)],
+			m_mask[((y + MASK_SIZE / 2 + 5) & m) * MASK_SIZE + ((x + MASK_SIZE / 2) & m)]);
+
+		glm::vec2 result = p + shift;
+		result -= glm::floor(result);
+		return glm::min(result, glm::vec2(ONE_MINUS_EPSILON));
+	}
+
+private:
+	std::vector<float> m_mask;
+};
+
+}
+
+Sampler const&
+Sampler::get(Type type)
+{
+	static const RandomSampler random;
+	static const HaltonSampler halton;
+	static const SobolSampler sobol;
+	switch (type) {
+	case HALTON:     return halton;
+	case SOBOL:      return sobol;
+	case BLUE_NOISE: {
+		/* the mask takes a moment to build, so only when it is used */
+		static const BlueNoiseSampler blue_noise;
+		return blue_noise;
+	}
+	default:         return random;
+	}
+}
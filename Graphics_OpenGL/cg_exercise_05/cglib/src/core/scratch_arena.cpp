@@ -0,0 +1,73 @@
+#include <cglib/core/scratch_arena.h>
+
+#include <cglib/core/assert.h>
+
+#include <algorithm>
+
+namespace {
+
+/* the size of the first block, in bytes */
+const std::size_t MIN_BLOCK_SIZE = 4096;
+
+inline std::size_t
+align_up(std::size_t offset, std::size_t alignment)
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+}
+
+void
+ScratchArena::release(Mark const& mark)
+{
+	cg_assert(mark.block < m_block || (mark.block == m_block && mark.offset <= m_offset));
+	m_block  = mark.block;
+	m_offset = mark.offset;
+}
+
+void
+ScratchArena::reset()
+{
+	if (m_blocks.size() > 1)
+	{
+		std::size_t size = 0;
+		for (Block const& b : m_blocks)
+			size += b.size;
+		m_blocks.clear();
+		m_blocks.push_back(Block{ std::unique_ptr<unsigned char[]>(new unsigned char[size]), size });
+	}
+	m_block  = 0;
+	m_offset = 0;
+}
+
+void*
+ScratchArena::allocate_bytes(std::size_t size, std::size_t alignment)
+{
+	/* blocks come from new[], which is aligned for every fundamental type */
+	cg_assert(alignment <= alignof(std::max_align_t));
+
+	if (!m_blocks.empty())
+	{
+		const std::size_t offset = align_up(m_offset, alignment);
+		if (offset + size <= m_blocks[m_block].size)
+		{
+			m_offset = offset + size;
+			return m_blocks[m_block].data.get() + offset;
+		}
+	}
+
+	/* the next block that is large enough, or a new one */
+	std::size_t block = m_blocks.empty() ? 0 : m_block + 1;
+	while (block < m_blocks.size() && m_blocks[block].size < size)
+		block++;
+	if (block == m_blocks.size())
+	{
+		const std::size_t last = m_blocks.empty() ? 0 : m_blocks.back().size;
+		const std::size_t block_size = std::max(std::max(size, 2 * last), MIN_BLOCK_SIZE);
+		m_blocks.push_back(Block{ std::unique_ptr<unsigned char[]>(new unsigned char[block_size]), block_size });
+	}
+
+	m_block  = block;
+	m_offset = size;
+	return m_blocks[block].data.get();
+}
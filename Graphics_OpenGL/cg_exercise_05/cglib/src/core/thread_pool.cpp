@@ -2,11 +2,157 @@
 #include <cglib/core/timer.h>
 
 #include <cglib/core/assert.h>
+#include <chrono>
 #include <iostream>
 #include <sstream>
 
+namespace {
+
+// The pool and index of the worker running on this thread, if any.
+thread_local ThreadPool const* tl_pool = nullptr;
+thread_local int tl_worker = -1;
+
+}
+
+// -----------------------------------------------------------------------------
+
+ThreadPool::TaskGroup::TaskGroup(ThreadPool& pool) :
+	m_pool(pool), m_outstanding(0), m_cancelled(false), m_complete(true)
+{
+}
+
+// -----------------------------------------------------------------------------
+
+ThreadPool::TaskGroup::~TaskGroup()
+{
+	wait_for_tasks();
+}
+
+// -----------------------------------------------------------------------------
+
+void ThreadPool::TaskGroup::run(std::function<void()> task)
+{
+	run_jobs(1, [task](int, int) { task(); });
+}
+
+// -----------------------------------------------------------------------------
+
+void ThreadPool::TaskGroup::run_jobs(int num_jobs, std::function<void(int, int)> kernel)
+{
+	cg_assert(num_jobs >= 0);
+	if (num_jobs == 0 || m_cancelled.load())
+	{
+		return;
+	}
+
+	Job* job;
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		m_jobs.push_back(Job());
+		job = &m_jobs.back();
+		job->kernel = std::move(kernel);
+		m_outstanding += num_jobs;
+		m_complete = false;
+	}
+
+	// Nested work goes to the deque of the current worker, from where
+	// idle workers steal it. Otherwise, deal the jobs out round robin.
+	int const self        = current_worker(&m_pool);
+	int const num_workers = m_pool.num_threads();
+	if (self >= 0 || num_workers == 1)
+	{
+		m_pool.push(std::max(self, 0), Range{ this, job, 0, num_jobs, 1 });
+	}
+	else
+	{
+		for (int i = 0; i < std::min(num_workers, num_jobs); ++i)
+		{
+			m_pool.push(i, Range{ this, job, i, num_jobs, num_workers });
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+void ThreadPool::TaskGroup::finish(int num_jobs)
+{
+	if (m_outstanding.fetch_sub(num_jobs) == num_jobs)
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		if (m_outstanding.load() == 0)
+		{
+			m_complete = true;
+			m_finished.notify_all();
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+void ThreadPool::TaskGroup::wait_for_tasks()
+{
+	int const self = current_worker(&m_pool);
+	if (self < 0)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_finished.wait(lock, [this]() { return m_complete; });
+		return;
+	}
+
+	// On a worker, the tasks may be queued behind the one that waits,
+	// so keep running tasks instead of blocking the thread.
+	while (true)
+	{
+		{
+			std::lock_guard<std::mutex> guard(m_mutex);
+			if (m_complete)
+			{
+				return;
+			}
+		}
+
+		Range job;
+		if (m_pool.pop(self, &job) || m_pool.steal(self, &job))
+		{
+			m_pool.execute(self, job);
+		}
+		else
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_finished.wait_for(lock, std::chrono::microseconds(100), [this]() { return m_complete; });
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+void ThreadPool::TaskGroup::wait()
+{
+	wait_for_tasks();
+
+	std::exception_ptr exception;
+	{
+		std::lock_guard<std::mutex> guard(m_mutex);
+		std::swap(exception, m_exception);
+	}
+	if (exception)
+	{
+		std::rethrow_exception(exception);
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+void ThreadPool::TaskGroup::cancel()
+{
+	m_cancelled.store(true);
+	m_pool.discard(this);
+}
+
+// -----------------------------------------------------------------------------
+
 ThreadPool::ThreadPool(unsigned max_threads) :
-	m_numJobs(0), m_hasException(false)
+	m_queued(0), m_shutdown(false), m_numJobs(0), m_jobsDone(0), m_hasException(false)
 {
 	using std::cout;
 	using std::endl;
@@ -15,11 +161,20 @@ ThreadPool::ThreadPool(unsigned max_threads) :
 	{
 		max_threads = std::thread::hardware_concurrency();
 	}
+	max_threads = std::max(max_threads, 1u);
 
 	cout << "[ThreadPool] " << "Using " << max_threads << " worker threads" << endl;
-	m_threads.resize(max_threads);
-	m_tld.resize(max_threads);
-	m_terminate.store(true);
+	m_workers.resize(max_threads);
+	for (auto& w : m_workers)
+	{
+		w.reset(new Worker());
+	}
+
+	// Workers are started once and live as long as the pool.
+	for (int i = 0; i < static_cast<int>(m_workers.size()); ++i)
+	{
+		m_workers[i]->thread = std::thread(&ThreadPool::worker_main, this, i);
+	}
 }
 
 // -----------------------------------------------------------------------------
@@ -27,12 +182,201 @@ ThreadPool::ThreadPool(unsigned max_threads) :
 ThreadPool::~ThreadPool()
 {
 	terminate();
+
+	{
+		std::lock_guard<std::mutex> guard(m_sleepMutex);
+		m_shutdown = true;
+	}
+	m_wake.notify_all();
+
+	for (auto& w : m_workers)
+	{
+		if (w->thread.joinable())
+		{
+			w->thread.join();
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+int ThreadPool::current_worker(ThreadPool const* pool)
+{
+	return (tl_pool == pool) ? tl_worker : -1;
+}
+
+// -----------------------------------------------------------------------------
+
+void ThreadPool::worker_main(int worker)
+{
+	tl_pool   = this;
+	tl_worker = worker;
+
+	while (true)
+	{
+		Range job;
+		if (pop(worker, &job) || steal(worker, &job))
+		{
+			execute(worker, job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		m_wake.wait(lock, [this]() { return m_shutdown || m_queued.load() > 0; });
+		if (m_shutdown)
+		{
+			return;
+		}
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+void ThreadPool::push(int worker, Range const& range)
+{
+	{
+		Worker& w = *m_workers[worker];
+		std::lock_guard<std::mutex> guard(w.mutex);
+		w.queue.push_back(range);
+		++m_queued;
+	}
+
+	// Taking the lock orders this with the predicate check of sleeping workers.
+	{
+		std::lock_guard<std::mutex> guard(m_sleepMutex);
+	}
+	m_wake.notify_all();
+}
+
+// -----------------------------------------------------------------------------
+
+bool ThreadPool::pop(int worker, Range* job)
+{
+	Worker& w = *m_workers[worker];
+	std::lock_guard<std::mutex> guard(w.mutex);
+	if (w.queue.empty())
+	{
+		return false;
+	}
+
+	// The owner takes the lowest job of its oldest range.
+	Range& r = w.queue.front();
+	*job = r;
+	job->end = r.begin + 1;
+	r.begin += r.stride;
+	if (r.begin >= r.end)
+	{
+		w.queue.pop_front();
+		--m_queued;
+	}
+	return true;
+}
+
+// -----------------------------------------------------------------------------
+
+bool ThreadPool::steal(int worker, Range* job)
+{
+	int const num_workers = num_threads();
+	for (int i = 1; i < num_workers; ++i)
+	{
+		Range stolen;
+		{
+			Worker& victim = *m_workers[(worker + i) % num_workers];
+			std::lock_guard<std::mutex> guard(victim.mutex);
+			if (victim.queue.empty())
+			{
+				continue;
+			}
+
+			// Thieves take the upper half of the newest range, so the
+			// victim keeps the jobs it would run next.
+			Range& r = victim.queue.back();
+			int const n = r.size();
+			if (n == 1)
+			{
+				stolen = r;
+				victim.queue.pop_back();
+				--m_queued;
+			}
+			else
+			{
+				int const keep = (n + 1) / 2;
+				stolen = r;
+				stolen.begin = r.begin + keep * r.stride;
+				r.end = stolen.begin;
+			}
+		}
+
+		*job = stolen;
+		job->end = stolen.begin + 1;
+		stolen.begin += stolen.stride;
+		if (stolen.begin < stolen.end)
+		{
+			push(worker, stolen);
+		}
+		return true;
+	}
+	return false;
+}
+
+// -----------------------------------------------------------------------------
+
+void ThreadPool::execute(int worker, Range const& job)
+{
+	TaskGroup* group = job.group;
+	if (!group->cancelled())
+	{
+		try
+		{
+			job.job->kernel(job.begin, worker);
+		}
+		catch (...)
+		{
+			{
+				std::lock_guard<std::mutex> guard(group->m_mutex);
+				if (!group->m_exception)
+				{
+					group->m_exception = std::current_exception();
+				}
+			}
+			group->cancel();
+		}
+	}
+	group->finish(1);
+}
+
+// -----------------------------------------------------------------------------
+
+void ThreadPool::discard(TaskGroup* group)
+{
+	int num_discarded = 0;
+	for (auto& w : m_workers)
+	{
+		std::lock_guard<std::mutex> guard(w->mutex);
+		for (auto it = w->queue.begin(); it != w->queue.end(); )
+		{
+			if (it->group == group)
+			{
+				num_discarded += it->size();
+				it = w->queue.erase(it);
+				--m_queued;
+			}
+			else
+			{
+				++it;
+			}
+		}
+	}
+	if (num_discarded > 0)
+	{
+		group->finish(num_discarded);
+	}
 }
 
 // -----------------------------------------------------------------------------
 
 void ThreadPool::run_internal(
-	int num_jobs, 
+	int num_jobs,
 	std::function<void(int, ThreadLocalData* tld, std::atomic<bool>&)> kernel,
 	std::function<void(int, std::unique_ptr<ThreadLocalData>& tld)> tldAlloc
 )
@@ -41,80 +385,79 @@ void ThreadPool::run_internal(
 	terminate();
 
 	// Set up data for jobs.
-	m_currentJob.store(0);
-	m_kernel = kernel;
 	m_numJobs.store(num_jobs);
 	m_jobsDone.store(0);
-	m_terminate.store(false);
 	m_hasException.store(false);
 	m_exceptionMsg.clear();
 
-	for (int i = 0; i < static_cast<int>(m_threads.size()); ++i)
+	for (int i = 0; i < num_threads(); ++i)
 	{
-		tldAlloc(i, m_tld[i]);
+		tldAlloc(i, m_workers[i]->tld);
 	}
 
-	auto thread_func = [&](int threadId) 
+	m_group.reset(new TaskGroup(*this));
+	TaskGroup* group = m_group.get();
+	group->run_jobs(num_jobs, [this, kernel, group](int jobId, int worker)
 	{
-		while (true)
+		try
 		{
-			int const jobId = m_currentJob++;
-			if (jobId >= m_numJobs.load())
-			{
-				return;
-			}
-
-			try 
-			{
-				m_kernel(jobId, m_tld[threadId].get(), m_terminate);
-			} catch (std::exception const& e)
-			{
-				std::lock_guard<std::mutex> guard(m_exceptionMutex);
-				m_hasException.store(true);
-				std::ostringstream os;
-				os << "Thread " << std::this_thread::get_id() << ": " << e.what();
-				m_exceptionMsg.push_back(os.str());
-				m_numJobs.store(0);
-				m_terminate.store(true);
-			} catch(...)
-			{
-				std::lock_guard<std::mutex> guard(m_exceptionMutex);
-				m_hasException.store(true);
-				std::ostringstream os;
-				os << "Thread " << std::this_thread::get_id() << ": " << "unknown exception caught";
-				m_exceptionMsg.push_back(os.str());
-				m_numJobs.store(0);
-				m_terminate.store(true);
-			}
-			m_jobsDone++;
-			std::this_thread::yield();
+			kernel(jobId, m_workers[worker]->tld.get(), group->cancel_flag());
+		} catch (std::exception const& e)
+		{
+			std::lock_guard<std::mutex> guard(m_exceptionMutex);
+			m_hasException.store(true);
+			std::ostringstream os;
+			os << "Thread " << std::this_thread::get_id() << ": " << e.what();
+			m_exceptionMsg.push_back(os.str());
+			m_numJobs.store(0);
+			group->cancel();
+		} catch(...)
+		{
+			std::lock_guard<std::mutex> guard(m_exceptionMutex);
+			m_hasException.store(true);
+			std::ostringstream os;
+			os << "Thread " << std::this_thread::get_id() << ": " << "unknown exception caught";
+			m_exceptionMsg.push_back(os.str());
+			m_numJobs.store(0);
+			group->cancel();
 		}
+		m_jobsDone++;
+	});
+}
 
-		m_tld[threadId].reset();
-	};
+// -----------------------------------------------------------------------------
 
-	// Launch threads.
-	for (int i = 0; i < static_cast<int>(m_threads.size()); ++i)
+bool ThreadPool::done() const
+{
+	return !m_group || m_group->done();
+}
+
+// -----------------------------------------------------------------------------
+
+void ThreadPool::wait()
+{
+	if (m_group)
 	{
-		m_threads[i].reset(new std::thread(thread_func, i));
+		m_group->wait_for_tasks();
 	}
 }
 
 // -----------------------------------------------------------------------------
 
-void ThreadPool::terminate() 
+void ThreadPool::terminate()
 {
 	m_numJobs.store(0);
-	m_terminate.store(true);
-	for (int i = 0; i < static_cast<int>(m_threads.size()); ++i)
+	if (m_group)
 	{
-		auto& t = m_threads[i];
-		if (t && t->joinable())
-		{
-			t->join();
-		}
-		t.reset();
-		m_tld[i].reset();
+		// Drop the pending jobs and wait for the running ones, which see
+		// the cancel flag. The workers stay alive for the next run.
+		m_group->cancel();
+		m_group->wait_for_tasks();
+		m_group.reset();
+	}
+	for (auto& w : m_workers)
+	{
+		w->tld.reset();
 	}
 }
 
@@ -127,18 +470,19 @@ void ThreadPool::force_kill()
 {
 	// Give some chance to threads to terminate gracefully.
 	m_numJobs.store(0);
-	m_terminate.store(true);
+	if (m_group)
+	{
+		m_group->cancel();
+	}
 
-	for (int i = 0; i < static_cast<int>(m_threads.size()); ++i)
+	for (auto& w : m_workers)
 	{
-		auto& t = m_threads[i];
-		if (t && t->joinable())
+		if (w->thread.joinable())
 		{
-			int const result = pthread_kill(t->native_handle(), SIGTERM);
+			int const result = pthread_kill(w->thread.native_handle(), SIGTERM);
 			cg_assert((result == 0) && bool("Cannot kill thread."));
+			w->thread.detach();
 		}
-		t.reset();
-		m_tld[i].reset();
 	}
 }
 #else
@@ -0,0 +1,158 @@
+#include <cglib/rt/adaptive.h>
+
+#include <cglib/rt/raytracing_context.h>
+#include <cglib/rt/render_data.h>
+#include <cglib/rt/renderer.h>
+
+#include <cglib/core/assert.h>
+#include <cglib/core/sampler.h>
+#include <cglib/core/thread_local_data.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+/*
+ * Below this luminance the error is measured relative to it instead of
+ * the mean, so that dark pixels do not sample forever.
+ */
+const float MIN_LUMINANCE = 1.f / 64.f;
+
+/*
+ * The sum of the samples of a pixel, and the running mean and sum of
+ * squared deviations of their luminance, see Welford, "Note on a Method
+ * for Calculating Corrected Sums of Squares and Products", 1962.
+ */
+struct PixelEstimate
+{
+	glm::vec3 sum = glm::vec3(0.f);
+	float mean    = 0.f;
+	float m2      = 0.f;
+	int n         = 0;
+
+	void add(glm::vec3 const& c)
+	{
+		const float l = glm::dot(c, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+		sum += c;
+		n++;
+		const float delta = l - mean;
+		mean += delta / float(n);
+		m2   += delta * (l - mean);
+	}
+
+	float error() const
+	{
+		if (n < 2)
+			return FLT_MAX;
+		const float variance = m2 / float(n - 1);
+		return std::sqrt(variance / float(n)) / std::max(mean, MIN_LUMINANCE);
+	}
+};
+
+}
+
+bool
+adaptive_supported(RaytracingParameters const& params)
+{
+	switch (params.render_mode) {
+	case RaytracingParameters::RECURSIVE:
+	case RaytracingParameters::PATH_TRACE:
+	case RaytracingParameters::SAMPLES:
+		return !params.stereo;
+	default:
+		return false;
+	}
+}
+
+bool
+render_tile_adaptive(
+	RaytracingContext const& context,
+	ThreadLocalData* tld,
+	int x0, int y0,
+	int x1, int y1,
+	glm::vec3* color,
+	int* num_samples,
+	std::atomic<bool> const& terminate)
+{
+	cg_assert(tld);
+	cg_assert(color);
+	cg_assert(num_samples);
+
+	RaytracingParameters const& params = context.params;
+	const int width      = x1 - x0;
+	const int height     = y1 - y0;
+	const int num_pixels = width * height;
+	const int spp         = std::max(int(params.spp), 1);
+	const int max_samples = ADAPTIVE_MAX_SAMPLE_FACTOR * spp;
+	const int batch       = std::max(std::min(spp, 4), spp / 8);
+	long long budget      = (long long)(spp) * num_pixels;
+
+	RenderData data(context, tld);
+	tld->sampler = &Sampler::get(params.sampler);
+	ScratchArena::Scope scope(tld->scratch);
+	PixelEstimate* estimates = tld->scratch.allocate<PixelEstimate>(num_pixels);
+	auto take = [&](int i, int count) {
+		const int x = x0 + i % width;
+		const int y = y0 + i / width;
+		PixelEstimate& e = estimates[i];
+		tld->random.begin_pixel(x, y);
+		for (int s = e.n, end = e.n + count; s < end; ++s)
+			e.add(trace_pixel_sample(data, x, y, s));
+		budget -= count;
+	};
+
+	/* a first batch everywhere, for the variance */
+	for (int i = 0; i < num_pixels; ++i)
+	{
+		if (terminate.load())
+			return false;
+		take(i, batch);
+	}
+
+	/* then more batches where the error is largest */
+	float* errors = tld->scratch.allocate<float>(num_pixels);
+	std::pair<float, int>* noisy = tld->scratch.allocate<std::pair<float, int>>(num_pixels);
+	while (budget > 0)
+	{
+		for (int i = 0; i < num_pixels; ++i)
+			errors[i] = estimates[i].error();
+
+		int num_noisy = 0;
+		for (int i = 0; i < num_pixels; ++i)
+		{
+			const int x = i % width;
+			const int y = i / width;
+			float error = 0.f;
+			for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, height - 1); ++ny)
+				for (int nx = std::max(x - 1, 0); nx <= std::min(x + 1, width - 1); ++nx)
+					error = std::max(error, errors[ny * width + nx]);
+			if (estimates[i].n < max_samples && error > params.adaptive_threshold)
+				noisy[num_noisy++] = std::make_pair(-error, i);
+		}
+		if (num_noisy == 0)
+			break;
+		std::sort(noisy, noisy + num_noisy);
+
+		for (int j = 0; j < num_noisy; ++j)
+		{
+			std::pair<float, int> const& p = noisy[j];
+			if (terminate.load())
+				return false;
+			const int count = int(std::min<long long>(
+				std::min(batch, max_samples - estimates[p.second].n), budget));
+			if (count <= 0)
+				break;
+			take(p.second, count);
+		}
+	}
+
+	for (int i = 0; i < num_pixels; ++i)
+	{
+		color[i]       = estimates[i].sum / float(estimates[i].n);
+		num_samples[i] = estimates[i].n;
+	}
+	return true;
+}
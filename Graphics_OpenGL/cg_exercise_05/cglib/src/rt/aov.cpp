@@ -0,0 +1,175 @@
+#include <cglib/rt/aov.h>
+
+#include <cglib/rt/raytracing_context.h>
+#include <cglib/rt/render_data.h>
+#include <cglib/rt/renderer.h>
+#include <cglib/rt/scene.h>
+
+#include <cglib/core/assert.h>
+#include <cglib/core/camera.h>
+#include <cglib/core/heatmap.h>
+#include <cglib/core/image.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <sstream>
+
+char const*
+AOVBuffers::name(AOV aov)
+{
+	switch (aov) {
+	case NORMAL:   return "normal";
+	case DEPTH:    return "depth";
+	case ALBEDO:   return "albedo";
+	case DUDV:     return "dudv";
+	case NUM_RAYS: return "num_rays";
+	case TIME:     return "time";
+	default:       return "";
+	}
+}
+
+bool
+AOVBuffers::parse(std::string const& list)
+{
+	m_mask = 0;
+	std::istringstream is(list);
+	std::string item;
+	while (std::getline(is, item, ','))
+	{
+		int aov = 0;
+		while (aov < NUM_AOVS && item != name(AOV(aov)))
+			++aov;
+		if (aov == NUM_AOVS)
+		{
+			std::cerr << "[AOV] unknown output variable '" << item << "'" << std::endl;
+			return false;
+		}
+		m_mask |= 1u << aov;
+	}
+	return true;
+}
+
+bool
+AOVBuffers::supported(RaytracingParameters const& params)
+{
+	switch (params.render_mode) {
+	case RaytracingParameters::RECURSIVE:
+	case RaytracingParameters::PATH_TRACE:
+		return !params.stereo;
+	default:
+		return false;
+	}
+}
+
+void
+AOVBuffers::resize(int width, int height)
+{
+	m_width  = width;
+	m_height = height;
+	for (int aov = 0; aov < NUM_AOVS; ++aov)
+		m_values[aov].assign(enabled(AOV(aov)) ? width * height : 0, glm::vec3(0.f));
+}
+
+void
+AOVBuffers::record(int x, int y, RenderData const& data, float time_ms)
+{
+	cg_assert(x >= 0 && x < m_width && y >= 0 && y < m_height);
+
+	const int p = y * m_width + x;
+	Intersection const& isect = data.isect;
+	RaytracingParameters const& params = data.context.params;
+
+	/* the same values as the render modes */
+	if (enabled(NORMAL))
+		m_values[NORMAL][p] = isect.isValid()
+			? glm::normalize(params.normal_mapping ? isect.shading_normal : isect.normal)
+			: glm::vec3(0.f);
+	if (enabled(DEPTH))
+		m_values[DEPTH][p] = glm::vec3(isect.isValid()
+			? glm::length(isect.position - data.context.scene->camera->get_position(data.camera_mode))
+			: 0.f);
+	if (enabled(ALBEDO))
+		m_values[ALBEDO][p] = isect.isValid() ? shading_material(data, isect).k_d : glm::vec3(0.f);
+	if (enabled(DUDV))
+		m_values[DUDV][p] = glm::vec3(isect.isValid() ? glm::length(isect.dudv) : -1.f);
+	if (enabled(NUM_RAYS))
+		m_values[NUM_RAYS][p] = glm::vec3(float(data.num_cast_rays));
+	if (enabled(TIME))
+		m_values[TIME][p] = glm::vec3(time_ms);
+}
+
+void
+AOVBuffers::save(RaytracingContext const& context, std::string const& output_file_name) const
+{
+	RaytracingParameters const& params = context.params;
+	std::string base = output_file_name;
+	std::string extension = ".tga";
+	const size_t dot = base.rfind('.');
+	if (dot != std::string::npos && base.find('/', dot) == std::string::npos)
+	{
+		extension = base.substr(dot);
+		base = base.substr(0, dot);
+	}
+
+	for (int aov = 0; aov < NUM_AOVS; ++aov)
+	{
+		if (!enabled(AOV(aov)))
+			continue;
+
+		std::vector<glm::vec3> const& values = m_values[aov];
+		/* far hits, such as those on an infinite plane, would leave the
+		 * rest black, so depth is relative to the 95th percentile */
+		float max_depth = 0.f;
+		if (aov == DEPTH)
+		{
+			std::vector<float> depths;
+			for (glm::vec3 const& v : values)
+			{
+				if (v.x > 0.f)
+					depths.push_back(v.x);
+			}
+			if (!depths.empty())
+			{
+				auto const percentile = depths.begin() + (depths.size() * 95) / 100;
+				std::nth_element(depths.begin(), percentile, depths.end());
+				max_depth = *percentile;
+			}
+		}
+
+		Image image(m_width, m_height);
+		for (int y = 0; y < m_height; ++y)
+		{
+			for (int x = 0; x < m_width; ++x)
+			{
+				glm::vec3 const& v = values[y * m_width + x];
+				glm::vec3 color(0.f);
+				switch (aov) {
+				case NORMAL:
+					color = (v == glm::vec3(0.f)) ? v : v * 0.5f + glm::vec3(0.5f);
+					break;
+				case DEPTH:
+					color = glm::vec3(max_depth > 0.f ? std::min(v.x / max_depth, 1.f) : 0.f);
+					break;
+				case ALBEDO:
+					color = v;
+					break;
+				case DUDV:
+					color = (v.x < 0.f) ? glm::vec3(0.f) : heatmap(std::log(1.0f + 5.0f * v.x));
+					break;
+				case NUM_RAYS:
+					color = heatmap((v.x - 1.f) / 64.0f);
+					break;
+				case TIME:
+					color = heatmap(v.x * params.scale_render_time);
+					break;
+				}
+				image.setPixel(x, y, glm::vec4(color, 1.f));
+			}
+		}
+
+		std::string const file_name = base + "_" + name(AOV(aov)) + extension;
+		image.saveTGA(file_name.c_str(), 2.2f);
+		std::cout << "[AOV] saved " << file_name << std::endl;
+	}
+}
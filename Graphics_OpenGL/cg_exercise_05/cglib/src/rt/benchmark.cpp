@@ -0,0 +1,453 @@
+#include <cglib/rt/benchmark.h>
+#include <cglib/rt/intersection.h>
+#include <cglib/rt/object.h>
+#include <cglib/rt/ray.h>
+#include <cglib/rt/raytracing_context.h>
+#include <cglib/rt/render_data.h>
+#include <cglib/rt/renderer.h>
+#include <cglib/rt/scene.h>
+#include <cglib/rt/shading_kernel.h>
+#include <cglib/rt/wavefront.h>
+
+#include <cglib/core/sampler.h>
+#include <cglib/core/thread_pool.h>
+#include <cglib/core/timer.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+
+/*
+ * Restart latency: start a frame's worth of tile jobs and terminate it
+ * right away, as the interactive renderer does on every camera move.
+ * Per-job overhead: run many empty jobs to completion.
+ */
+void
+benchmark_thread_pool(RaytracingContext const& context)
+{
+	const int num_threads = context.params.num_threads;
+	const int num_tiles   = 256;
+	const int num_restarts = 200;
+	const int num_jobs    = 200000;
+
+	ThreadPool pool(num_threads);
+
+	{
+		Timer timer;
+		timer.start();
+		for (int i = 0; i < num_restarts; ++i) {
+			pool.run<ThreadLocalData>(num_tiles, [](int, ThreadLocalData*, std::atomic<bool>&) {});
+			pool.terminate();
+		}
+		timer.stop();
+		std::cout << "[Benchmark] thread pool restart: "
+			<< timer.getElapsedTimeInMicroSec() / num_restarts << " us per run + terminate" << std::endl;
+	}
+
+	{
+		std::atomic<int> counter(0);
+		Timer timer;
+		timer.start();
+		pool.run<void>(num_jobs, [&](int, ThreadLocalData*, std::atomic<bool>&) { counter++; });
+		pool.wait();
+		timer.stop();
+		std::cout << "[Benchmark] thread pool run: "
+			<< timer.getElapsedTimeInMicroSec() * 1000.0 / num_jobs << " ns per empty job ("
+			<< counter.load() << " jobs)" << std::endl;
+	}
+
+	{
+		Timer timer;
+		timer.start();
+		const long long sum = pool.parallel_reduce(0, num_jobs, 64, 0ll,
+			[](int begin, int end) {
+				long long s = 0;
+				for (int i = begin; i < end; ++i)
+					s += i;
+				return s;
+			},
+			[](long long a, long long b) { return a + b; });
+		timer.stop();
+		std::cout << "[Benchmark] thread pool parallel_reduce: "
+			<< timer.getElapsedTimeInMicroSec() * 1000.0 / (num_jobs / 64) << " ns per chunk of 64 (sum "
+			<< sum << ", expected " << (long long)(num_jobs) * (num_jobs - 1) / 2 << ")" << std::endl;
+	}
+}
+
+/*
+ * Render the image with the given sampler and sample count, and return
+ * the number of rays cast per pixel.
+ */
+double
+render_image(RaytracingContext& context, HostRender::PixelFunc const& render_pixel,
+	ThreadPool& pool, Sampler::Type sampler, int spp, std::uint32_t seed,
+	std::vector<glm::vec3>* image)
+{
+	const int width  = context.params.image_width;
+	const int height = context.params.image_height;
+	context.params.spp = std::uint32_t(spp);
+	image->assign(width * height, glm::vec3(0.f));
+	std::vector<long long> rays(height, 0);
+
+	pool.run<ThreadLocalData>(height, [&](int y, ThreadLocalData* tld, std::atomic<bool>&) {
+		for (int x = 0; x < width; ++x) {
+			RenderData data(context, tld);
+			tld->random.begin_pixel(x, y, seed);
+			tld->sampler = &Sampler::get(sampler);
+			(*image)[y * width + x] = render_pixel(x, y, context, data);
+			/* the renderer counts shadow and occlusion rays, add the camera rays */
+			rays[y] += data.num_cast_rays + spp;
+		}
+	});
+	pool.wait();
+	pool.poll_exceptions();
+
+	long long total = 0;
+	for (long long r : rays)
+		total += r;
+	return double(total) / double(width * height);
+}
+
+/*
+ * Error of the samplers over the number of rays. Every effect that is
+ * enabled casts one ray per pixel sample, so that the ray count grows with
+ * spp; ambient occlusion is enabled if no effect is. The reference uses
+ * the Sobol sampler with another seed than the measured images, so that
+ * its scrambling is independent of theirs.
+ */
+void
+benchmark_convergence(RaytracingContext& context, HostRender::PixelFunc const& render_pixel)
+{
+	const int reference_spp = 1024;
+	const int max_spp       = 64;
+
+	RaytracingParameters& params = context.params;
+	params.image_width  = 128;
+	params.image_height = 96;
+	if (!params.ao && !params.soft_shadow && !params.dof && !params.indirect)
+		params.ao = true;
+	params.ao_rays       = 1;
+	params.shadow_rays   = 1;
+	params.dof_rays      = 1;
+	params.indirect_rays = 1;
+
+	context.scene->refresh_scene(params);
+	context.scene->update_bvhs(params);
+
+	ThreadPool pool(params.num_threads);
+	std::vector<glm::vec3> reference, image;
+	{
+		Timer timer;
+		timer.start();
+		render_image(context, render_pixel, pool, Sampler::SOBOL, reference_spp, 1, &reference);
+		timer.stop();
+		std::cout << "[Benchmark] convergence: reference with " << reference_spp << " spp took "
+			<< timer.getElapsedTimeInMilliSec() << " ms" << std::endl;
+	}
+
+	struct { Sampler::Type type; char const* name; } const samplers[] = {
+		{ Sampler::RANDOM,     "random"     },
+		{ Sampler::HALTON,     "halton"     },
+		{ Sampler::SOBOL,      "sobol"      },
+		{ Sampler::BLUE_NOISE, "blue noise" },
+	};
+	for (auto const& s : samplers) {
+		for (int spp = 1; spp <= max_spp; spp *= 2) {
+			Timer timer;
+			timer.start();
+			const double rays = render_image(context, render_pixel, pool, s.type, spp, 0, &image);
+			timer.stop();
+
+			double sum = 0.0;
+			for (size_t i = 0; i < image.size(); ++i) {
+				const glm::vec3 d = image[i] - reference[i];
+				sum += double(glm::dot(d, d));
+			}
+			const double rmse = std::sqrt(sum / double(3 * image.size()));
+			std::cout << "[Benchmark] convergence: " << std::setw(10) << s.name
+				<< " spp " << std::setw(3) << spp
+				<< " rays/pixel " << std::setw(7) << std::fixed << std::setprecision(1) << rays
+				<< " rmse " << std::setprecision(5) << rmse
+				<< " time " << std::setprecision(1) << timer.getElapsedTimeInMilliSec() << " ms"
+				<< std::defaultfloat << std::endl;
+		}
+	}
+}
+
+/*
+ * Rays per second of the per-pixel renderer and of the wavefront backend,
+ * for ambient occlusion and for soft shadows, at the image size and ray
+ * counts of the command line. Only camera rays and the rays of the effect
+ * are cast, and both renderers count all of them. The renderers take
+ * turns, and the best of a few rounds is reported for each, as the clock
+ * of the machine may drift during the benchmark.
+ */
+void
+benchmark_wavefront(RaytracingContext& context, HostRender::PixelFunc const& render_pixel)
+{
+	RaytracingParameters& params = context.params;
+	const int width  = params.image_width;
+	const int height = params.image_height;
+	const int tile_size   = params.tile_size;
+	const int num_tiles_x = (width  + tile_size - 1) / tile_size;
+	const int num_tiles_y = (height + tile_size - 1) / tile_size;
+	const int num_rounds  = 3;
+	params.render_mode = RaytracingParameters::RECURSIVE;
+	params.max_depth   = 0;
+	params.indirect    = false;
+	params.dof         = false;
+
+	ThreadPool pool(params.num_threads);
+	struct { char const* name; bool ao; int rays; } const effects[] = {
+		{ "ambient occlusion", true,  params.ao_rays     },
+		{ "soft shadows",      false, params.shadow_rays },
+	};
+	for (auto const& e : effects) {
+		params.ao          = e.ao;
+		params.soft_shadow = !e.ao;
+		context.scene->refresh_scene(params);
+		context.scene->update_bvhs(params);
+
+		std::vector<glm::vec3> per_pixel;
+		std::vector<glm::vec3> wavefront(width * height);
+		std::vector<long long> rays(num_tiles_x * num_tiles_y);
+		double per_pixel_ms   = 0.0;
+		double per_pixel_rays = 0.0;
+		double wavefront_ms   = 0.0;
+		for (int round = 0; round < num_rounds; ++round) {
+			Timer timer;
+			timer.start();
+			const double rays_per_pixel = render_image(context, render_pixel, pool, params.sampler,
+				int(params.spp), 0, &per_pixel);
+			timer.stop();
+			per_pixel_ms   = round ? std::min(per_pixel_ms, timer.getElapsedTimeInMilliSec()) : timer.getElapsedTimeInMilliSec();
+			per_pixel_rays = rays_per_pixel * double(width * height);
+
+			std::fill(rays.begin(), rays.end(), 0);
+			timer.start();
+			pool.run<ThreadLocalData>(num_tiles_x * num_tiles_y, [&](int tile, ThreadLocalData* tld, std::atomic<bool>& terminate) {
+				const int x0 = (tile % num_tiles_x) * tile_size;
+				const int y0 = (tile / num_tiles_x) * tile_size;
+				const int x1 = std::min(x0 + tile_size, width);
+				const int y1 = std::min(y0 + tile_size, height);
+				std::vector<glm::vec3> color((x1 - x0) * (y1 - y0));
+				render_tile_wavefront(context, tld, x0, y0, x1, y1, color.data(), terminate, &rays[tile]);
+				for (int y = y0; y < y1; ++y)
+					for (int x = x0; x < x1; ++x)
+						wavefront[y * width + x] = color[(y - y0) * (x1 - x0) + (x - x0)];
+			});
+			pool.wait();
+			pool.poll_exceptions();
+			timer.stop();
+			wavefront_ms = round ? std::min(wavefront_ms, timer.getElapsedTimeInMilliSec()) : timer.getElapsedTimeInMilliSec();
+		}
+		long long wavefront_rays = 0;
+		for (long long r : rays)
+			wavefront_rays += r;
+
+		float max_difference = 0.f;
+		for (size_t i = 0; i < per_pixel.size(); ++i) {
+			const glm::vec3 d = glm::abs(per_pixel[i] - wavefront[i]);
+			max_difference = std::max(max_difference, std::max(d.x, std::max(d.y, d.z)));
+		}
+
+		std::cout << std::fixed << std::setprecision(2)
+			<< "[Benchmark] wavefront: " << std::setw(17) << e.name << " (" << e.rays << " rays)"
+			<< " per-pixel " << per_pixel_rays / (per_pixel_ms * 1000.0) << " Mrays/s in " << per_pixel_ms << " ms,"
+			<< " wavefront " << double(wavefront_rays) / (wavefront_ms * 1000.0) << " Mrays/s in " << wavefront_ms << " ms,"
+			<< " max difference " << std::setprecision(6) << max_difference
+			<< std::defaultfloat << std::endl;
+	}
+}
+
+/*
+ * Time of the generic trace_recursive and of the shading kernel
+ * specialized for the parameters of the command line, on the scene of the
+ * command line, MONKEY by default. As for the wavefront benchmark, the two
+ * take turns and the best of a few rounds is reported; every round swaps
+ * which goes first, as the second render of a round may find the machine
+ * slower. Both must render the same image.
+ */
+void
+benchmark_shading(RaytracingContext& context, HostRender::PixelFunc const& render_pixel)
+{
+	RaytracingParameters& params = context.params;
+	const int num_rounds = 4;
+	params.render_mode = RaytracingParameters::RECURSIVE;
+	params.specialize_shading = true;
+	const ShadingKernel kernel = select_shading_kernel(params);
+
+	context.scene->refresh_scene(params);
+	context.scene->update_bvhs(params);
+
+	ThreadPool pool(params.num_threads);
+	std::vector<glm::vec3> images[2];     /* generic, specialized */
+	double ms[2] = { 0.0, 0.0 };
+	for (int round = 0; round < num_rounds; ++round) {
+		for (int turn = 0; turn < 2; ++turn) {
+			const int k = (round + turn) % 2;
+			context.shading_kernel = k ? kernel : nullptr;
+			Timer timer;
+			timer.start();
+			render_image(context, render_pixel, pool, params.sampler, int(params.spp), 0, &images[k]);
+			timer.stop();
+			ms[k] = round ? std::min(ms[k], timer.getElapsedTimeInMilliSec()) : timer.getElapsedTimeInMilliSec();
+		}
+	}
+	context.shading_kernel = nullptr;
+	std::vector<glm::vec3> const& generic     = images[0];
+	std::vector<glm::vec3> const& specialized = images[1];
+	const double generic_ms     = ms[0];
+	const double specialized_ms = ms[1];
+
+	float max_difference = 0.f;
+	for (size_t i = 0; i < generic.size(); ++i) {
+		const glm::vec3 d = glm::abs(generic[i] - specialized[i]);
+		max_difference = std::max(max_difference, std::max(d.x, std::max(d.y, d.z)));
+	}
+
+	std::cout << std::fixed << std::setprecision(2)
+		<< "[Benchmark] shading: " << params.image_width << "x" << params.image_height
+		<< " at " << params.spp << " spp, generic " << generic_ms << " ms,"
+		<< " specialized " << specialized_ms << " ms,"
+		<< " speedup " << generic_ms / specialized_ms << "x,"
+		<< " max difference " << std::setprecision(6) << max_difference
+		<< std::defaultfloat << std::endl;
+}
+
+/*
+ * Share of the frame that goes into shading the hits, i.e.
+ * compute_shading_info with the evaluation of the material. The camera
+ * rays through the pixel centers are intersected once, and their hits are
+ * shaded again in a loop of their own, which is timed against the frame
+ * of the same rays. Both are the best of a few rounds.
+ */
+void
+benchmark_materials(RaytracingContext& context, HostRender::PixelFunc const& render_pixel)
+{
+	RaytracingParameters& params = context.params;
+	const int width  = params.image_width;
+	const int height = params.image_height;
+	const int num_rounds = 3;
+	const bool footprint = params.tex_filter_mode == TextureFilterMode::TRILINEAR
+	                    || params.tex_filter_mode == TextureFilterMode::DEBUG_MIP;
+	params.render_mode = RaytracingParameters::RECURSIVE;
+	params.spp = 1;
+
+	context.scene->refresh_scene(params);
+	context.scene->update_bvhs(params);
+	context.shading_kernel = select_shading_kernel(params);
+
+	/* the hits before shading, as shoot_ray finds them */
+	struct Hit
+	{
+		Object* object = nullptr;
+		Ray corner_rays[4];
+		Intersection isect;
+	};
+	std::vector<Hit> hits(width * height);
+	ThreadPool pool(params.num_threads);
+	pool.run<ThreadLocalData>(height, [&](int y, ThreadLocalData* tld, std::atomic<bool>&) {
+		for (int x = 0; x < width; ++x) {
+			RenderData data(context, tld);
+			const Ray ray = createPrimaryRay(data, float(x) + 0.5f, float(y) + 0.5f);
+			const Ray ray_eps(ray.origin + params.ray_epsilon * ray.direction, ray.direction);
+			HitRecord record;
+			if (!context.scene->tlas.intersect(ray_eps, &record))
+				continue;
+			Hit& hit = hits[y * width + x];
+			hit.object = record.object;
+			hit.corner_rays[0] = createPrimaryRay(data, float(x), float(y));
+			hit.corner_rays[1] = createPrimaryRay(data, float(x) + 1.f, float(y) + 1.f);
+			hit.corner_rays[2] = createPrimaryRay(data, float(x), float(y) + 1.f);
+			hit.corner_rays[3] = createPrimaryRay(data, float(x) + 1.f, float(y));
+			record.object->fill_intersection(ray_eps, record, &hit.isect);
+		}
+	});
+	pool.wait();
+	pool.poll_exceptions();
+
+	std::vector<glm::vec3> image;
+	std::vector<float> checksum(height);
+	double frame_ms   = 0.0;
+	double shading_ms = 0.0;
+	for (int round = 0; round < num_rounds; ++round) {
+		Timer timer;
+		timer.start();
+		render_image(context, render_pixel, pool, params.sampler, 1, 0, &image);
+		timer.stop();
+		frame_ms = round ? std::min(frame_ms, timer.getElapsedTimeInMilliSec()) : timer.getElapsedTimeInMilliSec();
+
+		timer.start();
+		pool.run<ThreadLocalData>(height, [&](int y, ThreadLocalData*, std::atomic<bool>&) {
+			float sum = 0.f;
+			for (int x = 0; x < width; ++x) {
+				Hit const& hit = hits[y * width + x];
+				if (!hit.object)
+					continue;
+				Intersection isect = hit.isect;
+				if (footprint)
+					hit.object->compute_shading_info(hit.corner_rays, &isect);
+				else
+					hit.object->compute_shading_info(&isect);
+				sum += isect.material.k_d.x;
+			}
+			checksum[y] = sum;
+		});
+		pool.wait();
+		pool.poll_exceptions();
+		timer.stop();
+		shading_ms = round ? std::min(shading_ms, timer.getElapsedTimeInMilliSec()) : timer.getElapsedTimeInMilliSec();
+	}
+	context.shading_kernel = nullptr;
+
+	long long num_hits = 0;
+	for (Hit const& hit : hits)
+		num_hits += hit.object ? 1 : 0;
+	float sum = 0.f;
+	for (float s : checksum)
+		sum += s;
+
+	std::cout << std::fixed << std::setprecision(2)
+		<< "[Benchmark] materials: " << width << "x" << height << ", " << num_hits << " camera hits,"
+		<< " frame " << frame_ms << " ms, shading " << shading_ms << " ms"
+		<< " (" << 100.0 * shading_ms / frame_ms << "% of the frame),"
+		<< " " << 1e6 * shading_ms / double(std::max(num_hits, 1LL)) << " ns per hit,"
+		<< " checksum " << sum
+		<< std::defaultfloat << std::endl;
+}
+
+}
+
+int
+run_benchmark(RaytracingContext& context, HostRender::PixelFunc const& render_pixel)
+{
+	std::string const& name = context.params.benchmark;
+	if (name == "threadpool") {
+		benchmark_thread_pool(context);
+		return 0;
+	}
+	if (name == "convergence") {
+		benchmark_convergence(context, render_pixel);
+		return 0;
+	}
+	if (name == "wavefront") {
+		benchmark_wavefront(context, render_pixel);
+		return 0;
+	}
+	if (name == "shading") {
+		benchmark_shading(context, render_pixel);
+		return 0;
+	}
+	if (name == "materials") {
+		benchmark_materials(context, render_pixel);
+		return 0;
+	}
+	std::cerr << "Unknown benchmark '" << name << "'" << std::endl;
+	return 1;
+}
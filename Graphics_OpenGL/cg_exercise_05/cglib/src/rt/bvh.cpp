@@ -6,109 +6,528 @@
 #include <cglib/rt/interpolate.h>
 
 #include <cglib/core/camera.h>
+#include <cglib/core/timer.h>
+#include <cglib/core/thread_pool.h>
+
+#include <iostream>
+#include <memory>
+#include <mutex>
+
+namespace {
+
+// Relative costs of one traversal step and one ray-triangle test.
+const float SAH_COST_TRAVERSAL   = 1.0f;
+const float SAH_COST_INTERSECTION = 1.0f;
+
+// Builds with fewer triangles are not worth forking onto worker threads.
+const int PARALLEL_BUILD_MIN_TRIANGLES = 8192;
+// Chunk size for the parallel bounds, centroid and binning passes.
+const int PARALLEL_CHUNK_SIZE = 16384;
+
+// A subtree is rebuilt by update() once its relative SAH cost grew by this factor.
+const float REBUILD_COST_RATIO = 1.5f;
+
+const char* build_method_name(RaytracingParameters::BVHBuildMethod method)
+{
+	switch (method) {
+	case RaytracingParameters::BVH_MEDIAN_SPLIT: return "median split";
+	case RaytracingParameters::BVH_BINNED_SAH:   return "binned SAH";
+	}
+	return "unknown";
+}
+
+/*
+ * Run f(begin, end) over [0, n) in chunks, on the pool if there is one
+ * and more than one chunk.
+ */
+template <class F>
+void parallel_chunks(ThreadPool* pool, int n, F const& f)
+{
+	const int num_chunks = (n + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+	if (!pool || num_chunks <= 1) {
+		f(0, 0, n);
+		return;
+	}
+	pool->parallel_for(0, n, PARALLEL_CHUNK_SIZE, [&](int begin, int end) {
+		f(begin / PARALLEL_CHUNK_SIZE, begin, end);
+	});
+}
+
+// Parallel builds share one pool, started by the first of them, so that
+// rebuilds do not start and stop threads of their own. It is replaced only
+// when the number of threads changes. Builds hold the mutex while they use
+// the pool.
+std::mutex build_pool_mutex;
+
+ThreadPool&
+shared_build_pool(int num_threads)
+{
+	static std::unique_ptr<ThreadPool> pool;
+	static int pool_threads = 0;
+	if (!pool || pool_threads != num_threads) {
+		pool.reset(new ThreadPool(num_threads));
+		pool_threads = num_threads;
+	}
+	return *pool;
+}
+
+}
 
 BVH::
-BVH(const TriangleSoup &triangle_soup_)
+BVH(const TriangleSoup &triangle_soup_,
+	RaytracingParameters::BVHBuildMethod build_method_,
+	int max_triangles_in_leaf_)
 	: triangle_soup(triangle_soup_)
-	, triangle_indices(triangle_soup_.num_triangles)
-	, nodes(1)
 {
-	nodes.reserve(triangle_soup.num_triangles * 2);
-	for(int i = 0; i < triangle_soup.num_triangles; i++)
+	build(build_method_, max_triangles_in_leaf_);
+}
+
+BVH::
+BVH(const TriangleSoup &triangle_soup_, RaytracingParameters const& params)
+	: triangle_soup(triangle_soup_)
+{
+	verbose = params.verbose;
+	traversal_width = resolve_traversal_width(params.bvh_width);
+	build(params.bvh_build_method, params.bvh_max_triangles_in_leaf, params.num_threads);
+}
+
+void BVH::
+build(RaytracingParameters::BVHBuildMethod build_method_, int max_triangles_in_leaf_, int num_threads)
+{
+	build_method = build_method_;
+	max_triangles_in_leaf = std::max(1, max_triangles_in_leaf_);
+
+	Timer timer;
+	timer.start();
+
+	const int num_triangles = triangle_soup.num_triangles;
+	const bool parallel = num_threads > 1 && num_triangles >= PARALLEL_BUILD_MIN_TRIANGLES;
+	std::unique_lock<std::mutex> pool_lock(build_pool_mutex, std::defer_lock);
+	if (parallel) {
+		pool_lock.lock();
+		build_pool = &shared_build_pool(num_threads);
+		/* enough subtrees to keep all threads busy despite uneven splits */
+		subtree_task_size = std::max(num_triangles / (8 * num_threads), 1024);
+	}
+
+	triangle_indices.resize(num_triangles);
+	for(int i = 0; i < num_triangles; i++)
 		triangle_indices[i] = i;
-	build_bvh(0, 0, triangle_soup.num_triangles, 0);
+
+	nodes.clear();
+	nodes.reserve(std::max(1, num_triangles * 2));
+	nodes.push_back(Node());
+
+	if (build_method == RaytracingParameters::BVH_BINNED_SAH) {
+		triangle_bounds.resize(num_triangles);
+		triangle_centroids.resize(num_triangles);
+		parallel_chunks(build_pool, num_triangles, [&](int, int begin, int end) {
+			for(int i = begin; i < end; i++) {
+				AABB &b = triangle_bounds[i];
+				b = AABB();
+				for(int j = 0; j < 3; j++)
+					b.extend(triangle_soup.vertices[i * 3 + j]);
+				triangle_centroids[i] = 0.5f * (b.min + b.max);
+			}
+		});
+		build_sah(nodes, 0, 0, num_triangles, 0);
+	}
+	else {
+		build_median(nodes, 0, 0, num_triangles, 0);
+	}
+
+	if (build_pool) {
+		build_subtrees_parallel();
+		/* the result must not depend on the order the subtrees finished in */
+		reorder_nodes_depth_first();
+		refit_internal_nodes();
+	}
+
+	triangle_bounds.clear();
+	triangle_bounds.shrink_to_fit();
+	triangle_centroids.clear();
+	triangle_centroids.shrink_to_fit();
+	build_pool = nullptr;
+	subtree_task_size = 0;
+
+	timer.stop();
+	build_time_ms = timer.getElapsedTimeInMilliSec();
+	sah_cost = compute_sah_cost();
+
+	std::vector<float> cost;
+	compute_subtree_costs(&cost);
+	for (size_t i = 0; i < nodes.size(); ++i)
+		nodes[i].reference_cost = cost[i];
+
+	if (verbose)
+		std::cout << "[BVH] " << build_method_name(build_method)
+			<< ": " << num_triangles << " triangles, "
+			<< nodes.size() << " nodes, SAH cost " << sah_cost
+			<< ", built in " << build_time_ms << "ms"
+			<< (parallel ? " (parallel)" : "") << std::endl;
 
 	sanity_checks();
+	flatten();
 }
 
 bool BVH::
-intersect_local(Ray const& ray, Intersection* isect) const
+requires_rebuild(RaytracingParameters const& params) const
+{
+	return build_method != params.bvh_build_method
+		|| max_triangles_in_leaf != std::max(1, params.bvh_max_triangles_in_leaf);
+}
+
+void BVH::
+refit()
+{
+	refit_nodes();
+	sah_cost = compute_sah_cost();
+	flatten();
+}
+
+void BVH::
+refit_nodes()
+{
+	cg_assert(int(triangle_indices.size()) == triangle_soup.num_triangles);
+	if (triangle_soup.num_triangles == 0)
+		return;
+
+	for (auto& n : nodes) {
+		if (n.left >= 0)
+			continue;
+		n.aabb = AABB();
+		for (int i = n.triangle_idx; i < n.triangle_idx + n.num_triangles; ++i) {
+			const int t = triangle_indices[i];
+			for (int j = 0; j < 3; ++j)
+				n.aabb.extend(triangle_soup.vertices[t * 3 + j]);
+		}
+	}
+	refit_internal_nodes();
+}
+
+void BVH::
+update(int num_threads)
+{
+	Timer timer;
+	timer.start();
+
+	const float old_cost = sah_cost;
+	refit_nodes();
+
+	std::vector<float> cost;
+	compute_subtree_costs(&cost);
+
+	/* collect the topmost degraded subtrees as (node, depth) */
+	std::vector<std::pair<int, int>> degraded;
+	int num_degraded_triangles = 0;
+	std::vector<std::pair<int, int>> stack;
+	if (triangle_soup.num_triangles > 0)
+		stack.emplace_back(0, 0);
+	while (!stack.empty()) {
+		const int idx   = stack.back().first;
+		const int depth = stack.back().second;
+		stack.pop_back();
+
+		Node const& n = nodes[idx];
+		if (n.left < 0)
+			continue;
+		if (cost[idx] > REBUILD_COST_RATIO * n.reference_cost) {
+			degraded.emplace_back(idx, depth);
+			num_degraded_triangles += n.num_triangles;
+			continue;
+		}
+		stack.emplace_back(n.right, depth + 1);
+		stack.emplace_back(n.left,  depth + 1);
+	}
+
+	if (!degraded.empty() && (degraded[0].first == 0
+			|| 2 * num_degraded_triangles > triangle_soup.num_triangles)) {
+		build(build_method, max_triangles_in_leaf, num_threads);
+		num_rebuilt_subtrees  = 1;
+		num_rebuilt_triangles = triangle_soup.num_triangles;
+		update_time_ms = build_time_ms;
+		return;
+	}
+
+	if (!degraded.empty()) {
+		rebuild_subtrees(degraded);
+		compute_subtree_costs(&cost);
+		for (size_t i = 0; i < nodes.size(); ++i)
+			if (nodes[i].reference_cost == 0.f)
+				nodes[i].reference_cost = cost[i];
+	}
+	sah_cost = triangle_soup.num_triangles > 0 ? cost[0] : 0.f;
+	num_rebuilt_subtrees  = int(degraded.size());
+	num_rebuilt_triangles = num_degraded_triangles;
+	flatten();
+
+	timer.stop();
+	update_time_ms = timer.getElapsedTimeInMilliSec();
+
+	if (verbose)
+		std::cout << "[BVH] refit: SAH cost " << old_cost << " -> " << sah_cost
+			<< ", rebuilt " << num_rebuilt_subtrees << " subtrees ("
+			<< num_rebuilt_triangles << " triangles) in " << update_time_ms << "ms" << std::endl;
+}
+
+void BVH::
+rebuild_subtrees(std::vector<std::pair<int, int>> const& subtrees)
+{
+	triangle_bounds.resize(triangle_soup.num_triangles);
+	triangle_centroids.resize(triangle_soup.num_triangles);
+	for (auto const& s : subtrees) {
+		Node const& n = nodes[s.first];
+		for (int i = n.triangle_idx; i < n.triangle_idx + n.num_triangles; ++i) {
+			const int t = triangle_indices[i];
+			AABB &b = triangle_bounds[t];
+			b = AABB();
+			for (int j = 0; j < 3; j++)
+				b.extend(triangle_soup.vertices[t * 3 + j]);
+			triangle_centroids[t] = 0.5f * (b.min + b.max);
+		}
+	}
+
+	/* the subtrees cover disjoint triangle ranges, so they can be rebuilt in place */
+	for (auto const& s : subtrees) {
+		Node const& n = nodes[s.first];
+		std::vector<Node> subtree;
+		subtree.reserve(n.num_triangles * 2);
+		subtree.push_back(Node());
+		if (build_method == RaytracingParameters::BVH_BINNED_SAH)
+			build_sah(subtree, 0, n.triangle_idx, n.num_triangles, s.second);
+		else
+			build_median(subtree, 0, n.triangle_idx, n.num_triangles, s.second);
+		splice_subtree(s.first, subtree);
+	}
+
+	triangle_bounds.clear();
+	triangle_bounds.shrink_to_fit();
+	triangle_centroids.clear();
+	triangle_centroids.shrink_to_fit();
+
+	/* drops the replaced nodes and restores the parent before child order */
+	reorder_nodes_depth_first();
+	sanity_checks();
+}
+
+void BVH::
+flatten()
+{
+	static_assert(sizeof(FlatNode) == 32, "FlatNode must be 32 bytes");
+
+	flat_nodes.clear();
+	flat_triangles.clear();
+	wide4_nodes.clear();
+	wide8_nodes.clear();
+	if (triangle_soup.num_triangles == 0)
+		return;
+
+	flat_nodes.reserve(nodes.size());
+	flatten_subtree(0);
+
+	flat_triangles.resize(triangle_indices.size());
+	for (size_t i = 0; i < triangle_indices.size(); ++i) {
+		const int t = triangle_indices[i];
+		const glm::vec3 &v0 = triangle_soup.vertices[t * 3 + 0];
+		flat_triangles[i].v0    = v0;
+		flat_triangles[i].edge1 = triangle_soup.vertices[t * 3 + 1] - v0;
+		flat_triangles[i].edge2 = triangle_soup.vertices[t * 3 + 2] - v0;
+	}
+
+	build_wide();
+}
+
+int BVH::
+flatten_subtree(int node_idx)
+{
+	const Node &n = nodes[node_idx];
+	const int flat_idx = static_cast<int>(flat_nodes.size());
+	FlatNode f;
+	f.aabb_min = n.aabb.min;
+	f.aabb_max = n.aabb.max;
+	if (n.left < 0) {
+		f.offset        = n.triangle_idx;
+		f.num_triangles = n.num_triangles;
+		flat_nodes.push_back(f);
+	}
+	else {
+		f.num_triangles = 0;
+		flat_nodes.push_back(f);
+		flatten_subtree(n.left);
+		flat_nodes[flat_idx].offset = flatten_subtree(n.right);
+	}
+	return flat_idx;
+}
+
+namespace {
+
+/* same as AABB::intersect, on the bounds of a flat node */
+inline bool
+intersect_flat_node(BVH::FlatNode const& n, Ray const& ray, float &t_min, float &t_max, glm::vec3 const& div)
+{
+	glm::vec3 t_1 = (n.aabb_min - ray.origin) * div;
+	glm::vec3 t_2 = (n.aabb_max - ray.origin) * div;
+
+	glm::vec3 t_min2 = glm::min(t_1, t_2);
+	glm::vec3 t_max2 = glm::max(t_1, t_2);
+
+	t_min = glm::max(glm::max(t_min2.x, t_min2.y), glm::max(t_min2.z, t_min));
+	t_max = glm::min(glm::min(t_max2.x, t_max2.y), glm::min(t_max2.z, t_max));
+
+	return t_min <= t_max;
+}
+
+}
+
+int BVH::
+traverse_binary(Ray const& ray, float t_min, float t_max, bool any_hit, float* out_dist, glm::vec3* out_bary) const
 {
 	int stack[64];
 	int stack_size = 0;
 
-	float min_dist = std::numeric_limits<float>::max();
+	float min_dist = t_max;
 	glm::vec3 bary(0.f);
-	bool hit = false;
-	int nearest_triangle = -1;
+	int nearest = -1; /* index into flat_triangles */
 	
 	glm::vec3 div = 1.0f / ray.direction;
 
 	{ /* push root node on stack if hit */
-		float t_min = 0.0;
-		if(nodes[0].aabb.intersect(ray, t_min, min_dist, div))
+		float t_min_root = 0.0;
+		float t_max_root = min_dist;
+		if(intersect_flat_node(flat_nodes[0], ray, t_min_root, t_max_root, div))
 			stack[stack_size++] = 0;
 	}
 
 	while(stack_size > 0) {
-		const Node &n = nodes[stack[--stack_size]];
-		if(n.left < 0) { /* leaf node, intersect triangles */
-			for(int i = 0; i < n.num_triangles; i++) {
-				int x = triangle_indices[n.triangle_idx + i];
+		const int idx = stack[--stack_size];
+		const FlatNode &n = flat_nodes[idx];
+		if(n.num_triangles > 0) { /* leaf node, intersect triangles */
+			for(int i = n.offset; i < n.offset + n.num_triangles; i++) {
+				const FlatTriangle &tri = flat_triangles[i];
 				float dist;
 				glm::vec3 b;
-				if(intersect_triangle(ray.origin, ray.direction,
-						triangle_soup.vertices[x * 3 + 0],
-						triangle_soup.vertices[x * 3 + 1],
-						triangle_soup.vertices[x * 3 + 2], 
-						b, dist)) {
-					hit = true;
-					if(dist < min_dist || nearest_triangle == -1) {
+				if(intersect_triangle_precomputed(ray.origin, ray.direction,
+						tri.v0, tri.edge1, tri.edge2, b, dist)) {
+					if(dist >= t_min && dist < min_dist) {
 						min_dist = dist;
 						bary = b;
-						cg_assert(x >= 0);
-						nearest_triangle = x;
+						nearest = i;
+						if(any_hit)
+							break;
 					}
 				}
 			}
+			if(any_hit && nearest >= 0)
+				break;
 		}
 		else {
+			const int left  = idx + 1;
+			const int right = n.offset;
+
 			float t_min_l = 0;
 			float t_max_l = min_dist;
 			float t_min_r = 0;
 			float t_max_r = min_dist;
 
-			bool il = nodes[n.left ].aabb.intersect(ray, t_min_l, t_max_l, div);
-			bool ir = nodes[n.right].aabb.intersect(ray, t_min_r, t_max_r, div);
+			bool il = intersect_flat_node(flat_nodes[left ], ray, t_min_l, t_max_l, div);
+			bool ir = intersect_flat_node(flat_nodes[right], ray, t_min_r, t_max_r, div);
 			if(!il && !ir) { /* no child hit, do nothing */
 			}
 			else if(il ^ ir) { /* only one child hit */
-				stack[stack_size++] = il ? n.left : n.right;
+				stack[stack_size++] = il ? left : right;
 			}
 			else { /* both children hit, order by first aabb intersection */
 				if(t_min_l < t_min_r) {
-					stack[stack_size++] = n.right;
-					stack[stack_size++] = n.left;
+					stack[stack_size++] = right;
+					stack[stack_size++] = left;
 				}
 				else {
-					stack[stack_size++] = n.left;
-					stack[stack_size++] = n.right;
+					stack[stack_size++] = left;
+					stack[stack_size++] = right;
 				}
 			}
 		}
 	}
 
-	if (isect && hit) {
-		triangle_soup.fill_intersection(isect, nearest_triangle, min_dist, bary);
-	}
-	return hit;
+	*out_dist = min_dist;
+	*out_bary = bary;
+	return nearest;
+}
+
+bool BVH::
+occluded_local(Ray const& ray, float t_max) const
+{
+	if (flat_nodes.empty())
+		return false;
+
+	float dist;
+	glm::vec3 bary;
+	const int hit = traversal_width > 2
+		? traverse_wide(ray, 0.f, t_max, true, &dist, &bary)
+		: traverse_binary(ray, 0.f, t_max, true, &dist, &bary);
+	return hit >= 0;
 }
 
 bool BVH::
-intersect(Ray const& ray, Intersection* isect) const
+intersect_hit(Ray const& ray, float t_min, float t_max, HitRecord* hit) const
 {
+	if (flat_nodes.empty())
+		return false;
+
 	// transform ray in object space
 	const Ray ray_local = transform_ray(ray, transform_world_to_object);
+	float t_min_local, t_max_local;
+	const float scale = transform_ray_range(ray, transform_world_to_object, t_min, t_max, &t_min_local, &t_max_local);
+
+	float dist;
+	glm::vec3 bary;
+	const int nearest = traversal_width > 2
+		? traverse_wide(ray_local, t_min_local, t_max_local, false, &dist, &bary)
+		: traverse_binary(ray_local, t_min_local, t_max_local, false, &dist, &bary);
+	if (nearest < 0)
+		return false;
+
+	const float t = dist / scale;
+	if (t < t_min || t >= t_max)
+		return false;
+
+	hit->t            = t;
+	hit->t_local      = dist;
+	hit->primitive_id = triangle_indices[nearest];
+	hit->bary         = glm::vec2(bary.y, bary.z);
+	return true;
+}
+
+void BVH::
+fill_intersection(Ray const& ray, HitRecord const& hit, Intersection* isect) const
+{
+	cg_assert(isect);
+	const glm::vec3 bary(1.f - hit.bary.x - hit.bary.y, hit.bary.x, hit.bary.y);
 	Intersection isect_local;
-	if (intersect_local(ray_local, &isect_local)) {
-		if (isect) {
-			*isect = transform_intersection(isect_local, 
-				transform_object_to_world, transform_object_to_world_normal);
-			isect->t = glm::length(ray.origin-isect->position);
-		}
+	triangle_soup.fill_intersection(&isect_local, hit.primitive_id, hit.t_local, bary);
+	*isect = transform_intersection(isect_local, 
+		transform_object_to_world, transform_object_to_world_normal);
+	isect->t = glm::length(ray.origin-isect->position);
+}
+
+bool BVH::
+occluded(Ray const& ray, float t_max) const
+{
+	const Ray ray_local = transform_ray(ray, transform_world_to_object);
+	return occluded_local(ray_local, t_max * transform_ray_scale(ray, transform_world_to_object));
+}
+
+bool BVH::
+get_world_bounds(AABB* aabb) const
+{
+	cg_assert(aabb);
+	cg_assert(!nodes.empty());
+	if (triangle_soup.num_triangles == 0) {
+		*aabb = AABB(); /* empty, never hit */
 		return true;
 	}
-	return false;
+	*aabb = transform_aabb(nodes[0].aabb, transform_object_to_world);
+	return true;
 }
 
 void BVH::
@@ -134,10 +553,22 @@ sanity_checks()
 
 void BVH::
 build_bvh(int node_idx, int first_triangle_idx, int num_triangles, int depth)
+{
+	build_median(nodes, node_idx, first_triangle_idx, num_triangles, depth);
+}
+
+void BVH::
+build_bvh_sah(int node_idx, int first_triangle_idx, int num_triangles, int depth)
+{
+	build_sah(nodes, node_idx, first_triangle_idx, num_triangles, depth);
+}
+
+void BVH::
+build_median(std::vector<Node>& out, int node_idx, int first_triangle_idx, int num_triangles, int depth)
 {	
 	cg_assert(node_idx >= 0);
-	cg_assert(node_idx < int(nodes.size()));
-	Node& node = nodes[node_idx];
+	cg_assert(node_idx < int(out.size()));
+	Node& node = out[node_idx];
 
 	if (node_idx == 0 && num_triangles == 0)
 	{
@@ -146,17 +577,12 @@ build_bvh(int node_idx, int first_triangle_idx, int num_triangles, int depth)
 	cg_assert(num_triangles > 0);
 	cg_assert(first_triangle_idx + num_triangles <= triangle_soup.num_triangles);
 
+	if (defer_subtree(out, node_idx, first_triangle_idx, num_triangles, depth))
+		return;
+
 	int axis = depth % 3; /* split axis */
-	if(num_triangles <= MAX_TRIANGLES_IN_LEAF) {
-		node.left          = -1;
-		node.right         = -1;
-		node.triangle_idx  = first_triangle_idx;
-		node.num_triangles = num_triangles;
-		for(int i = 0; i < num_triangles; i++) {
-			int tidx = triangle_indices[first_triangle_idx + i];
-			for(int j = 0; j < 3; j++)
-				node.aabb.extend(triangle_soup.vertices[tidx * 3 + j]);
-		}
+	if(num_triangles <= max_triangles_in_leaf) {
+		make_leaf(node, first_triangle_idx, num_triangles);
 	}
 	else {
 		std::nth_element(
@@ -176,25 +602,417 @@ build_bvh(int node_idx, int first_triangle_idx, int num_triangles, int depth)
 					}
 					return min_l + max_l < min_r + max_r;
 				});
-		int const num_nodes = static_cast<int>(nodes.size());
+		int const num_nodes = static_cast<int>(out.size());
 		node.left  = num_nodes + 0;
 		node.right = num_nodes + 1;
-		nodes.push_back(Node());
-		nodes.push_back(Node());
+		out.push_back(Node());
+		out.push_back(Node());
 		node.triangle_idx = first_triangle_idx;
 		node.num_triangles = num_triangles;
 		int nt = num_triangles / 2;
-		build_bvh(node.left, first_triangle_idx, nt, depth + 1);
-		build_bvh(node.right, first_triangle_idx + nt, num_triangles - nt, depth + 1);
+		build_median(out, node.left, first_triangle_idx, nt, depth + 1);
+		build_median(out, node.right, first_triangle_idx + nt, num_triangles - nt, depth + 1);
 
-		Node &nl = nodes[node.left];
-		Node &nr = nodes[node.right];
+		Node &nl = out[node.left];
+		Node &nr = out[node.right];
 
 		node.aabb.min = glm::min(nl.aabb.min, nr.aabb.min);
 		node.aabb.max = glm::max(nl.aabb.max, nr.aabb.max);
 	}
 }
 
+void BVH::
+make_leaf(Node& node, int first_triangle_idx, int num_triangles)
+{
+	node.left          = -1;
+	node.right         = -1;
+	node.triangle_idx  = first_triangle_idx;
+	node.num_triangles = num_triangles;
+	node.aabb          = AABB();
+	for(int i = 0; i < num_triangles; i++) {
+		int tidx = triangle_indices[first_triangle_idx + i];
+		for(int j = 0; j < 3; j++)
+			node.aabb.extend(triangle_soup.vertices[tidx * 3 + j]);
+	}
+}
+
+void BVH::
+split_median(std::vector<Node>& out, int node_idx, int first_triangle_idx, int num_triangles, int axis, int depth)
+{
+	std::nth_element(
+			triangle_indices.begin() + first_triangle_idx,
+			triangle_indices.begin() + first_triangle_idx + num_triangles / 2,
+			triangle_indices.begin() + first_triangle_idx + num_triangles,
+			[&](int l, int r) -> bool {
+				return triangle_centroids[l][axis] < triangle_centroids[r][axis];
+			});
+
+	int const num_nodes = static_cast<int>(out.size());
+	out[node_idx].left  = num_nodes + 0;
+	out[node_idx].right = num_nodes + 1;
+	out[node_idx].triangle_idx  = first_triangle_idx;
+	out[node_idx].num_triangles = num_triangles;
+	out.push_back(Node());
+	out.push_back(Node());
+
+	int nt = num_triangles / 2;
+	build_sah(out, num_nodes + 0, first_triangle_idx, nt, depth + 1);
+	build_sah(out, num_nodes + 1, first_triangle_idx + nt, num_triangles - nt, depth + 1);
+
+	Node &nl = out[num_nodes + 0];
+	Node &nr = out[num_nodes + 1];
+	out[node_idx].aabb.min = glm::min(nl.aabb.min, nr.aabb.min);
+	out[node_idx].aabb.max = glm::max(nl.aabb.max, nr.aabb.max);
+}
+
+void BVH::
+compute_range_bounds(int first_triangle_idx, int num_triangles, AABB* bounds, AABB* centroid_bounds)
+{
+	auto accumulate = [&](int begin, int end, AABB& b, AABB& cb) {
+		for (int i = begin; i < end; ++i) {
+			const int t = triangle_indices[first_triangle_idx + i];
+			b.extend(triangle_bounds[t]);
+			cb.min = glm::min(cb.min, triangle_centroids[t]);
+			cb.max = glm::max(cb.max, triangle_centroids[t]);
+		}
+	};
+
+	*bounds = AABB();
+	*centroid_bounds = AABB();
+	if (!build_pool || num_triangles <= PARALLEL_CHUNK_SIZE) {
+		accumulate(0, num_triangles, *bounds, *centroid_bounds);
+		return;
+	}
+
+	/* min/max are exact, so merging the chunks gives the serial result */
+	const int num_chunks = (num_triangles + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+	std::vector<AABB> chunk_bounds(num_chunks), chunk_centroid_bounds(num_chunks);
+	parallel_chunks(build_pool, num_triangles, [&](int chunk, int begin, int end) {
+		accumulate(begin, end, chunk_bounds[chunk], chunk_centroid_bounds[chunk]);
+	});
+	for (int c = 0; c < num_chunks; ++c) {
+		bounds->extend(chunk_bounds[c]);
+		centroid_bounds->extend(chunk_centroid_bounds[c]);
+	}
+}
+
+void BVH::
+bin_range(int first_triangle_idx, int num_triangles, AABB const& centroid_bounds, SAHBin bins[3][SAH_NUM_BINS])
+{
+	const glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+	glm::vec3 scale;
+	for (int axis = 0; axis < 3; ++axis)
+		scale[axis] = extent[axis] > 0.f ? float(SAH_NUM_BINS) / extent[axis] : 0.f;
+
+	auto accumulate = [&](int begin, int end, SAHBin (*b)[SAH_NUM_BINS]) {
+		for (int i = begin; i < end; ++i) {
+			const int t = triangle_indices[first_triangle_idx + i];
+			for (int axis = 0; axis < 3; ++axis) {
+				SAHBin &bin = b[axis][sah_bin(triangle_centroids[t][axis], centroid_bounds.min[axis], scale[axis])];
+				bin.aabb.extend(triangle_bounds[t]);
+				bin.count++;
+			}
+		}
+	};
+
+	if (!build_pool || num_triangles <= PARALLEL_CHUNK_SIZE) {
+		accumulate(0, num_triangles, bins);
+		return;
+	}
+
+	const int num_chunks = (num_triangles + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+	struct ChunkBins { SAHBin bins[3][SAH_NUM_BINS]; };
+	std::vector<ChunkBins> chunk_bins(num_chunks);
+	parallel_chunks(build_pool, num_triangles, [&](int chunk, int begin, int end) {
+		accumulate(begin, end, chunk_bins[chunk].bins);
+	});
+	for (int c = 0; c < num_chunks; ++c) {
+		for (int axis = 0; axis < 3; ++axis) {
+			for (int i = 0; i < SAH_NUM_BINS; ++i) {
+				bins[axis][i].aabb.extend(chunk_bins[c].bins[axis][i].aabb);
+				bins[axis][i].count += chunk_bins[c].bins[axis][i].count;
+			}
+		}
+	}
+}
+
+int BVH::
+sah_bin(float centroid, float centroid_min, float scale)
+{
+	const int b = int((centroid - centroid_min) * scale);
+	return std::min(std::max(b, 0), int(SAH_NUM_BINS) - 1);
+}
+
+void BVH::
+build_sah(std::vector<Node>& out, int node_idx, int first_triangle_idx, int num_triangles, int depth)
+{
+	cg_assert(node_idx >= 0);
+	cg_assert(node_idx < int(out.size()));
+
+	if (node_idx == 0 && num_triangles == 0)
+	{
+		return;
+	}
+	cg_assert(num_triangles > 0);
+	cg_assert(first_triangle_idx + num_triangles <= triangle_soup.num_triangles);
+
+	if (defer_subtree(out, node_idx, first_triangle_idx, num_triangles, depth))
+		return;
+
+	AABB bounds, centroid_bounds;
+	compute_range_bounds(first_triangle_idx, num_triangles, &bounds, &centroid_bounds);
+
+	if (num_triangles == 1) {
+		make_leaf(out[node_idx], first_triangle_idx, num_triangles);
+		return;
+	}
+
+	const glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+	int largest_axis = 0;
+	if (extent[1] > extent[largest_axis]) largest_axis = 1;
+	if (extent[2] > extent[largest_axis]) largest_axis = 2;
+
+	if (depth >= SAH_MAX_DEPTH) {
+		if (num_triangles <= max_triangles_in_leaf)
+			make_leaf(out[node_idx], first_triangle_idx, num_triangles);
+		else
+			split_median(out, node_idx, first_triangle_idx, num_triangles, largest_axis, depth);
+		return;
+	}
+
+	/* bin the centroids along every axis and sweep for the cheapest split */
+	SAHBin bins[3][SAH_NUM_BINS];
+	bin_range(first_triangle_idx, num_triangles, centroid_bounds, bins);
+
+	float best_cost = std::numeric_limits<float>::max();
+	int best_axis   = -1;
+	int best_split  = -1;
+
+	for (int axis = 0; axis < 3; ++axis) {
+		if (!(extent[axis] > 0.f))
+			continue;
+
+		/* right_area[i] and right_count[i] describe bins i+1 .. SAH_NUM_BINS-1 */
+		float right_area[SAH_NUM_BINS];
+		int right_count[SAH_NUM_BINS];
+		{
+			AABB acc;
+			int count = 0;
+			for (int i = SAH_NUM_BINS - 1; i > 0; --i) {
+				acc.extend(bins[axis][i].aabb);
+				count += bins[axis][i].count;
+				right_area[i - 1]  = acc.surface_area();
+				right_count[i - 1] = count;
+			}
+		}
+
+		AABB acc;
+		int count = 0;
+		for (int i = 0; i < SAH_NUM_BINS - 1; ++i) {
+			acc.extend(bins[axis][i].aabb);
+			count += bins[axis][i].count;
+			if (count == 0 || right_count[i] == 0)
+				continue;
+			const float cost = acc.surface_area() * float(count)
+			                 + right_area[i] * float(right_count[i]);
+			if (cost < best_cost) {
+				best_cost  = cost;
+				best_axis  = axis;
+				best_split = i;
+			}
+		}
+	}
+
+	const float parent_area = bounds.surface_area();
+	const float leaf_cost   = SAH_COST_INTERSECTION * float(num_triangles);
+	const float split_cost  = (best_axis < 0 || !(parent_area > 0.f))
+		? std::numeric_limits<float>::max()
+		: SAH_COST_TRAVERSAL + SAH_COST_INTERSECTION * best_cost / parent_area;
+
+	if (num_triangles <= max_triangles_in_leaf && leaf_cost <= split_cost) {
+		make_leaf(out[node_idx], first_triangle_idx, num_triangles);
+		return;
+	}
+
+	if (best_axis < 0) {
+		/* all centroids coincide, no binned split possible */
+		split_median(out, node_idx, first_triangle_idx, num_triangles, largest_axis, depth);
+		return;
+	}
+
+	const float min   = centroid_bounds.min[best_axis];
+	const float scale = float(SAH_NUM_BINS) / extent[best_axis];
+	auto const begin  = triangle_indices.begin() + first_triangle_idx;
+	auto const mid    = std::partition(begin, begin + num_triangles, [&](int t) {
+		return sah_bin(triangle_centroids[t][best_axis], min, scale) <= best_split;
+	});
+	const int nt = static_cast<int>(mid - begin);
+	cg_assert(nt > 0 && nt < num_triangles);
+
+	int const num_nodes = static_cast<int>(out.size());
+	out[node_idx].left  = num_nodes + 0;
+	out[node_idx].right = num_nodes + 1;
+	out[node_idx].triangle_idx  = first_triangle_idx;
+	out[node_idx].num_triangles = num_triangles;
+	out[node_idx].aabb = bounds;
+	out.push_back(Node());
+	out.push_back(Node());
+
+	build_sah(out, num_nodes + 0, first_triangle_idx, nt, depth + 1);
+	build_sah(out, num_nodes + 1, first_triangle_idx + nt, num_triangles - nt, depth + 1);
+}
+
+bool BVH::
+defer_subtree(std::vector<Node>& out, int node_idx, int first_triangle_idx, int num_triangles, int depth)
+{
+	/* only the top levels, which build directly into nodes, fork subtrees */
+	if (subtree_task_size == 0 || &out != &nodes || num_triangles > subtree_task_size)
+		return false;
+
+	SubtreeTask task;
+	task.node_idx           = node_idx;
+	task.first_triangle_idx = first_triangle_idx;
+	task.num_triangles      = num_triangles;
+	task.depth              = depth;
+	subtree_tasks.push_back(task);
+	return true;
+}
+
+void BVH::
+build_subtrees_parallel()
+{
+	/* largest subtrees first, so that they do not end up last on one thread */
+	std::stable_sort(subtree_tasks.begin(), subtree_tasks.end(),
+		[](SubtreeTask const& a, SubtreeTask const& b) { return a.num_triangles > b.num_triangles; });
+
+	std::vector<std::vector<Node>> subtrees(subtree_tasks.size());
+	const int num_tasks = static_cast<int>(subtree_tasks.size());
+	ThreadPool* pool = build_pool;
+	build_pool = nullptr; /* subtrees are built serially on their thread */
+
+	ThreadPool::TaskGroup group(*pool);
+	group.run_jobs(num_tasks, [&](int i, int) {
+		SubtreeTask const& task = subtree_tasks[i];
+		std::vector<Node>& subtree = subtrees[i];
+		subtree.reserve(task.num_triangles * 2);
+		subtree.push_back(Node());
+		if (build_method == RaytracingParameters::BVH_BINNED_SAH)
+			build_sah(subtree, 0, task.first_triangle_idx, task.num_triangles, task.depth);
+		else
+			build_median(subtree, 0, task.first_triangle_idx, task.num_triangles, task.depth);
+	});
+	group.wait();
+	build_pool = pool;
+
+	for (int i = 0; i < num_tasks; ++i)
+		splice_subtree(subtree_tasks[i].node_idx, subtrees[i]);
+	subtree_tasks.clear();
+}
+
+void BVH::
+splice_subtree(int node_idx, std::vector<Node> const& subtree)
+{
+	/* the subtree root replaces nodes[node_idx], the other nodes are appended */
+	const int offset = static_cast<int>(nodes.size()) - 1;
+	auto relocate = [&](Node n) {
+		if (n.left >= 0) {
+			n.left  += offset;
+			n.right += offset;
+		}
+		return n;
+	};
+	nodes[node_idx] = relocate(subtree[0]);
+	for (size_t j = 1; j < subtree.size(); ++j)
+		nodes.push_back(relocate(subtree[j]));
+}
+
+void BVH::
+reorder_nodes_depth_first()
+{
+	/*
+	 * Renumber the nodes in the order the serial builder allocates them:
+	 * when a node is visited, its children get the next two indices, then
+	 * the left and afterwards the right subtree are visited. Nodes that
+	 * are no longer reachable, such as the old nodes of a rebuilt subtree,
+	 * are dropped.
+	 */
+	std::vector<Node> ordered(nodes.size());
+	std::vector<std::pair<int, int>> stack; /* (old index, new index) */
+	stack.emplace_back(0, 0);
+	int next = 1;
+	while (!stack.empty()) {
+		const int old_idx = stack.back().first;
+		const int new_idx = stack.back().second;
+		stack.pop_back();
+
+		Node n = nodes[old_idx];
+		if (n.left >= 0) {
+			const int old_left  = n.left;
+			const int old_right = n.right;
+			n.left  = next++;
+			n.right = next++;
+			stack.emplace_back(old_right, n.right);
+			stack.emplace_back(old_left,  n.left);
+		}
+		ordered[new_idx] = n;
+	}
+	cg_assert(next <= int(nodes.size()));
+	ordered.resize(next);
+	nodes.swap(ordered);
+}
+
+void BVH::
+refit_internal_nodes()
+{
+	/* children always have larger indices than their parent */
+	for (int i = static_cast<int>(nodes.size()) - 1; i >= 0; --i) {
+		Node &n = nodes[i];
+		if (n.left < 0)
+			continue;
+		n.aabb.min = glm::min(nodes[n.left].aabb.min, nodes[n.right].aabb.min);
+		n.aabb.max = glm::max(nodes[n.left].aabb.max, nodes[n.right].aabb.max);
+	}
+}
+
+float BVH::
+compute_sah_cost() const
+{
+	const float root_area = nodes[0].aabb.surface_area();
+	if (nodes.size() == 1 && nodes[0].num_triangles == 0)
+		return 0.f;
+	if (!(root_area > 0.f))
+		return SAH_COST_INTERSECTION * float(nodes[0].num_triangles);
+
+	float cost = 0.f;
+	for (auto const& n : nodes) {
+		const float area = n.aabb.surface_area() / root_area;
+		if (n.left < 0)
+			cost += SAH_COST_INTERSECTION * float(n.num_triangles) * area;
+		else
+			cost += SAH_COST_TRAVERSAL * area;
+	}
+	return cost;
+}
+
+void BVH::
+compute_subtree_costs(std::vector<float>* cost) const
+{
+	cost->resize(nodes.size());
+	/* children always have larger indices than their parent */
+	for (int i = static_cast<int>(nodes.size()) - 1; i >= 0; --i) {
+		Node const& n = nodes[i];
+		if (n.left < 0) {
+			(*cost)[i] = SAH_COST_INTERSECTION * float(n.num_triangles);
+			continue;
+		}
+		/* the probability that a ray through this node hits a child */
+		const float area = n.aabb.surface_area();
+		const float p_left  = area > 0.f ? nodes[n.left ].aabb.surface_area() / area : 1.f;
+		const float p_right = area > 0.f ? nodes[n.right].aabb.surface_area() / area : 1.f;
+		(*cost)[i] = SAH_COST_TRAVERSAL + p_left * (*cost)[n.left] + p_right * (*cost)[n.right];
+	}
+}
+
 glm::vec3 BVH::
 intersect_count(const Ray &ray, int idx, int depth)
 {
@@ -229,7 +1047,8 @@ intersect_count(const Ray &ray, int idx, int depth)
 void BVH::
 compute_shading_info(Intersection* isect) {
 	cg_assert(isect);
-	auto &material_ = triangle_soup.materials[triangle_soup.material_ids[isect->primitive_id]];
+	cg_assert(triangle_soup.flat_materials.size() == triangle_soup.materials.size());
+	auto &material_ = triangle_soup.flat_materials[triangle_soup.material_ids[isect->primitive_id]];
 	isect->material.evaluate(material_, *isect);
 }
 
@@ -259,6 +1078,7 @@ compute_shading_info(const Ray rays[4], Intersection* isect) {
 	}
 
 	isect->dudv = glm::abs(uv_max - uv_min);
-	auto &material_ = triangle_soup.materials[triangle_soup.material_ids[isect->primitive_id]];
+	cg_assert(triangle_soup.flat_materials.size() == triangle_soup.materials.size());
+	auto &material_ = triangle_soup.flat_materials[triangle_soup.material_ids[isect->primitive_id]];
 	isect->material.evaluate(material_, *isect);
 }
@@ -0,0 +1,343 @@
+#include <cglib/rt/bvh.h>
+#include <cglib/rt/intersection.h>
+#include <cglib/rt/intersection_tests.h>
+#include <cglib/rt/ray_packet.h>
+#include <cglib/rt/triangle_soup.h>
+
+#include <cglib/core/assert.h>
+#include <cglib/core/cpu_features.h>
+
+#if CG_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include <cmath>
+#include <limits>
+
+/*
+ * Packet traversal of the binary BVH in flat_nodes. Every node is tested
+ * against all rays of the packet that hit its parent, four rays per SSE
+ * slab test, after the whole packet has been tested with interval
+ * arithmetic. Once fewer than PACKET_MIN_ACTIVE rays remain, they
+ * continue through the subtree on their own.
+ */
+
+namespace {
+
+const int PACKET_MIN_ACTIVE = 3;
+
+struct PacketState
+{
+	enum { N = RayPacket::MAX_SIZE };
+
+	/* rays as structure of arrays for the SIMD slab test */
+	alignas(16) float ox[N], oy[N], oz[N];
+	alignas(16) float dx[N], dy[N], dz[N];
+	alignas(16) float t_max[N];
+
+	Ray const* rays;
+	glm::vec3 div[N];
+	int nearest[N];
+	glm::vec3 bary[N];
+
+	/* bounds of origins and reciprocal directions, for interval culling */
+	bool interval_valid;
+	glm::vec3 org_min, org_max;
+	glm::vec3 div_min, div_max;
+};
+
+void
+init_packet(PacketState& p, RayPacket const& packet)
+{
+	p.rays = packet.rays;
+	p.interval_valid = packet.size > 0;
+	p.org_min = p.div_min = glm::vec3(std::numeric_limits<float>::max());
+	p.org_max = p.div_max = glm::vec3(-std::numeric_limits<float>::max());
+
+	for (int i = 0; i < PacketState::N; ++i) {
+		const bool valid = i < packet.size;
+		const glm::vec3 o = valid ? packet.rays[i].origin : glm::vec3(0.f);
+		const glm::vec3 d = valid ? 1.0f / packet.rays[i].direction : glm::vec3(0.f);
+		p.ox[i] = o.x; p.oy[i] = o.y; p.oz[i] = o.z;
+		p.dx[i] = d.x; p.dy[i] = d.y; p.dz[i] = d.z;
+		p.div[i]     = d;
+		p.t_max[i]   = std::numeric_limits<float>::max();
+		p.nearest[i] = -1;
+		p.bary[i]    = glm::vec3(0.f);
+		if (!valid)
+			continue;
+
+		p.org_min = glm::min(p.org_min, o);
+		p.org_max = glm::max(p.org_max, o);
+		p.div_min = glm::min(p.div_min, d);
+		p.div_max = glm::max(p.div_max, d);
+		for (int a = 0; a < 3; ++a) {
+			if (!std::isfinite(d[a]))
+				p.interval_valid = false;
+		}
+	}
+	/* the interval test is only tight if all directions share their signs */
+	for (int a = 0; a < 3; ++a) {
+		if (p.div_min[a] < 0.f && p.div_max[a] > 0.f)
+			p.interval_valid = false;
+	}
+}
+
+/*
+ * Conservative test whether no ray of the packet can hit the node: bounds
+ * the entry and exit distances of all rays using interval arithmetic.
+ */
+inline bool
+packet_misses(BVH::FlatNode const& n, PacketState const& p, float t_max)
+{
+	float t_near = 0.f;
+	float t_far  = t_max;
+	for (int a = 0; a < 3; ++a) {
+		const float b0_lo = n.aabb_min[a] - p.org_max[a], b0_hi = n.aabb_min[a] - p.org_min[a];
+		const float b1_lo = n.aabb_max[a] - p.org_max[a], b1_hi = n.aabb_max[a] - p.org_min[a];
+		const float d_lo = p.div_min[a], d_hi = p.div_max[a];
+
+		const float t0_lo = std::min(std::min(b0_lo * d_lo, b0_lo * d_hi), std::min(b0_hi * d_lo, b0_hi * d_hi));
+		const float t0_hi = std::max(std::max(b0_lo * d_lo, b0_lo * d_hi), std::max(b0_hi * d_lo, b0_hi * d_hi));
+		const float t1_lo = std::min(std::min(b1_lo * d_lo, b1_lo * d_hi), std::min(b1_hi * d_lo, b1_hi * d_hi));
+		const float t1_hi = std::max(std::max(b1_lo * d_lo, b1_lo * d_hi), std::max(b1_hi * d_lo, b1_hi * d_hi));
+
+		t_near = std::max(t_near, std::min(t0_lo, t1_lo));
+		t_far  = std::min(t_far,  std::max(t0_hi, t1_hi));
+	}
+	return t_near > t_far;
+}
+
+/* same as AABB::intersect, for ray i of the packet */
+inline bool
+intersect_node(BVH::FlatNode const& n, PacketState const& p, int i, float& t_min, float& t_max)
+{
+	const Ray &ray = p.rays[i];
+	glm::vec3 t_1 = (n.aabb_min - ray.origin) * p.div[i];
+	glm::vec3 t_2 = (n.aabb_max - ray.origin) * p.div[i];
+
+	glm::vec3 t_min2 = glm::min(t_1, t_2);
+	glm::vec3 t_max2 = glm::max(t_1, t_2);
+
+	t_min = glm::max(glm::max(t_min2.x, t_min2.y), glm::max(t_min2.z, t_min));
+	t_max = glm::min(glm::min(t_max2.x, t_max2.y), glm::min(t_max2.z, t_max));
+
+	return t_min <= t_max;
+}
+
+/*
+ * Mask of the rays in active that hit the node before their current
+ * nearest hit.
+ */
+inline unsigned
+node_hit_mask(BVH::FlatNode const& n, PacketState const& p, unsigned active)
+{
+	unsigned mask = 0;
+	for (int g = 0; g < PacketState::N; g += 4) {
+		if (!((active >> g) & 0xfu))
+			continue;
+#if CG_HAVE_SSE2
+		const __m128 ox = _mm_load_ps(p.ox + g);
+		const __m128 oy = _mm_load_ps(p.oy + g);
+		const __m128 oz = _mm_load_ps(p.oz + g);
+		const __m128 dx = _mm_load_ps(p.dx + g);
+		const __m128 dy = _mm_load_ps(p.dy + g);
+		const __m128 dz = _mm_load_ps(p.dz + g);
+
+		const __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.aabb_min.x), ox), dx);
+		const __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.aabb_min.y), oy), dy);
+		const __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.aabb_min.z), oz), dz);
+		const __m128 t2x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.aabb_max.x), ox), dx);
+		const __m128 t2y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.aabb_max.y), oy), dy);
+		const __m128 t2z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(n.aabb_max.z), oz), dz);
+
+		/* operand order matches glm::min and glm::max for NaNs */
+		const __m128 t0 = _mm_max_ps(
+			_mm_max_ps(_mm_setzero_ps(), _mm_min_ps(t2z, t1z)),
+			_mm_max_ps(_mm_min_ps(t2y, t1y), _mm_min_ps(t2x, t1x)));
+		const __m128 t1 = _mm_min_ps(
+			_mm_min_ps(_mm_load_ps(p.t_max + g), _mm_max_ps(t2z, t1z)),
+			_mm_min_ps(_mm_max_ps(t2y, t1y), _mm_max_ps(t2x, t1x)));
+
+		mask |= unsigned(_mm_movemask_ps(_mm_cmple_ps(t0, t1))) << g;
+#else
+		for (int i = g; i < g + 4; ++i) {
+			float t_min = 0.f;
+			float t_max = p.t_max[i];
+			if (intersect_node(n, p, i, t_min, t_max))
+				mask |= 1u << i;
+		}
+#endif
+	}
+	return mask & active;
+}
+
+inline void
+intersect_leaf(BVH const& bvh, BVH::FlatNode const& n, PacketState& p, int i)
+{
+	const Ray &ray = p.rays[i];
+	for (int j = n.offset; j < n.offset + n.num_triangles; j++) {
+		const BVH::FlatTriangle &tri = bvh.flat_triangles[j];
+		float dist;
+		glm::vec3 b;
+		if (intersect_triangle_precomputed(ray.origin, ray.direction,
+				tri.v0, tri.edge1, tri.edge2, b, dist)) {
+			if (dist < p.t_max[i] || p.nearest[i] == -1) {
+				p.t_max[i]   = dist;
+				p.bary[i]    = b;
+				p.nearest[i] = j;
+			}
+		}
+	}
+}
+
+/*
+ * Continue ray i on its own through the subtree below node start, in the
+ * same way as BVH::traverse_binary.
+ */
+void
+traverse_single(BVH const& bvh, int start, PacketState& p, int i)
+{
+	int stack[64];
+	int stack_size = 0;
+	stack[stack_size++] = start;
+
+	while (stack_size > 0) {
+		const int idx = stack[--stack_size];
+		const BVH::FlatNode &n = bvh.flat_nodes[idx];
+		if (n.num_triangles > 0) {
+			intersect_leaf(bvh, n, p, i);
+			continue;
+		}
+
+		const int left  = idx + 1;
+		const int right = n.offset;
+		float t_min_l = 0, t_max_l = p.t_max[i];
+		float t_min_r = 0, t_max_r = p.t_max[i];
+		const bool il = intersect_node(bvh.flat_nodes[left ], p, i, t_min_l, t_max_l);
+		const bool ir = intersect_node(bvh.flat_nodes[right], p, i, t_min_r, t_max_r);
+		if (il && ir) {
+			stack[stack_size++] = t_min_l < t_min_r ? right : left;
+			stack[stack_size++] = t_min_l < t_min_r ? left : right;
+		}
+		else if (il || ir) {
+			stack[stack_size++] = il ? left : right;
+		}
+	}
+}
+
+inline int
+count_bits(unsigned mask)
+{
+	int count = 0;
+	for (; mask; mask &= mask - 1)
+		++count;
+	return count;
+}
+
+inline int
+lowest_bit(unsigned mask)
+{
+	int i = 0;
+	while (!(mask & (1u << i)))
+		++i;
+	return i;
+}
+
+}
+
+void BVH::
+intersect_packet_local(RayPacket const& packet, int nearest[], float dist[], glm::vec3 bary[]) const
+{
+	cg_assert(packet.size <= RayPacket::MAX_SIZE);
+
+	PacketState p;
+	init_packet(p, packet);
+
+	struct Entry {
+		int node;
+		unsigned active;
+	};
+	Entry stack[64];
+	int stack_size = 0;
+	if (!flat_nodes.empty() && packet.size > 0)
+		stack[stack_size++] = { 0, (1u << packet.size) - 1 };
+
+	while (stack_size > 0) {
+		const Entry e = stack[--stack_size];
+		const FlatNode &n = flat_nodes[e.node];
+
+		if (p.interval_valid) {
+			float t_max = 0.f;
+			for (int i = 0; i < packet.size; ++i) {
+				if (e.active & (1u << i))
+					t_max = std::max(t_max, p.t_max[i]);
+			}
+			if (packet_misses(n, p, t_max))
+				continue;
+		}
+
+		const unsigned mask = node_hit_mask(n, p, e.active);
+		if (!mask)
+			continue;
+
+		if (n.num_triangles > 0) {
+			for (int i = 0; i < packet.size; ++i) {
+				if (mask & (1u << i))
+					intersect_leaf(*this, n, p, i);
+			}
+			continue;
+		}
+
+		if (count_bits(mask) < PACKET_MIN_ACTIVE) { /* diverged */
+			for (int i = 0; i < packet.size; ++i) {
+				if (mask & (1u << i))
+					traverse_single(*this, e.node, p, i);
+			}
+			continue;
+		}
+
+		/* visit the child that the first active ray enters first */
+		const int left  = e.node + 1;
+		const int right = n.offset;
+		const int r = lowest_bit(mask);
+		float t_min_l = 0, t_max_l = p.t_max[r];
+		float t_min_r = 0, t_max_r = p.t_max[r];
+		intersect_node(flat_nodes[left ], p, r, t_min_l, t_max_l);
+		intersect_node(flat_nodes[right], p, r, t_min_r, t_max_r);
+		const bool left_first = t_min_l <= t_min_r;
+		stack[stack_size++] = { left_first ? right : left, mask };
+		stack[stack_size++] = { left_first ? left : right, mask };
+	}
+
+	for (int i = 0; i < packet.size; ++i) {
+		nearest[i] = p.nearest[i] < 0 ? -1 : triangle_indices[p.nearest[i]];
+		dist[i]    = p.t_max[i];
+		bary[i]    = p.bary[i];
+	}
+}
+
+void BVH::
+intersect_packet(RayPacket const& packet, Intersection isects[], bool hits[]) const
+{
+	RayPacket packet_local;
+	packet_local.size = packet.size;
+	for (int i = 0; i < packet.size; ++i)
+		packet_local.rays[i] = transform_ray(packet.rays[i], transform_world_to_object);
+
+	int nearest[RayPacket::MAX_SIZE];
+	float dist[RayPacket::MAX_SIZE];
+	glm::vec3 bary[RayPacket::MAX_SIZE];
+	intersect_packet_local(packet_local, nearest, dist, bary);
+
+	for (int i = 0; i < packet.size; ++i) {
+		hits[i] = nearest[i] >= 0;
+		if (!hits[i])
+			continue;
+		Intersection isect_local;
+		triangle_soup.fill_intersection(&isect_local, nearest[i], dist[i], bary[i]);
+		isects[i] = transform_intersection(isect_local,
+			transform_object_to_world, transform_object_to_world_normal);
+		isects[i].t = glm::length(packet.rays[i].origin - isects[i].position);
+	}
+}
@@ -0,0 +1,418 @@
+#include <cglib/rt/bvh.h>
+#include <cglib/rt/intersection.h>
+#include <cglib/rt/intersection_tests.h>
+#include <cglib/rt/triangle_soup.h>
+
+#include <cglib/core/assert.h>
+#include <cglib/core/cpu_features.h>
+
+#if CG_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+#if CG_HAVE_AVX
+#include <immintrin.h>
+#endif
+
+#include <iostream>
+#include <limits>
+
+/*
+ * Wide BVH traversal. The binary tree in flat_nodes is collapsed into
+ * nodes with up to 4 or 8 children, and all children of a node are tested
+ * against the ray at once. The slab test computes exactly what
+ * AABB::intersect computes, lane by lane.
+ */
+
+namespace {
+
+/*
+ * Each traversal step pops one entry and pushes at most N-1 more, so the
+ * stack needs (N-1) entries per level of the tree.
+ */
+const int WIDE_STACK_SIZE = 64 * 7 + 1;
+
+struct WideStackEntry
+{
+	int child;
+	int num_triangles; /* 0 for inner nodes */
+	float t_near;
+};
+
+inline float
+surface_area(glm::vec3 const& min, glm::vec3 const& max)
+{
+	const glm::vec3 d = glm::max(max - min, glm::vec3(0.f));
+	return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+/*
+ * Collapse the binary subtree rooted at flat_idx into wide nodes. Inner
+ * children are opened, largest surface area first, until the node is full.
+ */
+template <int N>
+int
+collapse(BVH const& bvh, int flat_idx, std::vector<BVH::WideNode<N>>& out)
+{
+	auto const& flat = bvh.flat_nodes;
+	const int wide_idx = static_cast<int>(out.size());
+	out.push_back(BVH::WideNode<N>());
+
+	int children[N];
+	int num_children = 0;
+	if (flat[flat_idx].num_triangles > 0) {
+		/* only happens at the root of a single leaf tree */
+		children[num_children++] = flat_idx;
+	}
+	else {
+		children[num_children++] = flat_idx + 1;
+		children[num_children++] = flat[flat_idx].offset;
+	}
+
+	while (num_children < N) {
+		int best = -1;
+		float best_area = -1.f;
+		for (int i = 0; i < num_children; ++i) {
+			BVH::FlatNode const& c = flat[children[i]];
+			if (c.num_triangles > 0)
+				continue;
+			const float area = surface_area(c.aabb_min, c.aabb_max);
+			if (area > best_area) {
+				best_area = area;
+				best = i;
+			}
+		}
+		if (best < 0)
+			break;
+		const int c = children[best];
+		children[best] = c + 1;
+		children[num_children++] = flat[c].offset;
+	}
+
+	for (int i = 0; i < num_children; ++i) {
+		BVH::FlatNode const& c = flat[children[i]];
+		const int child = c.num_triangles > 0 ? c.offset : collapse(bvh, children[i], out);
+		BVH::WideNode<N>& w = out[wide_idx];
+		w.min_x[i] = c.aabb_min.x;
+		w.min_y[i] = c.aabb_min.y;
+		w.min_z[i] = c.aabb_min.z;
+		w.max_x[i] = c.aabb_max.x;
+		w.max_y[i] = c.aabb_max.y;
+		w.max_z[i] = c.aabb_max.z;
+		w.child[i] = child;
+		w.num_triangles[i] = c.num_triangles;
+	}
+	out[wide_idx].num_children = num_children;
+	return wide_idx;
+}
+
+/*
+ * The kernels return a bit mask of the children hit within [0, t_max] and
+ * store the entry distances in t_near. Arguments of min and max are in the
+ * order that matches glm::min and glm::max for NaNs.
+ */
+template <int N>
+struct ScalarKernel
+{
+	static int
+	hit_mask(BVH::WideNode<N> const& n, Ray const& ray, glm::vec3 const& div, float t_max, float t_near[N])
+	{
+		int mask = 0;
+		for (int i = 0; i < n.num_children; ++i) {
+			const glm::vec3 t_1 = (glm::vec3(n.min_x[i], n.min_y[i], n.min_z[i]) - ray.origin) * div;
+			const glm::vec3 t_2 = (glm::vec3(n.max_x[i], n.max_y[i], n.max_z[i]) - ray.origin) * div;
+
+			const glm::vec3 t_min2 = glm::min(t_1, t_2);
+			const glm::vec3 t_max2 = glm::max(t_1, t_2);
+
+			const float t0 = glm::max(glm::max(t_min2.x, t_min2.y), glm::max(t_min2.z, 0.f));
+			const float t1 = glm::min(glm::min(t_max2.x, t_max2.y), glm::min(t_max2.z, t_max));
+
+			t_near[i] = t0;
+			if (t0 <= t1)
+				mask |= 1 << i;
+		}
+		return mask;
+	}
+};
+
+#if CG_HAVE_SSE2
+inline int
+hit_mask_sse(float const* min_x, float const* min_y, float const* min_z,
+             float const* max_x, float const* max_y, float const* max_z,
+             Ray const& ray, glm::vec3 const& div, float t_max, float* t_near)
+{
+	const __m128 ox = _mm_set1_ps(ray.origin.x);
+	const __m128 oy = _mm_set1_ps(ray.origin.y);
+	const __m128 oz = _mm_set1_ps(ray.origin.z);
+	const __m128 dx = _mm_set1_ps(div.x);
+	const __m128 dy = _mm_set1_ps(div.y);
+	const __m128 dz = _mm_set1_ps(div.z);
+
+	const __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(min_x), ox), dx);
+	const __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(min_y), oy), dy);
+	const __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(min_z), oz), dz);
+	const __m128 t2x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(max_x), ox), dx);
+	const __m128 t2y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(max_y), oy), dy);
+	const __m128 t2z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(max_z), oz), dz);
+
+	const __m128 t_min_x = _mm_min_ps(t2x, t1x);
+	const __m128 t_min_y = _mm_min_ps(t2y, t1y);
+	const __m128 t_min_z = _mm_min_ps(t2z, t1z);
+	const __m128 t_max_x = _mm_max_ps(t2x, t1x);
+	const __m128 t_max_y = _mm_max_ps(t2y, t1y);
+	const __m128 t_max_z = _mm_max_ps(t2z, t1z);
+
+	const __m128 t0 = _mm_max_ps(
+		_mm_max_ps(_mm_setzero_ps(), t_min_z),
+		_mm_max_ps(t_min_y, t_min_x));
+	const __m128 t1 = _mm_min_ps(
+		_mm_min_ps(_mm_set1_ps(t_max), t_max_z),
+		_mm_min_ps(t_max_y, t_max_x));
+
+	_mm_storeu_ps(t_near, t0);
+	return _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+}
+
+template <int N>
+struct SSEKernel
+{
+	static_assert(N % 4 == 0, "SSE kernel needs a multiple of 4 children");
+
+	static int
+	hit_mask(BVH::WideNode<N> const& n, Ray const& ray, glm::vec3 const& div, float t_max, float t_near[N])
+	{
+		int mask = 0;
+		for (int i = 0; i < N; i += 4) {
+			mask |= hit_mask_sse(n.min_x + i, n.min_y + i, n.min_z + i,
+				n.max_x + i, n.max_y + i, n.max_z + i,
+				ray, div, t_max, t_near + i) << i;
+		}
+		return mask & ((1 << n.num_children) - 1);
+	}
+};
+#endif
+
+#if CG_HAVE_AVX
+struct AVXKernel
+{
+	CG_TARGET_AVX static int
+	hit_mask(BVH::WideNode<8> const& n, Ray const& ray, glm::vec3 const& div, float t_max, float t_near[8])
+	{
+		const __m256 ox = _mm256_set1_ps(ray.origin.x);
+		const __m256 oy = _mm256_set1_ps(ray.origin.y);
+		const __m256 oz = _mm256_set1_ps(ray.origin.z);
+		const __m256 dx = _mm256_set1_ps(div.x);
+		const __m256 dy = _mm256_set1_ps(div.y);
+		const __m256 dz = _mm256_set1_ps(div.z);
+
+		const __m256 t1x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(n.min_x), ox), dx);
+		const __m256 t1y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(n.min_y), oy), dy);
+		const __m256 t1z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(n.min_z), oz), dz);
+		const __m256 t2x = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(n.max_x), ox), dx);
+		const __m256 t2y = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(n.max_y), oy), dy);
+		const __m256 t2z = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(n.max_z), oz), dz);
+
+		const __m256 t_min_x = _mm256_min_ps(t2x, t1x);
+		const __m256 t_min_y = _mm256_min_ps(t2y, t1y);
+		const __m256 t_min_z = _mm256_min_ps(t2z, t1z);
+		const __m256 t_max_x = _mm256_max_ps(t2x, t1x);
+		const __m256 t_max_y = _mm256_max_ps(t2y, t1y);
+		const __m256 t_max_z = _mm256_max_ps(t2z, t1z);
+
+		const __m256 t0 = _mm256_max_ps(
+			_mm256_max_ps(_mm256_setzero_ps(), t_min_z),
+			_mm256_max_ps(t_min_y, t_min_x));
+		const __m256 t1 = _mm256_min_ps(
+			_mm256_min_ps(_mm256_set1_ps(t_max), t_max_z),
+			_mm256_min_ps(t_max_y, t_max_x));
+
+		_mm256_storeu_ps(t_near, t0);
+		return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ))
+			& ((1 << n.num_children) - 1);
+	}
+};
+#endif
+
+/*
+ * Find the nearest triangle hit with a distance in [t_min, t_max), returns
+ * its index in flat_triangles or -1. Children are pushed sorted by entry
+ * distance so that the nearest one is visited first, entries behind the
+ * current hit are skipped when popped. With any_hit, the first hit found
+ * in the range is returned.
+ */
+template <int N, class Kernel, bool any_hit>
+int
+intersect_wide(BVH const& bvh, std::vector<BVH::WideNode<N>> const& nodes,
+	Ray const& ray, float t_min, float t_max, float* out_dist, glm::vec3* out_bary)
+{
+	WideStackEntry stack[WIDE_STACK_SIZE];
+	int stack_size = 0;
+
+	float min_dist = t_max;
+	glm::vec3 bary(0.f);
+	int nearest = -1;
+
+	const glm::vec3 div = 1.0f / ray.direction;
+
+	stack[stack_size++] = { 0, 0, 0.f };
+	while (stack_size > 0) {
+		const WideStackEntry e = stack[--stack_size];
+		if (e.t_near > min_dist)
+			continue;
+
+		if (e.num_triangles > 0) { /* leaf, intersect triangles */
+			for (int i = e.child; i < e.child + e.num_triangles; i++) {
+				const BVH::FlatTriangle &tri = bvh.flat_triangles[i];
+				float dist;
+				glm::vec3 b;
+				if (intersect_triangle_precomputed(ray.origin, ray.direction,
+						tri.v0, tri.edge1, tri.edge2, b, dist)) {
+					if (dist >= t_min && dist < min_dist) {
+						min_dist = dist;
+						bary = b;
+						nearest = i;
+						if (any_hit)
+							break;
+					}
+				}
+			}
+			if (any_hit && nearest >= 0)
+				break;
+			continue;
+		}
+
+		BVH::WideNode<N> const& n = nodes[e.child];
+		float t_near[N];
+		const int mask = Kernel::hit_mask(n, ray, div, min_dist, t_near);
+		if (!mask)
+			continue;
+
+		cg_assert(stack_size + N <= WIDE_STACK_SIZE);
+		const int first = stack_size;
+		for (int i = 0; i < N; ++i) {
+			if (!(mask & (1 << i)))
+				continue;
+			const WideStackEntry c = { n.child[i], n.num_triangles[i], t_near[i] };
+			int j = stack_size++;
+			while (j > first && stack[j - 1].t_near < c.t_near) {
+				stack[j] = stack[j - 1];
+				--j;
+			}
+			stack[j] = c;
+		}
+	}
+
+	*out_dist = min_dist;
+	*out_bary = bary;
+	return nearest;
+}
+
+template <int N, class Kernel>
+int
+intersect_wide(BVH const& bvh, std::vector<BVH::WideNode<N>> const& nodes,
+	Ray const& ray, float t_min, float t_max, bool any_hit, float* out_dist, glm::vec3* out_bary)
+{
+	if (any_hit)
+		return intersect_wide<N, Kernel, true>(bvh, nodes, ray, t_min, t_max, out_dist, out_bary);
+	return intersect_wide<N, Kernel, false>(bvh, nodes, ray, t_min, t_max, out_dist, out_bary);
+}
+
+#if CG_HAVE_AVX
+/*
+ * The whole traversal is inlined here and compiled for AVX, otherwise
+ * every node test would be a call into the AVX kernel.
+ */
+#if defined(__GNUC__)
+__attribute__((flatten))
+#endif
+CG_TARGET_AVX int
+intersect_wide8_avx(BVH const& bvh, Ray const& ray, float t_min, float t_max, bool any_hit,
+	float* out_dist, glm::vec3* out_bary)
+{
+	return intersect_wide<8, AVXKernel>(bvh, bvh.wide8_nodes, ray, t_min, t_max, any_hit, out_dist, out_bary);
+}
+#endif
+
+const char*
+kernel_name(int width)
+{
+	if (width == 8 && CG_HAVE_AVX && cpu_features().avx)
+		return "AVX";
+	if (CG_HAVE_SSE2)
+		return "SSE";
+	return "scalar";
+}
+
+}
+
+int BVH::
+resolve_traversal_width(RaytracingParameters::BVHWidth width)
+{
+	switch (width) {
+	case RaytracingParameters::BVH_WIDTH_2: return 2;
+	case RaytracingParameters::BVH_WIDTH_4: return 4;
+	case RaytracingParameters::BVH_WIDTH_8: return 8;
+	case RaytracingParameters::BVH_WIDTH_AUTO: break;
+	}
+	if (cpu_features().avx)
+		return 8;
+	if (cpu_features().sse2)
+		return 4;
+	return 2;
+}
+
+void BVH::
+set_traversal_width(RaytracingParameters::BVHWidth width)
+{
+	traversal_width = resolve_traversal_width(width);
+	build_wide();
+}
+
+void BVH::
+build_wide()
+{
+	wide4_nodes.clear();
+	wide8_nodes.clear();
+	if (flat_nodes.empty() || traversal_width <= 2)
+		return;
+
+	size_t num_nodes;
+	if (traversal_width == 4) {
+		wide4_nodes.reserve(flat_nodes.size() / 2 + 1);
+		collapse<4>(*this, 0, wide4_nodes);
+		num_nodes = wide4_nodes.size();
+	}
+	else {
+		cg_assert(traversal_width == 8);
+		wide8_nodes.reserve(flat_nodes.size() / 4 + 1);
+		collapse<8>(*this, 0, wide8_nodes);
+		num_nodes = wide8_nodes.size();
+	}
+
+	if (verbose)
+		std::cout << "[BVH] " << traversal_width << "-wide traversal ("
+			<< kernel_name(traversal_width) << "), "
+			<< num_nodes << " nodes" << std::endl;
+}
+
+int BVH::
+traverse_wide(Ray const& ray, float t_min, float t_max, bool any_hit, float* dist, glm::vec3* bary) const
+{
+	if (traversal_width == 4) {
+#if CG_HAVE_SSE2
+		return intersect_wide<4, SSEKernel<4>>(*this, wide4_nodes, ray, t_min, t_max, any_hit, dist, bary);
+#else
+		return intersect_wide<4, ScalarKernel<4>>(*this, wide4_nodes, ray, t_min, t_max, any_hit, dist, bary);
+#endif
+	}
+
+#if CG_HAVE_AVX
+	if (cpu_features().avx)
+		return intersect_wide8_avx(*this, ray, t_min, t_max, any_hit, dist, bary);
+	return intersect_wide<8, SSEKernel<8>>(*this, wide8_nodes, ray, t_min, t_max, any_hit, dist, bary);
+#elif CG_HAVE_SSE2
+	return intersect_wide<8, SSEKernel<8>>(*this, wide8_nodes, ray, t_min, t_max, any_hit, dist, bary);
+#else
+	return intersect_wide<8, ScalarKernel<8>>(*this, wide8_nodes, ray, t_min, t_max, any_hit, dist, bary);
+#endif
+}
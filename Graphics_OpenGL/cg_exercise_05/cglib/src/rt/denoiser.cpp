@@ -0,0 +1,237 @@
+#include <cglib/rt/denoiser.h>
+
+#include <cglib/rt/intersection.h>
+#include <cglib/rt/object.h>
+#include <cglib/rt/ray.h>
+#include <cglib/rt/raytracing_context.h>
+#include <cglib/rt/render_data.h>
+#include <cglib/rt/renderer.h>
+#include <cglib/rt/scene.h>
+
+#include <cglib/core/assert.h>
+#include <cglib/core/image.h>
+#include <cglib/core/thread_local_data.h>
+#include <cglib/core/thread_pool.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/* rows per job */
+const int GRAIN_SIZE = 8;
+
+/* the cosine between two normals is squared this often, for a power of 64 */
+const int SIGMA_NORMAL_LOG2 = 6;
+
+/* distance from the tangent plane, relative to the depth */
+const float SIGMA_PLANE = 0.01f;
+
+/* difference of the albedos */
+const float SIGMA_ALBEDO = 0.1f;
+
+/* luminance difference, relative to the standard deviation of the noise */
+const float SIGMA_LUMINANCE = 4.f;
+
+const float KERNEL[3] = { 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+
+inline float
+luminance(glm::vec3 const& c)
+{
+	return glm::dot(c, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+/*
+ * How much the pixel q counts for the pixel p, not counting the color:
+ * the weight of the normals times exp(-exponent).
+ */
+inline float
+geometry_weight(GuideBuffers const& guides, int p, int q, float* exponent)
+{
+	if (guides.depth[q] == 0.f)
+		return 0.f;
+	float w_normal = std::max(0.f, glm::dot(guides.normal[p], guides.normal[q]));
+	for (int i = 0; i < SIGMA_NORMAL_LOG2; ++i)
+		w_normal *= w_normal;
+	const float plane      = std::abs(glm::dot(guides.normal[p], guides.position[q] - guides.position[p]));
+	const glm::vec3 albedo = guides.albedo[p] - guides.albedo[q];
+	*exponent = plane / (SIGMA_PLANE * guides.depth[p])
+		+ glm::dot(albedo, albedo) / (SIGMA_ALBEDO * SIGMA_ALBEDO);
+	return w_normal;
+}
+
+/*
+ * One iteration of the filter with the given distance between taps, from
+ * the colors and their variance in in.w to out.
+ */
+void
+filter_rows(GuideBuffers const& guides, int step, glm::vec4 const* in, glm::vec4* out, int y0, int y1)
+{
+	const int width  = guides.width;
+	const int height = guides.height;
+	for (int y = y0; y < y1; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			const int p = y * width + x;
+			if (guides.depth[p] == 0.f)
+			{
+				out[p] = in[p];
+				continue;
+			}
+
+			const float l_p   = luminance(glm::vec3(in[p]));
+			const float inv_sigma = 1.f / (SIGMA_LUMINANCE * std::sqrt(std::max(in[p].w, 0.f)) + 1e-4f);
+			glm::vec3 sum(0.f);
+			float sum_variance = 0.f;
+			float sum_weight   = 0.f;
+			for (int j = -2; j <= 2; ++j)
+			{
+				const int qy = y + j * step;
+				if (qy < 0 || qy >= height)
+					continue;
+				for (int i = -2; i <= 2; ++i)
+				{
+					const int qx = x + i * step;
+					if (qx < 0 || qx >= width)
+						continue;
+					const int q = qy * width + qx;
+					float exponent = 0.f;
+					float w = geometry_weight(guides, p, q, &exponent);
+					if (w == 0.f)
+						continue;
+					exponent += std::abs(l_p - luminance(glm::vec3(in[q]))) * inv_sigma;
+					w *= KERNEL[std::abs(i)] * KERNEL[std::abs(j)] * std::exp(-exponent);
+					sum          += w * glm::vec3(in[q]);
+					sum_variance += w * w * in[q].w;
+					sum_weight   += w;
+				}
+			}
+			/* the center always counts, so sum_weight > 0 */
+			out[p] = glm::vec4(sum / sum_weight, sum_variance / (sum_weight * sum_weight));
+		}
+	}
+}
+
+}
+
+bool
+denoise_supported(RaytracingParameters const& params)
+{
+	switch (params.render_mode) {
+	case RaytracingParameters::RECURSIVE:
+	case RaytracingParameters::PATH_TRACE:
+		return !params.stereo && !(params.dof && params.dof_rays > 0);
+	default:
+		return false;
+	}
+}
+
+bool
+capture_guides(RaytracingContext const& context, ThreadPool& thread_pool, GuideBuffers* guides,
+	std::atomic<bool> const* terminate)
+{
+	cg_assert(guides);
+
+	const int width  = context.params.image_width;
+	const int height = context.params.image_height;
+	guides->width  = width;
+	guides->height = height;
+	guides->normal.assign(width * height, glm::vec3(0.f));
+	guides->position.assign(width * height, glm::vec3(0.f));
+	guides->albedo.assign(width * height, glm::vec3(1.f));
+	guides->depth.assign(width * height, 0.f);
+
+	thread_pool.parallel_for(0, height, GRAIN_SIZE, [&](int y0, int y1) {
+		ThreadLocalData tld;
+		RenderData data(context, &tld);
+		for (int y = y0; y < y1; ++y)
+		{
+			if (terminate && terminate->load())
+				return;
+
+			for (int x = 0; x < width; ++x)
+			{
+				const Ray ray = createPrimaryRay(data, float(x) + 0.5f, float(y) + 0.5f);
+				Intersection isect;
+				if (!shoot_ray(data, ray, &isect))
+					continue;
+
+				const int p = y * width + x;
+				const glm::vec3 N = glm::normalize(context.params.normal_mapping ? isect.shading_normal : isect.normal);
+				guides->normal[p]   = glm::dot(N, ray.direction) > 0.f ? -N : N;
+				guides->position[p] = isect.position;
+				guides->albedo[p]   = shading_material(data, isect).k_d;
+				guides->depth[p]    = glm::length(isect.position - ray.origin);
+			}
+		}
+	});
+	return !(terminate && terminate->load());
+}
+
+bool
+denoise(RaytracingContext const& context, ThreadPool& thread_pool, GuideBuffers const& guides, Image* image,
+	std::atomic<bool> const* terminate)
+{
+	cg_assert(image);
+	cg_assert(image->getWidth() == guides.width && image->getHeight() == guides.height);
+
+	const int width  = guides.width;
+	const int height = guides.height;
+	std::vector<glm::vec4> a(width * height);
+	std::vector<glm::vec4> b(width * height);
+
+	/* the colors, and the variance of their luminance in the 5x5 neighborhood */
+	glm::vec4* pixels = image->getPixels();
+	for (int p = 0; p < width * height; ++p)
+		a[p] = glm::vec4(glm::vec3(pixels[p]), 0.f);
+	thread_pool.parallel_for(0, height, GRAIN_SIZE, [&](int y0, int y1) {
+		for (int y = y0; y < y1; ++y)
+		{
+			for (int x = 0; x < width; ++x)
+			{
+				const int p = y * width + x;
+				if (guides.depth[p] == 0.f)
+				{
+					b[p] = a[p];
+					continue;
+				}
+				float sum = 0.f, sum2 = 0.f, sum_weight = 0.f;
+				for (int qy = std::max(y - 2, 0); qy <= std::min(y + 2, height - 1); ++qy)
+				{
+					for (int qx = std::max(x - 2, 0); qx <= std::min(x + 2, width - 1); ++qx)
+					{
+						const int q = qy * width + qx;
+						float exponent = 0.f;
+						const float w = geometry_weight(guides, p, q, &exponent) * std::exp(-exponent);
+						if (w == 0.f)
+							continue;
+						const float l = luminance(glm::vec3(a[q]));
+						sum        += w * l;
+						sum2       += w * l * l;
+						sum_weight += w;
+					}
+				}
+				const float mean = sum / sum_weight;
+				b[p] = glm::vec4(glm::vec3(a[p]), std::max(sum2 / sum_weight - mean * mean, 0.f));
+			}
+		}
+	});
+	std::swap(a, b);
+
+	for (int i = 0; i < context.params.denoise_iterations; ++i)
+	{
+		if (terminate && terminate->load())
+			return false;
+		thread_pool.parallel_for(0, height, GRAIN_SIZE, [&](int y0, int y1) {
+			filter_rows(guides, 1 << i, a.data(), b.data(), y0, y1);
+		});
+		std::swap(a, b);
+	}
+
+	if (terminate && terminate->load())
+		return false;
+	for (int p = 0; p < width * height; ++p)
+		pixels[p] = glm::vec4(glm::vec3(a[p]), pixels[p].w);
+	return true;
+}
@@ -1,23 +1,48 @@
 #include <cglib/rt/host_render.h>
+#include <cglib/rt/adaptive.h>
+#include <cglib/rt/aov.h>
+#include <cglib/rt/benchmark.h>
+#include <cglib/rt/denoiser.h>
 #include <cglib/rt/render_data.h>
+#include <cglib/core/allocation_counter.h>
 #include <cglib/core/heatmap.h>
 #include <cglib/rt/ray.h>
 #include <cglib/rt/renderer.h>
 #include <cglib/rt/bvh.h>
+#include <cglib/rt/ray_packet.h>
+#include <cglib/rt/reprojection.h>
+#include <cglib/rt/shading_kernel.h>
+#include <cglib/rt/wavefront.h>
 
 int HostRender::run(RaytracingContext& context, 
 			   PixelFunc const& render_pixel, 
 			   int kill_timeout_seconds,
 			   std::function<void()> const& render_overlay)
 {
-	auto render_pixel_wrapper = [&](int x, int y, RaytracingContext const &ctx, ThreadLocalData *tld)
-		-> glm::vec3
+	// Output variables are recorded by the wrapper, while rendering.
+	AOVBuffers aovs;
+	if (use_aovs(context.params) && !aovs.parse(context.params.aovs))
+	{
+		return 1;
+	}
+	if (!context.params.aovs.empty() && !use_aovs(context.params))
+	{
+		std::cerr << "[AOV] output variables need a noninteractive render in the "
+		             "recursive or path tracing mode, without stereo" << std::endl;
+	}
+
+	auto render_pixel_wrapper = [&](int x, int y, RaytracingContext const &ctx, ThreadLocalData *tld,
+		PacketHit const* packet_hit) -> glm::vec3
 	{
 		RenderData data(context, tld);
+		data.packet_hit = packet_hit;
+		tld->random.begin_pixel(x, y);
+		tld->sampler = &Sampler::get(context.params.sampler);
 
 		switch(context.params.render_mode) {
 
 		case RaytracingParameters::RECURSIVE:
+		case RaytracingParameters::PATH_TRACE:
 			if (context.params.stereo)
 			{
 				data.camera_mode = Camera::StereoLeft;
@@ -26,6 +51,15 @@ int HostRender::run(RaytracingContext& context,
 				auto const right = render_pixel(x, y, ctx, data);
 				return combine_stereo(left, right);
 			}
+			else if (aovs.enabled())
+			{
+				Timer timer;
+				timer.start();
+				auto const color = render_pixel(x, y, ctx, data);
+				timer.stop();
+				aovs.record(x, y, data, static_cast<float>(timer.getElapsedTimeInMilliSec()));
+				return color;
+			}
 			else
 			{
 				return render_pixel(x, y, ctx, data);
@@ -48,6 +82,10 @@ int HostRender::run(RaytracingContext& context,
 		case RaytracingParameters::NUM_RAYS:
 			render_pixel(x, y, ctx, data);
 			return heatmap(float(data.num_cast_rays - 1) / 64.0f);
+		case RaytracingParameters::SAMPLES:
+			/* without adaptive sampling, every pixel takes spp samples,
+			 * there is nothing to trace */
+			return heatmap(1.f / float(ADAPTIVE_MAX_SAMPLE_FACTOR));
 		case RaytracingParameters::NORMAL:
 			render_pixel(x, y, ctx, data);
 			if (context.params.normal_mapping)
@@ -97,6 +135,11 @@ int HostRender::run(RaytracingContext& context,
 		}
 	};
 
+	if (!context.params.benchmark.empty())
+	{
+		return run_benchmark(context, render_pixel);
+	}
+
 	if (context.params.interactive)
 	{
 		return run_interactive(context, render_pixel_wrapper, render_overlay);
@@ -104,7 +147,7 @@ int HostRender::run(RaytracingContext& context,
 	else
 	{
 		return run_noninteractive(context, render_pixel_wrapper, 
-			kill_timeout_seconds);
+			kill_timeout_seconds, &aovs);
 	}
 }
 
@@ -149,17 +192,144 @@ void HostRender::generate_tile_idx(int num_tiles_x, int num_tiles_y, std::vector
 
 // -----------------------------------------------------------------------------
 
+bool HostRender::use_ray_packets(RaytracingParameters const& params)
+{
+	/* Packets hold the rays through the pixel centers. Other primary rays,
+	 * and render modes that time single pixels, would not profit. */
+	switch (params.render_mode) {
+	case RaytracingParameters::RECURSIVE:
+	case RaytracingParameters::PATH_TRACE:
+	case RaytracingParameters::DESATURATE:
+	case RaytracingParameters::NUM_RAYS:
+	case RaytracingParameters::NORMAL:
+	case RaytracingParameters::DUDV:
+		break;
+	default:
+		return false;
+	}
+	return params.ray_packets
+		&& !use_aovs(params)
+		&& !use_progressive(params)
+		&& !use_adaptive(params)
+		&& !use_wavefront(params)
+		&& !params.stereo
+		&& params.spp == 1
+		&& !(params.dof && params.dof_rays > 0);
+}
+
+// -----------------------------------------------------------------------------
+
+bool HostRender::use_wavefront(RaytracingParameters const& params)
+{
+	return params.wavefront && !use_aovs(params) && !use_progressive(params) && !use_adaptive(params) && wavefront_supported(params);
+}
+
+// -----------------------------------------------------------------------------
+
+bool HostRender::use_adaptive(RaytracingParameters const& params)
+{
+	return params.adaptive && !use_aovs(params) && !use_progressive(params) && adaptive_supported(params);
+}
+
+// -----------------------------------------------------------------------------
+
+bool HostRender::use_progressive(RaytracingParameters const& params)
+{
+	/* passes of single samples, so only for the modes that average them */
+	switch (params.render_mode) {
+	case RaytracingParameters::RECURSIVE:
+	case RaytracingParameters::PATH_TRACE:
+		return params.progressive && !params.stereo && !use_aovs(params);
+	default:
+		return false;
+	}
+}
+
+// -----------------------------------------------------------------------------
+
+bool HostRender::use_aovs(RaytracingParameters const& params)
+{
+	/* recorded per pixel by the wrapper, so the other launch paths yield */
+	return !params.aovs.empty() && !params.interactive && AOVBuffers::supported(params);
+}
+
+// -----------------------------------------------------------------------------
+
+bool HostRender::use_reprojection(RaytracingParameters const& params)
+{
+	return params.reprojection && use_progressive(params) && reprojection_supported(params);
+}
+
+// -----------------------------------------------------------------------------
+
+bool HostRender::use_denoiser(RaytracingParameters const& params)
+{
+	return params.denoise && denoise_supported(params);
+}
+
+// -----------------------------------------------------------------------------
+
+void HostRender::launch_denoiser(Image* fb, ThreadPool& thread_pool, RaytracingContext const* context)
+{
+	if (!use_denoiser(context->params))
+		return;
+
+	// A single job, which runs the rows of the filter as nested tasks on
+	// all workers; terminating the pool stops it between iterations.
+	ThreadPool* const pool = &thread_pool;
+	thread_pool.run(1,
+		[=](int, ThreadLocalData*, std::atomic<bool>& terminate)
+		{
+			Timer timer;
+			timer.start();
+			GuideBuffers guides;
+			if (!capture_guides(*context, *pool, &guides, &terminate)
+			 || !denoise(*context, *pool, guides, fb, &terminate))
+				return;
+			timer.stop();
+			if (context->params.verbose)
+				std::cout << "[Denoiser] " << context->params.denoise_iterations << " iterations in "
+				          << timer.getElapsedTimeInMilliSec() << "ms" << std::endl;
+		}
+	);
+}
+
+// -----------------------------------------------------------------------------
+
 int HostRender::run_noninteractive(RaytracingContext& context, 
-	PixelFuncRaw const& render_pixel, int kill_timeout_seconds)
+	PixelFuncRaw const& render_pixel, int kill_timeout_seconds,
+	AOVBuffers* aovs)
 {
 	Image      frame_buffer(context.params.image_width, context.params.image_height);
 	ThreadPool thread_pool(context.params.num_threads);
-	std::vector<glm::ivec2> tile_idx;
+	TileScheduler tiles;
+	FrameHistory history;
 
     Timer timer;
     timer.start();
 	context.scene->refresh_scene(context.params);
-	launch(&frame_buffer, thread_pool, &context, &tile_idx, render_pixel);
+	context.scene->update_bvhs(context.params);
+	context.shading_kernel = select_shading_kernel(context.params);
+	if (use_progressive(context.params))
+	{
+		/* the passes without preview, one after the other, so that the
+		 * image equals the one of the interactive mode after spp passes */
+		history.begin(context, frame_buffer.getWidth(), frame_buffer.getHeight());
+		for (int pass = 0; pass < std::max<int>(context.params.spp, 1); ++pass)
+		{
+			if (pass > 0)
+			{
+				thread_pool.wait();
+				thread_pool.poll_exceptions();
+			}
+			launch_progressive(&frame_buffer, &history, pass, thread_pool, &context, &tiles);
+		}
+	}
+	else
+	{
+		aovs->resize(frame_buffer.getWidth(), frame_buffer.getHeight());
+		launch(&frame_buffer, thread_pool, &context, &tiles, render_pixel);
+	}
 
 	if (kill_timeout_seconds > 0)
 	{
@@ -174,9 +344,13 @@ int HostRender::run_noninteractive(RaytracingContext& context,
 		thread_pool.wait();
 	}
 	thread_pool.poll_exceptions();
+	launch_denoiser(&frame_buffer, thread_pool, &context);
+	thread_pool.wait();
+	thread_pool.poll_exceptions();
     timer.stop();
     std::cout << "Rendering time: " << timer.getElapsedTimeInMilliSec() << "ms" << std::endl;
 	frame_buffer.saveTGA(context.params.output_file_name.c_str(), 2.2f);
+	aovs->save(context, context.params.output_file_name);
 
 	return 0;
 }
@@ -188,6 +362,7 @@ int HostRender::run_interactive(RaytracingContext& context, PixelFuncRaw const&
 {
 	Image      frame_buffer(context.params.image_width, context.params.image_height);
 	ThreadPool thread_pool(context.params.num_threads);
+	TileScheduler tiles;
 	std::vector<glm::ivec2> tile_idx;
 
 	if (!GUI::init_host(context.params))
@@ -195,13 +370,44 @@ int HostRender::run_interactive(RaytracingContext& context, PixelFuncRaw const&
 		return 1;
 	}
 
-	if(context.scene)
+	if(context.scene) {
 		context.scene->set_active_camera();
+		context.scene->update_bvhs(context.params);
+	}
+
+	// Progressive rendering accumulates passes until the next restart,
+	// or until the camera moves, when the history may be reprojected.
+	FrameHistory history;
+	FrameHistory previous;
+	std::atomic<int> num_reused(0);
+	bool reprojected = false;
+	int pass = 0;
+	// The denoiser runs once the image is finished.
+	bool denoised = false;
+	auto const start = [&]()
+	{
+		reprojected = false;
+		denoised = false;
+		thread_pool.terminate();
+		context.shading_kernel = select_shading_kernel(context.params);
+		if (use_progressive(context.params))
+		{
+			frame_buffer.clear(glm::vec4(0.f));
+			history.begin(context, frame_buffer.getWidth(), frame_buffer.getHeight());
+			pass = context.params.preview_scale > 1 ? -1 : 0;
+			launch_progressive(&frame_buffer, &history, pass, thread_pool, &context, &tiles);
+		}
+		else
+		{
+			launch(&frame_buffer, thread_pool, &context, &tiles, render_pixel);
+		}
+	};
     
 	// Launch first render.
-	launch(&frame_buffer, thread_pool, &context, &tile_idx, render_pixel);
+	start();
 
 	auto time_last_frame = std::chrono::high_resolution_clock::now();
+	auto const time_start = time_last_frame;
 
 	RaytracingParameters oldParams = context.params;
 	while (GUI::keep_running())
@@ -211,8 +417,23 @@ int HostRender::run_interactive(RaytracingContext& context, PixelFuncRaw const&
 
 		// Restart rendering if parameters have changed.
 		auto cam = Camera::get_active();
-		if ((cam && cam->requires_restart())
-		|| context.params.change_requires_restart(oldParams))
+		bool const camera_moved   = cam && cam->requires_restart();
+		bool const params_changed = context.params.change_requires_restart(oldParams);
+		if (camera_moved && !params_changed
+		 && use_reprojection(context.params) && pass >= 0)
+		{
+			// Only the view changed, and there is a history to reuse.
+			thread_pool.terminate();
+			std::swap(history, previous);
+			history.begin(context, frame_buffer.getWidth(), frame_buffer.getHeight());
+			history.first_sample = previous.first_sample + pass + 1;
+			pass = 0;
+			num_reused = 0;
+			reprojected = true;
+			denoised = false;
+			launch_reprojection(&frame_buffer, &previous, &history, &num_reused, thread_pool, &context, &tile_idx);
+		}
+		else if (camera_moved || params_changed)
 		{
 			thread_pool.terminate();
 			if (oldParams.scene != context.params.scene) {
@@ -234,20 +455,36 @@ int HostRender::run_interactive(RaytracingContext& context, PixelFuncRaw const&
 				cg_assert(context.scene);
 				context.scene->set_active_camera();
 			}
-			if(context.params.spp < oldParams.spp) {
-				while(int(sqrtf(static_cast<float>(context.params.spp))) * int(sqrtf(static_cast<float>(context.params.spp))) != context.params.spp
-						&& context.params.spp >= 1) {
-					context.params.spp--;
-				}
-			}
-			else {
-				while(int(sqrtf(static_cast<float>(context.params.spp))) * int(sqrtf(static_cast<float>(context.params.spp))) != context.params.spp) {
-					context.params.spp++;
-				}
-			}
 			context.scene->refresh_scene(context.params);
+			context.scene->update_bvhs(context.params);
 			oldParams = context.params;
-			launch(&frame_buffer, thread_pool, &context, &tile_idx, render_pixel);
+			start();
+		}
+		// Deform an animated scene once the last frame is done; only the
+		// changed objects are refit.
+		else if (context.params.animate_scene && thread_pool.done()
+		      && context.scene->animate(std::chrono::duration<float>(
+		             std::chrono::high_resolution_clock::now() - time_start).count()))
+		{
+			context.scene->update_bvhs(context.params);
+			start();
+		}
+		// Add the next pass while the view stays the same.
+		else if (use_progressive(context.params)
+		      && pass + 1 < int(context.params.spp)
+		      && thread_pool.done())
+		{
+			if (reprojected && pass == 0 && context.params.verbose)
+			{
+				std::cout << "[Reprojection] reused " << num_reused.load() << " of "
+				          << history.pixels.size() << " pixels" << std::endl;
+			}
+			launch_progressive(&frame_buffer, &history, ++pass, thread_pool, &context, &tiles);
+		}
+		else if (!denoised && thread_pool.done())
+		{
+			launch_denoiser(&frame_buffer, thread_pool, &context);
+			denoised = true;
 		}
 
 		// Update the texture displayed online in regular intervals so that
@@ -260,6 +497,8 @@ int HostRender::run_interactive(RaytracingContext& context, PixelFuncRaw const&
 		}
 	}
 
+	// The jobs use the buffers above.
+	thread_pool.terminate();
 	GUI::cleanup();
 
 	return 0;
@@ -270,7 +509,7 @@ int HostRender::run_interactive(RaytracingContext& context, PixelFuncRaw const&
 void HostRender::launch(Image* fb, 
 		         ThreadPool& thread_pool, 
 				 RaytracingContext const* context, 
-				 std::vector<glm::ivec2>* tile_idx,
+				 TileScheduler* tiles,
 				 PixelFuncRaw render_pixel)
 {
     if (!thread_pool.enough_progress())
@@ -288,45 +527,232 @@ void HostRender::launch(Image* fb,
 	int const tile_size   = context->params.tile_size;
 	int const num_tiles_x = static_cast<int>(std::ceil(float(width) / float(tile_size)));
 	int const num_tiles_y = static_cast<int>(std::ceil(float(height) / float(tile_size)));
-	int const num_tiles   = num_tiles_x * num_tiles_y;
-
-	// New tile indices.
-	generate_tile_idx(num_tiles_x, num_tiles_y, tile_idx);
 
-	// Launch threads.
-	thread_pool.run<ThreadLocalData>(num_tiles, 
+	// New tile indices, and the jobs in the order of their cost. Adaptive
+	// sampling spends its budget per tile, so its tiles are not split.
+	std::vector<glm::ivec2> tile_idx;
+	generate_tile_idx(num_tiles_x, num_tiles_y, &tile_idx);
+	tiles->plan(width, height, tile_size, tile_idx, thread_pool.num_threads(),
+		context->params.tile_scheduling, !use_adaptive(context->params), context->params.verbose);
+
+	// Packet dimensions, if primary rays are traced in packets.
+	bool const packets   = use_ray_packets(context->params);
+	int const packet_w   = (context->params.ray_packet_size == RaytracingParameters::RAY_PACKET_4) ? 2 : 4;
+	int const packet_h   = int(context->params.ray_packet_size) / packet_w;
+	bool const wavefront = use_wavefront(context->params);
+	bool const adaptive  = use_adaptive(context->params);
+	bool const heatmap_samples = context->params.render_mode == RaytracingParameters::SAMPLES;
+
+	// Launch threads. Tiles never overlap, so every job writes its pixels
+	// straight into the frame buffer, without a lock, and the tiles that
+	// need a buffer take it from the scratch memory of the thread, so that
+	// only the first tiles of a thread allocate.
+	thread_pool.run<ThreadLocalData>(tiles->num_jobs(), 
 		// The actual kernel.
 		[=](int tile, ThreadLocalData* tld, std::atomic<bool>& terminate)
 		{
-			glm::ivec2 const idx = (*tile_idx)[tile];
-			int const baseX = std::max<int>(idx[0] * tile_size, 0);
-			int const endX  = std::min<int>(baseX + tile_size, width);
-
-			int const baseY = std::max<int>(idx[1] * tile_size, 0);
-			int const endY  = std::min<int>(baseY + tile_size, height);
+			TileScheduler::Job const& job = tiles->job(tile);
+			int const baseX = job.begin.x;
+			int const endX  = job.end.x;
+
+			int const baseY = job.begin.y;
+			int const endY  = job.end.y;
+
+			tiles->begin_job(tile);
+			tld->scratch.reset();
+			long long const num_allocations = thread_allocations();
+			glm::vec4* const pixels = fb->getPixels();
+			if (adaptive)
+			{
+				glm::vec3* color = tld->scratch.allocate<glm::vec3>((endX-baseX) * (endY-baseY));
+				int* num_samples = tld->scratch.allocate<int>((endX-baseX) * (endY-baseY));
+				if (!render_tile_adaptive(*context, tld, baseX, baseY, endX, endY, color, num_samples, terminate))
+					return;
+				int const max_samples = ADAPTIVE_MAX_SAMPLE_FACTOR * std::max<int>(context->params.spp, 1);
+				for (int y = baseY; y < endY; y++)
+				{
+					for (int x = baseX; x < endX; x++)
+					{
+						int const i = (y-baseY) * (endX-baseX) + (x-baseX);
+						glm::vec3 const c = heatmap_samples ? heatmap(float(num_samples[i]) / float(max_samples)) : color[i];
+						pixels[y * width + x] = glm::vec4(c, 1.f);
+					}
+				}
+			}
+			else if (wavefront)
+			{
+				glm::vec3* color = tld->scratch.allocate<glm::vec3>((endX-baseX) * (endY-baseY));
+				if (!render_tile_wavefront(*context, tld, baseX, baseY, endX, endY, color, terminate))
+					return;
+				for (int y = baseY; y < endY; y++)
+				{
+					for (int x = baseX; x < endX; x++)
+						pixels[y * width + x] = glm::vec4(color[(y-baseY) * (endX-baseX) + (x-baseX)], 1.f);
+				}
+			}
+			else if (packets)
+			{
+				RenderData packet_data(*context, tld);
+				PacketHit hits[RayPacket::MAX_SIZE];
+				for (int by = baseY; by < endY; by += packet_h)
+				{
+					if (terminate.load())
+						return;
 
-            Image img(endX-baseX, endY-baseY);
-			for (int y = baseY; y < endY; y++) 
+					for (int bx = baseX; bx < endX; bx += packet_w)
+					{
+						int const w = std::min(packet_w, endX - bx);
+						int const h = std::min(packet_h, endY - by);
+						trace_primary_packet(packet_data, bx, by, w, h, hits);
+						for (int i = 0; i < w * h; ++i)
+						{
+							int const x = bx + i % w;
+							int const y = by + i / w;
+							glm::vec3 const color = render_pixel(x, y, *context, tld, &hits[i]);
+							pixels[y * width + x] = glm::vec4(color, 1.f);
+						}
+					}
+				}
+			}
+			else
 			{
-				for (int x = baseX; x < endX; x++) 
+				for (int y = baseY; y < endY; y++) 
 				{
 					if (terminate.load())
 						return;
 
-					glm::vec3 const color = render_pixel(x, y, *context, dynamic_cast<ThreadLocalData*>(tld));
-					img.setPixel(x-baseX, y-baseY, glm::vec4(color, 1.f));
+					for (int x = baseX; x < endX; x++) 
+					{
+						glm::vec3 const color = render_pixel(x, y, *context, tld, nullptr);
+						pixels[y * width + x] = glm::vec4(color, 1.f);
+					}
 				}
 			}
+			tiles->end_job(tile, tld, int(thread_allocations() - num_allocations));
+		}
+	);
+}
+
+// -----------------------------------------------------------------------------
 
-            std::lock_guard<std::mutex> lock(mutex);
-			for (int y = baseY; y < endY; y++) 
+void HostRender::launch_progressive(Image* fb,
+				 FrameHistory* history,
+				 int pass,
+				 ThreadPool& thread_pool,
+				 RaytracingContext const* context,
+				 TileScheduler* tiles)
+{
+	thread_pool.terminate();
+
+	int const width  = fb->getWidth();
+	int const height = fb->getHeight();
+	int const tile_size   = context->params.tile_size;
+	int const num_tiles_x = static_cast<int>(std::ceil(float(width) / float(tile_size)));
+	int const num_tiles_y = static_cast<int>(std::ceil(float(height) / float(tile_size)));
+	std::vector<glm::ivec2> tile_idx;
+	generate_tile_idx(num_tiles_x, num_tiles_y, &tile_idx);
+	tiles->plan(width, height, tile_size, tile_idx, thread_pool.num_threads(),
+		context->params.tile_scheduling, true, context->params.verbose);
+
+	int const scale = (pass < 0) ? std::max(context->params.preview_scale, 1) : 1;
+
+	thread_pool.run<ThreadLocalData>(tiles->num_jobs(),
+		[=](int tile, ThreadLocalData* tld, std::atomic<bool>& terminate)
+		{
+			TileScheduler::Job const& job = tiles->job(tile);
+			int const baseX = job.begin.x;
+			int const endX  = job.end.x;
+
+			int const baseY = job.begin.y;
+			int const endY  = job.end.y;
+
+			if (pass >= 0)
+				tiles->begin_job(tile);
+			tld->scratch.reset();
+			long long const num_allocations = thread_allocations();
+			RenderData data(*context, tld);
+			tld->sampler = &Sampler::get(context->params.sampler);
+
+			glm::vec4* const pixels = fb->getPixels();
+			for (int by = baseY; by < endY; by += scale)
 			{
-				for (int x = baseX; x < endX; x++) 
+				if (terminate.load())
+					return;
+
+				for (int bx = baseX; bx < endX; bx += scale)
 				{
-                    fb->setPixel(x, y, img.getPixel(x-baseX, y-baseY));
-                }
-            }
+					// The preview shades the center of the block.
+					int const x = std::min(bx + scale / 2, endX - 1);
+					int const y = std::min(by + scale / 2, endY - 1);
+					tld->random.begin_pixel(x, y);
+					data.isect = Intersection();
+					glm::vec3 color = trace_pixel_sample(data, x, y, history->first_sample + std::max(pass, 0));
+					if (pass >= 0)
+					{
+						HistoryPixel& pixel = history->pixels[y * width + x];
+						if (pass == 0)
+							record_primary_hit(data, &pixel);
+						pixel.sum += color;
+						pixel.n++;
+						color = pixel.sum / float(pixel.n);
+					}
+
+					for (int py = by; py < std::min(by + scale, endY); py++)
+					{
+						for (int px = bx; px < std::min(bx + scale, endX); px++)
+							pixels[py * width + px] = glm::vec4(color, 1.f);
+					}
+				}
+			}
+			if (pass >= 0)
+				tiles->end_job(tile, tld, int(thread_allocations() - num_allocations));
+		}
+	);
+}
+
+// -----------------------------------------------------------------------------
+
+void HostRender::launch_reprojection(Image* fb,
+				 FrameHistory const* previous,
+				 FrameHistory* history,
+				 std::atomic<int>* num_reused,
+				 ThreadPool& thread_pool,
+				 RaytracingContext const* context,
+				 std::vector<glm::ivec2>* tile_idx)
+{
+	thread_pool.terminate();
 
+	int const width  = fb->getWidth();
+	int const height = fb->getHeight();
+	int const tile_size   = context->params.tile_size;
+	int const num_tiles_x = static_cast<int>(std::ceil(float(width) / float(tile_size)));
+	int const num_tiles_y = static_cast<int>(std::ceil(float(height) / float(tile_size)));
+	int const num_tiles   = num_tiles_x * num_tiles_y;
+	generate_tile_idx(num_tiles_x, num_tiles_y, tile_idx);
+
+	thread_pool.run<ThreadLocalData>(num_tiles,
+		[=](int tile, ThreadLocalData* tld, std::atomic<bool>& terminate)
+		{
+			glm::ivec2 const idx = (*tile_idx)[tile];
+			int const baseX = std::max<int>(idx[0] * tile_size, 0);
+			int const endX  = std::min<int>(baseX + tile_size, width);
+
+			int const baseY = std::max<int>(idx[1] * tile_size, 0);
+			int const endY  = std::min<int>(baseY + tile_size, height);
+
+			int reused = 0;
+			if (!reproject_tile(*context, tld, *previous, history, baseX, baseY, endX, endY, terminate, &reused))
+				return;
+			*num_reused += reused;
+
+			for (int y = baseY; y < endY; y++)
+			{
+				for (int x = baseX; x < endX; x++)
+				{
+					HistoryPixel const& pixel = history->pixels[y * width + x];
+					fb->setPixel(x, y, glm::vec4(pixel.sum / float(pixel.n), 1.f));
+				}
+			}
 		}
 	);
 }
@@ -0,0 +1,287 @@
+#include <cglib/rt/light.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/*
+ * Below this solid angle the spherical polygons lose too much precision,
+ * and sampling the area is just as good.
+ */
+const float MIN_SOLID_ANGLE = 3e-4f;
+
+float
+angle_between(glm::vec3 const& u, glm::vec3 const& v)
+{
+	return std::acos(glm::clamp(glm::dot(u, v), -1.f, 1.f));
+}
+
+/*
+ * A rectangle projected onto the unit sphere around a point; see Urena et
+ * al., "An Area-Preserving Parametrization for Spherical Rectangles", EGSR
+ * 2013. Unlike two triangles, this maps the unit square continuously onto
+ * the rectangle, so stratified points stay stratified on the light.
+ */
+struct SphericalRectangle
+{
+	glm::vec3 o, x, y, z;  /* corner and local frame */
+	float x0, x1, y0, y1, z0;
+	float b0, b1, k;
+	float solid_angle;
+};
+
+/*
+ * False if the light is not a rectangle.
+ */
+bool
+make_spherical_rectangle(AreaLight const& light, glm::vec3 const& P, SphericalRectangle* r)
+{
+	const float ex = glm::length(light.tangent);
+	const float ey = glm::length(light.bitangent);
+	if (std::fabs(glm::dot(light.tangent, light.bitangent)) > 1e-4f * ex * ey)
+		return false;
+
+	r->o = light.getPosition();
+	r->x = light.tangent / ex;
+	r->y = light.bitangent / ey;
+	r->z = glm::cross(r->x, r->y);
+	const glm::vec3 d = r->o - P;
+	r->z0 = glm::dot(d, r->z);
+	if (r->z0 > 0.f) {
+		r->z  = -r->z;
+		r->z0 = -r->z0;
+	}
+	r->x0 = glm::dot(d, r->x);
+	r->y0 = glm::dot(d, r->y);
+	r->x1 = r->x0 + ex;
+	r->y1 = r->y0 + ey;
+
+	/* normals of the planes through P and the edges */
+	const glm::vec3 n0 = glm::normalize(glm::vec3(0.f, r->z0, -r->y0));
+	const glm::vec3 n1 = glm::normalize(glm::vec3(-r->z0, 0.f, r->x1));
+	const glm::vec3 n2 = glm::normalize(glm::vec3(0.f, -r->z0, r->y1));
+	const glm::vec3 n3 = glm::normalize(glm::vec3(r->z0, 0.f, -r->x0));
+	const float g0 = angle_between(-n0, n1);
+	const float g1 = angle_between(-n1, n2);
+	const float g2 = angle_between(-n2, n3);
+	const float g3 = angle_between(-n3, n0);
+	r->b0 = n0.z;
+	r->b1 = n2.z;
+	r->k  = 2.f * float(M_PI) - g2 - g3;
+	r->solid_angle = std::max(0.f, g0 + g1 - r->k);
+	return true;
+}
+
+glm::vec3
+sample_spherical_rectangle(SphericalRectangle const& r, float u0, float u1)
+{
+	/* the column whose left part has the fraction u0 of the solid angle */
+	const float au = u0 * r.solid_angle + r.k;
+	const float fu = (std::cos(au) * r.b0 - r.b1) / std::sin(au);
+	float cu = std::copysign(1.f / std::sqrt(fu * fu + r.b0 * r.b0), fu);
+	cu = glm::clamp(cu, -0.99999994f, 0.99999994f);
+	float xu = -cu * r.z0 / std::sqrt(1.f - cu * cu);
+	xu = glm::clamp(xu, r.x0, r.x1);
+
+	/* the height in that column, uniform in the projected angle */
+	const float d = std::sqrt(xu * xu + r.z0 * r.z0);
+	const float h0 = r.y0 / std::sqrt(d * d + r.y0 * r.y0);
+	const float h1 = r.y1 / std::sqrt(d * d + r.y1 * r.y1);
+	const float hv = h0 + u1 * (h1 - h0);
+	const float hv2 = hv * hv;
+	const float yv = hv2 < 0.99999994f ? hv * d / std::sqrt(1.f - hv2) : r.y1;
+
+	return r.o + (xu - r.x0) * r.x + (yv - r.y0) * r.y;
+}
+
+/*
+ * A triangle projected onto the unit sphere around a point; see Arvo,
+ * "Stratified Sampling of Spherical Triangles", SIGGRAPH 1995.
+ */
+struct SphericalTriangle
+{
+	glm::vec3 a, b, c;  /* unit directions to the corners */
+	float alpha;        /* interior angle at a */
+	float solid_angle;
+};
+
+SphericalTriangle
+make_spherical_triangle(glm::vec3 const& P, glm::vec3 const& v0, glm::vec3 const& v1, glm::vec3 const& v2)
+{
+	SphericalTriangle t;
+	t.a = glm::normalize(v0 - P);
+	t.b = glm::normalize(v1 - P);
+	t.c = glm::normalize(v2 - P);
+
+	const glm::vec3 n_ab = glm::normalize(glm::cross(t.a, t.b));
+	const glm::vec3 n_bc = glm::normalize(glm::cross(t.b, t.c));
+	const glm::vec3 n_ca = glm::normalize(glm::cross(t.c, t.a));
+	t.alpha = angle_between(n_ab, -n_ca);
+	const float beta  = angle_between(n_bc, -n_ab);
+	const float gamma = angle_between(n_ca, -n_bc);
+	t.solid_angle = std::max(0.f, t.alpha + beta + gamma - float(M_PI));
+	return t;
+}
+
+/*
+ * The first coordinate selects the part of the solid angle left of a
+ * great arc through a, the second the position on that arc.
+ */
+glm::vec3
+sample_spherical_triangle(SphericalTriangle const& t, float u0, float u1)
+{
+	/* the sampled area plus pi, the sum of the angles of its triangle */
+	const float angles = u0 * t.solid_angle + float(M_PI);
+	const float cos_alpha = std::cos(t.alpha);
+	const float sin_alpha = std::sin(t.alpha);
+	const float sin_phi = std::sin(angles) * cos_alpha - std::cos(angles) * sin_alpha;
+	const float cos_phi = std::cos(angles) * cos_alpha + std::sin(angles) * sin_alpha;
+	const float k1 = cos_phi + cos_alpha;
+	const float k2 = sin_phi - sin_alpha * glm::dot(t.a, t.b);
+	float cos_b = (k2 + (k2 * cos_phi - k1 * sin_phi) * cos_alpha)
+	            / ((k2 * sin_phi + k1 * cos_phi) * sin_alpha);
+	cos_b = glm::clamp(cos_b, -1.f, 1.f);
+	const float sin_b = std::sqrt(std::max(0.f, 1.f - cos_b * cos_b));
+
+	const glm::vec3 c_perp = glm::normalize(t.c - glm::dot(t.c, t.a) * t.a);
+	const glm::vec3 cp = cos_b * t.a + sin_b * c_perp;
+
+	const float cos_theta = 1.f - u1 * (1.f - glm::dot(cp, t.b));
+	const float sin_theta = std::sqrt(std::max(0.f, 1.f - cos_theta * cos_theta));
+	const glm::vec3 cp_perp = glm::normalize(cp - glm::dot(cp, t.b) * t.b);
+	return glm::normalize(cos_theta * t.b + sin_theta * cp_perp);
+}
+
+/*
+ * The parallelogram as two spherical triangles.
+ */
+void
+make_spherical_triangles(AreaLight const& light, glm::vec3 const& P, SphericalTriangle t[2])
+{
+	const glm::vec3 p00 = light.getPosition();
+	const glm::vec3 p10 = p00 + light.tangent;
+	const glm::vec3 p11 = p10 + light.bitangent;
+	const glm::vec3 p01 = p00 + light.bitangent;
+	t[0] = make_spherical_triangle(P, p00, p10, p11);
+	t[1] = make_spherical_triangle(P, p00, p11, p01);
+}
+
+/*
+ * How the light is sampled from P: as a spherical rectangle, as two
+ * spherical triangles if it is no rectangle or the rectangle is too small,
+ * or by area if the triangles are too small as well. Sampling and its
+ * density both decide here, so that they always agree.
+ */
+struct LightSolidAngle
+{
+	enum Method { RECTANGLE, TRIANGLES, AREA } method;
+	SphericalRectangle rectangle;
+	SphericalTriangle triangles[2];
+	float solid_angle;  /* of the rectangle or the triangles */
+};
+
+LightSolidAngle
+make_light_solid_angle(AreaLight const& light, glm::vec3 const& P)
+{
+	LightSolidAngle s;
+	if (make_spherical_rectangle(light, P, &s.rectangle) && s.rectangle.solid_angle > MIN_SOLID_ANGLE) {
+		s.method = LightSolidAngle::RECTANGLE;
+		s.solid_angle = s.rectangle.solid_angle;
+		return s;
+	}
+
+	make_spherical_triangles(light, P, s.triangles);
+	s.solid_angle = s.triangles[0].solid_angle + s.triangles[1].solid_angle;
+	s.method = s.solid_angle > MIN_SOLID_ANGLE ? LightSolidAngle::TRIANGLES : LightSolidAngle::AREA;
+	return s;
+}
+
+/*
+ * The density of uniform area sampling, converted to solid angle at P.
+ */
+float
+area_pdf(AreaLight const& light, glm::vec3 const& P, glm::vec3 const& point)
+{
+	const glm::vec3 d = point - P;
+	const float dist2 = glm::dot(d, d);
+	const float cos_light = std::fabs(glm::dot(light.normal, d)) / std::sqrt(dist2);
+	return cos_light > 0.f ? dist2 / (cos_light * light.get_area()) : 0.f;
+}
+
+}
+
+bool AreaLight::
+sample_solid_angle(glm::vec3 const& P, float x0, float x1, glm::vec3* point, float* pdf) const
+{
+	if (glm::dot(P - position, normal) <= 0.f)
+		return false;
+
+	const LightSolidAngle s = make_light_solid_angle(*this, P);
+	if (s.method == LightSolidAngle::RECTANGLE) {
+		*point = sample_spherical_rectangle(s.rectangle, x0, x1);
+		*pdf = 1.f / s.solid_angle;
+		return true;
+	}
+	if (s.method == LightSolidAngle::AREA) {
+		*point = uniform_sample_point(x0, x1);
+		*pdf = area_pdf(*this, P, *point);
+		return *pdf > 0.f;
+	}
+
+	/* split the first coordinate between the triangles */
+	SphericalTriangle const* t = s.triangles;
+	const float solid_angle = s.solid_angle;
+	const float split = t[0].solid_angle / solid_angle;
+	glm::vec3 dir;
+	if (x0 < split)
+		dir = sample_spherical_triangle(t[0], x0 / split, x1);
+	else
+		dir = sample_spherical_triangle(t[1], std::min((x0 - split) / (1.f - split), 1.f), x1);
+
+	const float denom = glm::dot(dir, normal);
+	if (denom >= 0.f)
+		return false;
+	*point = P + dir * (glm::dot(position - P, normal) / denom);
+	*pdf = 1.f / solid_angle;
+	return true;
+}
+
+float AreaLight::
+solid_angle_pdf(glm::vec3 const& P, glm::vec3 const& point) const
+{
+	if (glm::dot(P - position, normal) <= 0.f)
+		return 0.f;
+
+	const LightSolidAngle s = make_light_solid_angle(*this, P);
+	if (s.method != LightSolidAngle::AREA)
+		return 1.f / s.solid_angle;
+	return area_pdf(*this, P, point);
+}
+
+bool AreaLight::
+intersect(glm::vec3 const& P, glm::vec3 const& dir, float* t) const
+{
+	const float denom = glm::dot(dir, normal);
+	if (denom == 0.f)
+		return false;
+	const float t_hit = glm::dot(position - P, normal) / denom;
+	if (t_hit <= 0.f)
+		return false;
+
+	/* coordinates of the hit point along the edges */
+	const glm::vec3 q = P + t_hit * dir - position;
+	const float tt = glm::dot(tangent, tangent);
+	const float tb = glm::dot(tangent, bitangent);
+	const float bb = glm::dot(bitangent, bitangent);
+	const float qt = glm::dot(q, tangent);
+	const float qb = glm::dot(q, bitangent);
+	const float det = tt * bb - tb * tb;
+	const float u = (qt * bb - qb * tb) / det;
+	const float v = (qb * tt - qt * tb) / det;
+	if (u < 0.f || u > 1.f || v < 0.f || v > 1.f)
+		return false;
+
+	*t = t_hit;
+	return true;
+}
@@ -1,5 +1,44 @@
 #include <cglib/rt/material.h>
 #include <cglib/rt/intersection.h>
+#include <cglib/core/assert.h>
+
+namespace {
+
+/* the normal of the normal map value v */
+inline glm::vec3
+decode_normal(glm::vec3 const& v)
+{
+	return glm::normalize(glm::vec3(2.f*v[0]-1.f, v[2], 2.f*v[1]-1.f));
+}
+
+/* the value of channel c of the material at the hit */
+inline glm::vec3
+evaluate_channel(FlatMaterial const& material, int c, Intersection const& isect)
+{
+	Texture const* texture = material.texture[c];
+	return texture ? glm::vec3(texture->evaluate(isect.uv, isect.dudv)) : material.value[c];
+}
+
+/* add the ambient term, and scale the terms down to at most 1 in sum */
+inline void
+conserve_energy(MaterialSample* s)
+{
+	s->k_a = 0.1f * s->k_d; // simple ambient term
+
+	auto sum = s->k_s + s->k_d + s->k_r + s->k_t + s->k_a;
+	for (int i = 0; i < 3; ++i)
+	{
+		if (sum[i] > 1.f) {
+			s->k_s[i] /= sum[i];
+			s->k_d[i] /= sum[i];
+			s->k_r[i] /= sum[i];
+			s->k_t[i] /= sum[i];
+			s->k_a[i] /= sum[i];
+		}
+	}
+}
+
+}
 
 void MaterialSample::
 evaluate(
@@ -10,23 +49,59 @@ evaluate(
 	k_s    = glm::vec3(material.k_s->evaluate(isect.uv, isect.dudv));
 	k_r    = glm::vec3(material.k_r->evaluate(isect.uv, isect.dudv));
 	k_t    = glm::vec3(material.k_t->evaluate(isect.uv, isect.dudv));
-	normal = glm::vec3(material.normal->evaluate(isect.uv, isect.dudv));
-	normal = glm::normalize(glm::vec3(2.f*normal[0]-1.f, normal[2], 2.f*normal[1]-1.f));
-
-	k_a = 0.1f * k_d; // simple ambient term
+	normal = decode_normal(glm::vec3(material.normal->evaluate(isect.uv, isect.dudv)));
 	eta = material.eta;
 	n = material.n;
+	conserve_energy(this);
+}
 
-	auto sum = k_s + k_d + k_r + k_t + k_a;
-	for (int i = 0; i < 3; ++i)
-	{
-		if (sum[i] > 1.f) {
-			k_s[i] /= sum[i];
-			k_d[i] /= sum[i];
-			k_r[i] /= sum[i];
-			k_t[i] /= sum[i];
-			k_a[i] /= sum[i];
+void MaterialSample::
+evaluate(
+	FlatMaterial const& material,
+	Intersection const& isect)
+{
+	if (!material.textured) {
+		*this = material.sample;
+		return;
+	}
+
+	k_d    = evaluate_channel(material, FlatMaterial::K_D, isect);
+	k_s    = evaluate_channel(material, FlatMaterial::K_S, isect);
+	k_r    = evaluate_channel(material, FlatMaterial::K_R, isect);
+	k_t    = evaluate_channel(material, FlatMaterial::K_T, isect);
+	normal = material.texture[FlatMaterial::NORMAL]
+		? decode_normal(evaluate_channel(material, FlatMaterial::NORMAL, isect))
+		: material.sample.normal;
+	eta = material.sample.eta;
+	n = material.sample.n;
+	conserve_energy(this);
+}
+
+FlatMaterial::
+FlatMaterial(Material const& material)
+{
+	std::shared_ptr<Texture> const* channels[NUM_CHANNELS] = {
+		&material.k_d, &material.k_s, &material.k_r, &material.k_t, &material.normal
+	};
+	for (int c = 0; c < NUM_CHANNELS; ++c) {
+		cg_assert(*channels[c]);
+		if (auto const* constant = dynamic_cast<ConstTexture const*>(channels[c]->get())) {
+			value[c]   = constant->get_value();
+			texture[c] = nullptr;
+		}
+		else {
+			value[c]   = glm::vec3(0.f);
+			texture[c] = channels[c]->get();
+			textured   = true;
 		}
 	}
 
+	sample.k_d    = value[K_D];
+	sample.k_s    = value[K_S];
+	sample.k_r    = value[K_R];
+	sample.k_t    = value[K_T];
+	sample.normal = decode_normal(value[NORMAL]);
+	sample.eta    = material.eta;
+	sample.n      = material.n;
+	conserve_energy(&sample);
 }
@@ -1,24 +1,71 @@
 #include <cglib/rt/object.h>
+#include <cglib/rt/ray_packet.h>
 
 Object::Object() :
 	material(new Material()),
 	texture_mapping(new ZeroMapping())
 {
 	material->k_d = std::shared_ptr<ConstTexture>(new ConstTexture(glm::vec3(0.18f)));
+	Object::update_materials();
 }
 
 bool Object::
-intersect(Ray const& ray, Intersection* isect) const
+intersect(Ray const& ray, float t_min, float t_max, Intersection* isect) const
+{
+	HitRecord hit;
+	if (!intersect_hit(ray, t_min, t_max, &hit))
+		return false;
+	if (isect)
+		fill_intersection(ray, hit, isect);
+	return true;
+}
+
+bool Object::
+intersect_hit(Ray const& ray, float t_min, float t_max, HitRecord* hit) const
 {
 	// transform ray in object space
 	const Ray ray_local = transform_ray(ray, transform_world_to_object);
+	float t_min_local, t_max_local;
+	const float scale = transform_ray_range(ray, transform_world_to_object, t_min, t_max, &t_min_local, &t_max_local);
 	Intersection isect_local;
-	if (geo->intersect(ray_local, &isect_local)) {
-		*isect = transform_intersection(isect_local, transform_object_to_world, transform_object_to_world_normal);
-		isect->t = glm::length(ray.origin-isect->position);
-		return true;
-	}
-	return false;
+	if (!geo->intersect(ray_local, t_min_local, t_max_local, &isect_local))
+		return false;
+	const float t = isect_local.t / scale;
+	if (t < t_min || t >= t_max)
+		return false;
+	hit->t            = t;
+	hit->t_local      = isect_local.t;
+	hit->primitive_id = isect_local.primitive_id;
+	hit->bary         = glm::vec2(0.f);
+	return true;
+}
+
+void Object::
+fill_intersection(Ray const& ray, HitRecord const& hit, Intersection* isect) const
+{
+	cg_assert(isect);
+	// intersecting again from the recorded distance gives the same hit
+	const Ray ray_local = transform_ray(ray, transform_world_to_object);
+	Intersection isect_local;
+	const bool found = geo->intersect(ray_local, hit.t_local, std::numeric_limits<float>::max(), &isect_local);
+	cg_assert(found);
+	(void) found;
+	*isect = transform_intersection(isect_local, transform_object_to_world, transform_object_to_world_normal);
+	isect->t = glm::length(ray.origin-isect->position);
+}
+
+bool Object::
+occluded(Ray const& ray, float t_max) const
+{
+	const Ray ray_local = transform_ray(ray, transform_world_to_object);
+	return geo->occluded(ray_local, t_max * transform_ray_scale(ray, transform_world_to_object));
+}
+
+void Object::
+intersect_packet(RayPacket const& packet, Intersection isects[], bool hits[]) const
+{
+	for (int i = 0; i < packet.size; ++i)
+		hits[i] = intersect(packet.rays[i], &isects[i]);
 }
 
 void Object::
@@ -29,7 +76,7 @@ compute_shading_info(Intersection* isect)
 	texture_mapping->compute_tangent_space(&isect_local);
 
 	isect_local.uv = get_uv(isect_local);
-	isect_local.material.evaluate(*material, isect_local);
+	isect_local.material.evaluate(flat_material, isect_local);
 	isect_local.shading_normal = transform_direction_to_object_space(isect_local.material.normal,
 		isect_local.normal, isect_local.tangent, isect_local.bitangent);
 
@@ -49,13 +96,20 @@ compute_shading_info(const Ray rays[4], Intersection* isect)
 		rays_local[i] = transform_ray(rays[i], transform_world_to_object);
 	}
 	isect_local.dudv = compute_uv_aabb_size(rays_local, isect_local);
-	isect_local.material.evaluate(*material, isect_local);
+	isect_local.material.evaluate(flat_material, isect_local);
 	isect_local.shading_normal = transform_direction_to_object_space(isect_local.material.normal,
 		isect_local.normal, isect_local.tangent, isect_local.bitangent);
 
 	*isect = transform_intersection(isect_local, transform_object_to_world, transform_object_to_world_normal);
 }
 
+void Object::
+update_materials()
+{
+	cg_assert(material);
+	flat_material = FlatMaterial(*material);
+}
+
 void Object::
 get_intersection_uvs(glm::vec3 const positions[4], Intersection const& isect, glm::vec2 uvs[4])
 {
@@ -118,6 +172,17 @@ get_uv(Intersection const& isect)
 	return texture_mapping->get_uv(isect);
 }
 
+bool Object::
+get_world_bounds(AABB* aabb) const
+{
+	cg_assert(aabb);
+	AABB local;
+	if (!geo || !geo->get_bounds(&local))
+		return false;
+	*aabb = transform_aabb(local, transform_object_to_world);
+	return true;
+}
+
 void Object::
 set_transform_object_to_world(glm::mat4 const& T)
 {
@@ -128,6 +193,96 @@ set_transform_object_to_world(glm::mat4 const& T)
 	transform_world_to_object_normal = glm::transpose(transform_object_to_world);
 }
 
+Instance::
+Instance(std::shared_ptr<Object> const& prototype_) :
+	prototype(prototype_)
+{
+	cg_assert(prototype);
+}
+
+bool Instance::
+occluded(Ray const& ray, float t_max) const
+{
+	const Ray ray_local = transform_ray(ray, transform_world_to_object);
+	return prototype->occluded(ray_local, t_max * transform_ray_scale(ray, transform_world_to_object));
+}
+
+bool Instance::
+intersect_hit(Ray const& ray, float t_min, float t_max, HitRecord* hit) const
+{
+	const Ray ray_local = transform_ray(ray, transform_world_to_object);
+	float t_min_local, t_max_local;
+	const float scale = transform_ray_range(ray, transform_world_to_object, t_min, t_max, &t_min_local, &t_max_local);
+	HitRecord hit_local;
+	if (!prototype->intersect_hit(ray_local, t_min_local, t_max_local, &hit_local))
+		return false;
+	hit_local.t /= scale;
+	if (hit_local.t < t_min || hit_local.t >= t_max)
+		return false;
+	*hit = hit_local;
+	return true;
+}
+
+void Instance::
+fill_intersection(Ray const& ray, HitRecord const& hit, Intersection* isect) const
+{
+	cg_assert(isect);
+	const Ray ray_local = transform_ray(ray, transform_world_to_object);
+	Intersection isect_local;
+	prototype->fill_intersection(ray_local, hit, &isect_local);
+	*isect = transform_intersection(isect_local, transform_object_to_world, transform_object_to_world_normal);
+	isect->t = glm::length(ray.origin-isect->position);
+}
+
+void Instance::
+compute_shading_info(Intersection* isect)
+{
+	cg_assert(isect);
+	Intersection isect_local = transform_intersection(*isect, transform_world_to_object, transform_world_to_object_normal);
+	prototype->compute_shading_info(&isect_local);
+	*isect = transform_intersection(isect_local, transform_object_to_world, transform_object_to_world_normal);
+}
+
+void Instance::
+compute_shading_info(const Ray rays[4], Intersection* isect)
+{
+	cg_assert(isect);
+	Intersection isect_local = transform_intersection(*isect, transform_world_to_object, transform_world_to_object_normal);
+	Ray rays_local[4];
+	for (int i = 0; i < 4; ++i) {
+		rays_local[i] = transform_ray(rays[i], transform_world_to_object);
+	}
+	prototype->compute_shading_info(rays_local, &isect_local);
+	*isect = transform_intersection(isect_local, transform_object_to_world, transform_object_to_world_normal);
+}
+
+void Instance::
+update_materials()
+{
+	Object::update_materials();
+	prototype->update_materials();
+}
+
+bool Instance::
+get_world_bounds(AABB* aabb) const
+{
+	cg_assert(aabb);
+	AABB local;
+	if (!prototype->get_world_bounds(&local))
+		return false;
+	*aabb = transform_aabb(local, transform_object_to_world);
+	return true;
+}
+
+std::unique_ptr<Object> create_instance(
+		std::shared_ptr<Object> const& prototype,
+		glm::mat4 const& transform_object_to_world)
+{
+	std::unique_ptr<Object> object(new Instance(prototype));
+	object->set_transform_object_to_world(transform_object_to_world);
+	return object;
+}
+
 std::unique_ptr<Object> create_sphere(
 		glm::vec3 const& center,
 		float radius,
@@ -20,8 +20,10 @@ static TwEnumVal tex_wrap_enum[] = {
 
 static TwEnumVal render_mode_enum[] = {
 	{ RaytracingParameters::RECURSIVE,            "Recursive"               },
+	{ RaytracingParameters::PATH_TRACE,           "Path Tracing"            },
 	{ RaytracingParameters::DESATURATE,           "Desaturate"              },
 	{ RaytracingParameters::NUM_RAYS,             "Num rays cast"           },
+	{ RaytracingParameters::SAMPLES,              "Samples per pixel"       },
 	{ RaytracingParameters::NORMAL,               "Normal"                  },
 	{ RaytracingParameters::TIME,                 "Time"                    },
 	{ RaytracingParameters::DUDV,                 "dudv"                    },
@@ -35,6 +37,37 @@ static TwEnumVal scene_enum[] = {
 	{ RaytracingParameters::POOL_TABLE,        "Pool Table"      },
 };
 
+static TwEnumVal bvh_build_method_enum[] = {
+	{ RaytracingParameters::BVH_MEDIAN_SPLIT,  "Median Split"    },
+	{ RaytracingParameters::BVH_BINNED_SAH,    "Binned SAH"      },
+};
+
+static TwEnumVal bvh_width_enum[] = {
+	{ RaytracingParameters::BVH_WIDTH_AUTO,    "Auto"            },
+	{ RaytracingParameters::BVH_WIDTH_2,       "Binary"          },
+	{ RaytracingParameters::BVH_WIDTH_4,       "4-wide (SSE)"    },
+	{ RaytracingParameters::BVH_WIDTH_8,       "8-wide (AVX)"    },
+};
+
+static TwEnumVal ray_packet_size_enum[] = {
+	{ RaytracingParameters::RAY_PACKET_4,      "4 (2x2)"         },
+	{ RaytracingParameters::RAY_PACKET_8,      "8 (4x2)"         },
+	{ RaytracingParameters::RAY_PACKET_16,     "16 (4x4)"        },
+};
+
+static TwEnumVal sampling_enum[] = {
+	{ RaytracingParameters::SAMPLE_UNIFORM,    "Uniform"         },
+	{ RaytracingParameters::SAMPLE_IMPORTANCE, "Importance"      },
+	{ RaytracingParameters::SAMPLE_MIS,        "MIS"             },
+};
+
+static TwEnumVal sampler_enum[] = {
+	{ Sampler::RANDOM,                         "Random"          },
+	{ Sampler::HALTON,                         "Halton"          },
+	{ Sampler::SOBOL,                          "Sobol"           },
+	{ Sampler::BLUE_NOISE,                     "Blue Noise"      },
+};
+
 static void TW_CALL
 eye_sep_set(void const* value, void* )
 {
@@ -61,9 +94,15 @@ derived_gui_setup(TwBar* bar)
 	TwType tex_wrap_type    = TwDefineEnum("Texture Wrap Mode",   tex_wrap_enum,    LENGTH(tex_wrap_enum));
 
 	TwType scene_type = TwDefineEnum("Scene", scene_enum, LENGTH(scene_enum));
+	TwType bvh_build_method_type = TwDefineEnum("BVH Build Method", bvh_build_method_enum, LENGTH(bvh_build_method_enum));
+	TwType bvh_width_type = TwDefineEnum("BVH Width", bvh_width_enum, LENGTH(bvh_width_enum));
+	TwType ray_packet_size_type = TwDefineEnum("Ray Packet Size", ray_packet_size_enum, LENGTH(ray_packet_size_enum));
+	TwType sampler_type = TwDefineEnum("Sampler", sampler_enum, LENGTH(sampler_enum));
+	TwType sampling_type = TwDefineEnum("Sampling Strategy", sampling_enum, LENGTH(sampling_enum));
 	TwAddVarRW(bar, "scene", scene_type, &scene, "label='Scene' group='Rendering Settings'");
 
 	TwAddVarRW(bar, "render_mode",  render_mode_type, &render_mode,  "label='Render Mode' group='Rendering Settings'");
+	TwAddVarRW(bar, "wavefront",    TW_TYPE_BOOLCPP,  &wavefront,    "label='Wavefront' help='Render tiles in stages, for path tracing, and for the recursive mode without reflection, transmission and indirect light' group='Rendering Settings'");
 	TwAddVarRW(bar, "diffuse_white_mode", TW_TYPE_BOOLCPP, &diffuse_white_mode, "label='Diffuse White' group='Shading Settings'");
 	TwAddVarRW(bar, "max_depth",    TW_TYPE_INT32,    &max_depth,    "label='Max Depth' group='Rendering Settings'");
 	TwAddVarRW(bar, "shadows",      TW_TYPE_BOOLCPP,  &shadows,      "label='Shadows' group='Shading Settings'");
@@ -87,7 +126,15 @@ derived_gui_setup(TwBar* bar)
 	TwAddVarRW(bar, "focal_length",      TW_TYPE_FLOAT,    &focal_length,   "label='Focal Length' group='Shading Settings' min=0");
 	TwAddVarRW(bar, "shadow_rays",       TW_TYPE_INT32,    &shadow_rays,    "label='# Shadow Rays' help='Number of shadow rays' group='Shading Settings' min=0");
 	TwAddVarRW(bar, "disable_direct",    TW_TYPE_BOOLCPP,  &disable_direct, "label='Disable Direct Lighting' group='Shading Settings'");
-	TwAddVarRW(bar, "stratified", TW_TYPE_BOOLCPP, &stratified, "label='Stratified Sampling' group='Rendering Settings'");
+	TwAddVarRW(bar, "sampling",          sampling_type,    &sampling,       "label='Sampling Strategy' help='Importance sampling of AO, indirect and soft shadow rays' group='Shading Settings'");
+	TwAddVarRW(bar, "sampler", sampler_type, &sampler, "label='Sampler' group='Rendering Settings'");
+	TwAddVarRW(bar, "stratified", TW_TYPE_BOOLCPP, &stratified, "label='Stratified Sampling' help='Stratify the pixel samples of the random sampler' group='Rendering Settings'");
+	TwAddVarRW(bar, "bvh_build_method", bvh_build_method_type, &bvh_build_method, "label='BVH Build Method' group='Acceleration Structure'");
+	TwAddVarRW(bar, "bvh_max_triangles_in_leaf", TW_TYPE_INT32, &bvh_max_triangles_in_leaf, "label='Max Triangles in Leaf' group='Acceleration Structure' min=1");
+	TwAddVarRW(bar, "bvh_width", bvh_width_type, &bvh_width, "label='BVH Width' group='Acceleration Structure'");
+	TwAddVarRW(bar, "animate_scene", TW_TYPE_BOOLCPP, &animate_scene, "label='Animate Scene' help='Deform the triangles scene every frame and refit its BVH' group='Acceleration Structure'");
+	TwAddVarRW(bar, "ray_packets", TW_TYPE_BOOLCPP, &ray_packets, "label='Ray Packets' group='Acceleration Structure'");
+	TwAddVarRW(bar, "ray_packet_size", ray_packet_size_type, &ray_packet_size, "label='Ray Packet Size' group='Acceleration Structure'");
 	TwAddVarRW(bar, "ray_epsilon", TW_TYPE_FLOAT, &ray_epsilon, "label='Ray Epsilon' group='Shading Settings' min=0.0 step=0.0001");
 
 	TwAddVarRW(bar, "stereo",            TW_TYPE_BOOL8,  &stereo,            "label='Stereo Rendering' group='General Settings'");
@@ -100,6 +147,15 @@ derived_gui_setup(TwBar* bar)
 	TwAddVarRO(bar, "image_width",       TW_TYPE_UINT32, &image_width,       "label='Image width' group='General Settings'");
 	TwAddVarRO(bar, "image_height",      TW_TYPE_UINT32, &image_height,      "label='Image height' group='General Settings'");
 	TwAddVarRW(bar, "spp", TW_TYPE_UINT32, &spp, "label='Pixel Samples' group='Rendering Settings' min=1");
+	TwAddVarRW(bar, "adaptive", TW_TYPE_BOOLCPP, &adaptive, "label='Adaptive Sampling' help='Spend the pixel samples where the error is largest' group='Rendering Settings'");
+	TwAddVarRW(bar, "adaptive_threshold", TW_TYPE_FLOAT, &adaptive_threshold, "label='Adaptive Error' help='Relative standard error at which a pixel takes no more samples' group='Rendering Settings' min=0 step=0.001");
+	TwAddVarRW(bar, "progressive", TW_TYPE_BOOLCPP, &progressive, "label='Progressive' help='Preview first, then accumulate one sample per pixel and pass' group='Rendering Settings'");
+	TwAddVarRW(bar, "preview_scale", TW_TYPE_INT32, &preview_scale, "label='Preview Scale' help='Pixels per side of a preview block, 1 for no preview' group='Rendering Settings' min=1 max=32");
+	TwAddVarRW(bar, "reprojection", TW_TYPE_BOOLCPP, &reprojection, "label='Reprojection' help='When the camera moves, reuse the progressive samples that are still visible' group='Rendering Settings'");
+	TwAddVarRW(bar, "denoise", TW_TYPE_BOOLCPP, &denoise, "label='Denoise' help='Filter the finished image, guided by normals, depth and albedo' group='Rendering Settings'");
+	TwAddVarRW(bar, "denoise_iterations", TW_TYPE_INT32, &denoise_iterations, "label='Denoise Iterations' help='Iteration i filters over 2^i pixels' group='Rendering Settings' min=0 max=10");
+	TwAddVarRW(bar, "tile_scheduling", TW_TYPE_BOOLCPP, &tile_scheduling, "label='Tile Scheduling' help='Render the tiles that were expensive in the last frame first, and split them' group='Rendering Settings'");
+	TwAddVarRW(bar, "specialize_shading", TW_TYPE_BOOLCPP, &specialize_shading, "label='Specialize Shading' help='Shade with a kernel compiled for the enabled effects' group='Rendering Settings'");
 }
 
 bool RaytracingParameters::
@@ -139,12 +195,30 @@ derived_change_requires_restart(Parameters const& old_) const
 		|| (focal_length      != old->focal_length)
 		|| (shadow_rays       != old->shadow_rays)
 		|| (disable_direct    != old->disable_direct)
+		|| (sampling          != old->sampling)
 		|| (stratified        != old->stratified)
+		|| (sampler           != old->sampler)
 		|| (normal_mapping    != old->normal_mapping)
 		|| (transform_objects != old->transform_objects)
 		|| (spp               != old->spp)
+		|| (adaptive          != old->adaptive)
+		|| (adaptive_threshold != old->adaptive_threshold)
+		|| (progressive       != old->progressive)
+		|| (preview_scale     != old->preview_scale)
+		|| (reprojection      != old->reprojection)
+		|| (denoise           != old->denoise)
+		|| (denoise_iterations != old->denoise_iterations)
+		|| (tile_scheduling   != old->tile_scheduling)
+		|| (specialize_shading != old->specialize_shading)
 		|| (filtered_envmap   != old->filtered_envmap)
 		|| (num_triangles     != old->num_triangles)
+		|| (bvh_build_method  != old->bvh_build_method)
+		|| (bvh_max_triangles_in_leaf != old->bvh_max_triangles_in_leaf)
+		|| (bvh_width         != old->bvh_width)
+		|| (animate_scene     != old->animate_scene)
+		|| (ray_packets       != old->ray_packets)
+		|| (ray_packet_size   != old->ray_packet_size)
+		|| (wavefront         != old->wavefront)
 		;
 
 	return restart;
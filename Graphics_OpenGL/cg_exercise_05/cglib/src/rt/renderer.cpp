@@ -5,9 +5,12 @@
 #include <cglib/rt/object.h>
 #include <cglib/rt/light.h>
 #include <cglib/rt/ray.h>
+#include <cglib/rt/ray_packet.h>
 #include <cglib/rt/raytracing_context.h>
 #include <cglib/rt/render_data.h>
+#include <cglib/rt/sampling_patterns.h>
 #include <cglib/rt/scene.h>
+#include <cglib/rt/shading_kernel.h>
 #include <exception>
 #include <stdexcept>
 
@@ -93,47 +96,64 @@ Ray createPrimaryRay(RenderData& data, float x, float y)
     return Ray(glm::vec3(origin_world_space), glm::vec3(direction_world_space));
 }
 
+/*
+ * Is there a precomputed result for exactly this primary ray?
+ */
+static PacketHit const*
+find_packet_hit(RenderData const& data, Ray const& ray, const Ray corner_rays[4])
+{
+	PacketHit const* h = data.packet_hit;
+	if (!h || h->ray.origin != ray.origin || h->ray.direction != ray.direction)
+		return nullptr;
+	if (h->has_corner_rays != (corner_rays != nullptr))
+		return nullptr;
+	for (int i = 0; corner_rays && i < 4; ++i) {
+		if (h->corner_rays[i].origin != corner_rays[i].origin
+		 || h->corner_rays[i].direction != corner_rays[i].direction)
+			return nullptr;
+	}
+	return h;
+}
+
 bool visible(
 	RenderData &data,
 	glm::vec3 const& from,
 	glm::vec3 const& to)
 {
 	data.num_cast_rays++;
+	PacketHit const* h = data.packet_hit;
+	if (h && h->hit && h->isect.position == from) {
+		for (int i = 0; i < h->num_lights; ++i) {
+			if (h->light_position[i] == to)
+				return h->light_visible[i];
+		}
+	}
     const glm::vec3 d = glm::normalize(to-from);
     const float dist = glm::length(to-from) - 2.f*data.context.params.ray_epsilon;
     Ray ray_eps(from + data.context.params.ray_epsilon * d, d);
-    for (auto& o : data.context.scene->objects) {
-        cg_assert(o);
-        Intersection isect;
-        if (o->intersect(ray_eps, &isect) && isect.t < dist) {
-            return false;
-        }
-    }
-    return true;
+    return !data.context.scene->tlas.occluded(ray_eps, dist);
 }
 
 bool shoot_ray(RenderData &data, Ray const& ray, Intersection* isect)
 {
-    Object* object = nullptr;
-
     cg_assert(isect);
+
+	if (PacketHit const* h = find_packet_hit(data, ray, nullptr)) {
+		if (h->hit && h->isect.t < isect->t) {
+			*isect = h->isect;
+			return true;
+		}
+		return false;
+	}
     
 	Ray ray_eps(ray.origin + data.context.params.ray_epsilon * ray.direction, ray.direction);
 
-    bool found_intersection = false;
-    for (auto& o : data.context.scene->objects) {
-        cg_assert(o);
-        Intersection isect_temp;
-        if (o->intersect(ray_eps, &isect_temp) && isect_temp.t < isect->t) {
-            found_intersection = true;
-            object = o.get();
-            *isect = isect_temp;
-        }
-    }
-
-    if(found_intersection) {
-        cg_assert(object);
-        object->compute_shading_info(isect);
+    HitRecord hit;
+    hit.t = isect->t;
+    if (data.context.scene->tlas.intersect(ray_eps, &hit)) {
+        cg_assert(hit.object);
+        hit.object->fill_intersection(ray_eps, hit, isect);
+        hit.object->compute_shading_info(isect);
         return true;
     }
 
@@ -146,31 +166,144 @@ bool shoot_ray(
 	const Ray corner_rays[4],
 	Intersection* isect)
 {
-    Object* object = nullptr;
-
     cg_assert(isect);
-    Ray ray_eps(ray.origin + data.context.params.ray_epsilon * ray.direction, ray.direction);
 
-    bool found_intersection = false;
-    for (auto& o : data.context.scene->objects) {
-        cg_assert(o);
-        Intersection isect_temp;
-        if (o->intersect(ray_eps, &isect_temp) && isect_temp.t < isect->t) {
-            found_intersection = true;
-            object = o.get();
-            *isect = isect_temp;
-        }
-    }
+	if (PacketHit const* h = find_packet_hit(data, ray, corner_rays)) {
+		if (h->hit && h->isect.t < isect->t) {
+			*isect = h->isect;
+			return true;
+		}
+		return false;
+	}
+
+    Ray ray_eps(ray.origin + data.context.params.ray_epsilon * ray.direction, ray.direction);
 
-    if(found_intersection) {
-        cg_assert(object);
-        object->compute_shading_info(corner_rays, isect);
+    HitRecord hit;
+    hit.t = isect->t;
+    if (data.context.scene->tlas.intersect(ray_eps, &hit)) {
+        cg_assert(hit.object);
+        hit.object->fill_intersection(ray_eps, hit, isect);
+        hit.object->compute_shading_info(corner_rays, isect);
         return true;
     }
 
     return false;
 }
 
+void trace_primary_packet(
+	RenderData &data,
+	int x0, int y0,
+	int w, int h,
+	PacketHit hits[])
+{
+	auto const& params  = data.context.params;
+	auto const& objects = data.context.scene->objects;
+	const float eps = params.ray_epsilon;
+	const int n = w * h;
+	cg_assert(n > 0 && n <= RayPacket::MAX_SIZE);
+
+	/* trace_recursive asks for the pixel footprint in these modes */
+	const bool footprint = params.tex_filter_mode == TextureFilterMode::TRILINEAR
+	                    || params.tex_filter_mode == TextureFilterMode::DEBUG_MIP;
+
+	/* neighboring pixels share their corner rays */
+	Ray corners[2 * (RayPacket::MAX_SIZE + 1)]; /* (w + 1) * (h + 1) for w * h <= MAX_SIZE */
+	if (footprint) {
+		for (int y = 0; y <= h; ++y) {
+			for (int x = 0; x <= w; ++x)
+				corners[y * (w + 1) + x] = createPrimaryRay(data, float(x0 + x), float(y0 + y));
+		}
+	}
+
+	RayPacket packet;
+	packet.size = n;
+	Object* hit_object[RayPacket::MAX_SIZE];
+	for (int i = 0; i < n; ++i) {
+		const int x = i % w;
+		const int y = i / w;
+
+		PacketHit &ph = hits[i];
+		ph = PacketHit();
+		ph.ray = createPrimaryRay(data, float(x0 + x) + 0.5f, float(y0 + y) + 0.5f);
+		ph.has_corner_rays = footprint;
+		if (footprint) {
+			/* same order as in trace_recursive */
+			ph.corner_rays[0] = corners[ y      * (w + 1) + x    ];
+			ph.corner_rays[1] = corners[(y + 1) * (w + 1) + x + 1];
+			ph.corner_rays[2] = corners[(y + 1) * (w + 1) + x    ];
+			ph.corner_rays[3] = corners[ y      * (w + 1) + x + 1];
+		}
+		packet.rays[i] = Ray(ph.ray.origin + eps * ph.ray.direction, ph.ray.direction);
+		hit_object[i] = nullptr;
+	}
+
+	Intersection isects[RayPacket::MAX_SIZE];
+	bool found[RayPacket::MAX_SIZE];
+	for (auto& o : objects) {
+		cg_assert(o);
+		o->intersect_packet(packet, isects, found);
+		for (int i = 0; i < n; ++i) {
+			if (found[i] && isects[i].t < hits[i].isect.t) {
+				hits[i].isect = isects[i];
+				hit_object[i] = o.get();
+			}
+		}
+	}
+
+	for (int i = 0; i < n; ++i) {
+		PacketHit &ph = hits[i];
+		if (!hit_object[i])
+			continue;
+		ph.hit = true;
+		if (footprint)
+			hit_object[i]->compute_shading_info(ph.corner_rays, &ph.isect);
+		else
+			hit_object[i]->compute_shading_info(&ph.isect);
+	}
+
+	/* point light shadow rays, only where trace_recursive will cast them */
+	if (!params.shadows || params.ao || params.soft_shadow)
+		return;
+
+	const int num_lights = std::min(int(data.context.scene->lights.size()), int(PacketHit::MAX_LIGHTS));
+	for (int l = 0; l < num_lights; ++l) {
+		const glm::vec3 to = data.context.scene->lights[l]->getPosition();
+
+		RayPacket shadow;
+		int pixel[RayPacket::MAX_SIZE];
+		float dist[RayPacket::MAX_SIZE];
+		bool occluded[RayPacket::MAX_SIZE];
+		for (int i = 0; i < n; ++i) {
+			PacketHit const& ph = hits[i];
+			if (!ph.hit || glm::dot(ph.isect.geometric_normal, -ph.ray.direction) < 0.f)
+				continue;
+			/* same rays as visible() */
+			const glm::vec3 from = ph.isect.position;
+			const glm::vec3 d = glm::normalize(to - from);
+			dist[shadow.size]     = glm::length(to - from) - 2.f * eps;
+			occluded[shadow.size] = false;
+			pixel[shadow.size]    = i;
+			shadow.rays[shadow.size++] = Ray(from + eps * d, d);
+		}
+		if (shadow.size == 0)
+			break;
+
+		for (auto& o : objects) {
+			o->intersect_packet(shadow, isects, found);
+			for (int k = 0; k < shadow.size; ++k)
+				occluded[k] = occluded[k] || (found[k] && isects[k].t < dist[k]);
+		}
+
+		for (int k = 0; k < shadow.size; ++k) {
+			PacketHit &ph = hits[pixel[k]];
+			cg_assert(ph.num_lights == l);
+			ph.light_position[l] = to;
+			ph.light_visible[l]  = !occluded[k];
+			ph.num_lights = l + 1;
+		}
+	}
+}
+
 glm::vec3 evaluate_ambient(
 	RenderData &data,			// class containing raytracing information
 	MaterialSample const& mat,	// the material at position
@@ -250,19 +383,44 @@ glm::vec3 evaluate_phong(
 float max_unobstructed_distance(
 	RenderData &data,
 	glm::vec3 const& from,
-	glm::vec3 const& dir)
+	glm::vec3 const& dir,
+	float max_distance)
 {
 	data.num_cast_rays++;
     Ray ray_eps(from + data.context.params.ray_epsilon * dir, dir);
-	float closest_hit = FLT_MAX;
-    for (auto& o : data.context.scene->objects) {
-        cg_assert(o);
-        Intersection isect;
-        if (o->intersect(ray_eps, &isect) && isect.t < closest_hit) {
-            closest_hit = isect.t + data.context.params.ray_epsilon;
-        }
+    HitRecord hit;
+    hit.t = max_distance;
+    if (data.context.scene->tlas.intersect(ray_eps, &hit)) {
+        return hit.t + data.context.params.ray_epsilon;
     }
-    return closest_hit;
+    return FLT_MAX;
+}
+
+glm::vec3 visible_contribution(
+	RenderData &data,
+	glm::vec3 const& from,
+	glm::vec3 const& to,
+	glm::vec3 const& contribution)
+{
+	if (data.deferred_rays) {
+		data.deferred_rays->shadow_ray(from, to, contribution);
+		return glm::vec3(0.f);
+	}
+	return visible(data, from, to) ? contribution : glm::vec3(0.f);
+}
+
+float ambient_occlusion_ray(
+	RenderData &data,
+	glm::vec3 const& from,
+	glm::vec3 const& dir,
+	float max_distance,
+	float weight)
+{
+	if (data.deferred_rays) {
+		data.deferred_rays->occlusion_ray(from, dir, max_distance, weight);
+		return 0.f;
+	}
+	return weight * ambient_occlusion_falloff(data, max_unobstructed_distance(data, from, dir, max_distance));
 }
 
 glm::vec3 evaluate_phong_BRDF(
@@ -292,6 +450,222 @@ glm::vec3 evaluate_phong_BRDF(
 	return diffuse + specular;
 }
 
+/*
+ * An orthonormal basis with the given z axis, see Duff et al., "Building an
+ * Orthonormal Basis, Revisited", JCGT 2017.
+ */
+static void
+make_frame(glm::vec3 const& z, glm::vec3* x, glm::vec3* y)
+{
+	const float sign = std::copysign(1.f, z.z);
+	const float a = -1.f / (sign + z.z);
+	const float b = z.x * z.y * a;
+	*x = glm::vec3(1.f + sign * z.x * z.x * a, sign * b, -sign * z.x);
+	*y = glm::vec3(b, sign + z.y * z.y * a, -z.y);
+}
+
+/*
+ * Direction with angle cos_theta = c to the axis z.
+ */
+static glm::vec3
+sample_around(glm::vec3 const& z, float c, float phi)
+{
+	glm::vec3 x, y;
+	make_frame(z, &x, &y);
+	const float s = std::sqrt(std::max(0.f, 1.f - c * c));
+	return glm::normalize(s * std::cos(phi) * x + s * std::sin(phi) * y + c * z);
+}
+
+float diffuse_lobe_probability(
+	RenderData const& data,
+	MaterialSample const& mat)
+{
+	const glm::vec3 luminance(0.2126f, 0.7152f, 0.0722f);
+	const float d = data.context.params.diffuse  ? glm::dot(mat.k_d, luminance) : 0.f;
+	const float s = data.context.params.specular ? glm::dot(mat.k_s, luminance) : 0.f;
+	return (d + s > 0.f) ? d / (d + s) : 1.f;
+}
+
+glm::vec3 cosine_sample_hemisphere(
+	glm::vec2 const& u,
+	glm::vec3 const& N)
+{
+	return sample_around(N, std::sqrt(1.f - u.x), 2.f * float(M_PI) * u.y);
+}
+
+float sample_phong_BRDF(
+	RenderData &data,
+	MaterialSample const& mat,
+	glm::vec2 const& u,
+	glm::vec3 const& N,
+	glm::vec3 const& V,
+	glm::vec3* L)
+{
+	cg_assert(L);
+
+	/* reuse the first coordinate to choose the lobe */
+	const float p_diffuse = diffuse_lobe_probability(data, mat);
+	if (u.x < p_diffuse)
+		*L = cosine_sample_hemisphere(glm::vec2(u.x / p_diffuse, u.y), N);
+	else
+		sample_phong_specular_lobe(mat, glm::vec2((u.x - p_diffuse) / (1.f - p_diffuse), u.y), N, V, L);
+	return phong_BRDF_pdf(data, mat, *L, N, V);
+}
+
+float sample_phong_specular_lobe(
+	MaterialSample const& mat,
+	glm::vec2 const& u,
+	glm::vec3 const& N,
+	glm::vec3 const& V,
+	glm::vec3* L)
+{
+	cg_assert(L);
+	const float c = std::pow(std::max(u.x, 1e-7f), 1.f / (mat.n + 1.f));
+	*L = sample_around(reflect(V, N), c, 2.f * float(M_PI) * u.y);
+	return phong_specular_lobe_pdf(mat, *L, N, V);
+}
+
+float phong_specular_lobe_pdf(
+	MaterialSample const& mat,
+	glm::vec3 const& L,
+	glm::vec3 const& N,
+	glm::vec3 const& V)
+{
+	const float c = std::max(0.f, glm::dot(reflect(V, N), L));
+	return std::pow(c, mat.n) * (mat.n + 1.f) / (2.f * float(M_PI));
+}
+
+float phong_BRDF_pdf(
+	RenderData &data,
+	MaterialSample const& mat,
+	glm::vec3 const& L,
+	glm::vec3 const& N,
+	glm::vec3 const& V)
+{
+	const float p_diffuse = diffuse_lobe_probability(data, mat);
+	float pdf = 0.f;
+	if (p_diffuse > 0.f)
+		pdf += p_diffuse * std::max(0.f, glm::dot(N, L)) / float(M_PI);
+	if (p_diffuse < 1.f)
+		pdf += (1.f - p_diffuse) * phong_specular_lobe_pdf(mat, L, N, V);
+	return pdf;
+}
+
+glm::vec3 evaluate_phong_diffuse_BRDF(
+	RenderData const& data,
+	MaterialSample const& mat,
+	glm::vec3 const& L,
+	glm::vec3 const& N)
+{
+	if (!data.context.params.diffuse)
+		return glm::vec3(0.f);
+	return std::max(0.f, glm::dot(N, L)) * mat.k_d / float(M_PI);
+}
+
+float power_heuristic(int n_a, float pdf_a, int n_b, float pdf_b)
+{
+	const float a = n_a * pdf_a;
+	const float b = n_b * pdf_b;
+	return (a * a) / (a * a + b * b);
+}
+
+glm::vec3
+env_map_lookup(RenderData &data, const glm::vec3 &dir)
+{
+	cg_assert(std::fabs(glm::length(dir) - 1.f) < EPSILON);
+
+	auto &env_map = data.context.scene->env_map;
+
+	if(!env_map)
+		return glm::vec3(0.0f);
+
+	float x = (std::atan2(dir.z, dir.x) + static_cast<float>(M_PI)) / (2.0f * static_cast<float>(M_PI));
+	float y = (std::asin(dir.y) + static_cast<float>(M_PI)/2.0f) / static_cast<float>(M_PI);
+
+	switch(data.context.params.tex_filter_mode) {
+	case TextureFilterMode::NEAREST:
+		return glm::vec3(env_map->evaluate_nearest(0, glm::vec2(x, y)));
+	default:
+		return glm::vec3(env_map->evaluate_bilinear(0, glm::vec2(x, y)));
+	}
+}
+
+bool
+shoot_ray_at_depth(RenderData & data, Ray const& ray, int depth, Intersection* isect)
+{
+    if ((   data.context.params.tex_filter_mode == TextureFilterMode::TRILINEAR
+	     || data.context.params.tex_filter_mode == TextureFilterMode::DEBUG_MIP)
+		&& depth == 0)
+	{
+        // shoot ray and compute pixel footprint with corner rays
+        Ray rays[] = { createPrimaryRay(data, (data.x - 0.5f), (data.y - 0.5f)),
+                       createPrimaryRay(data, (data.x + 0.5f), (data.y + 0.5f)),
+                       createPrimaryRay(data, (data.x - 0.5f), (data.y + 0.5f)),
+                       createPrimaryRay(data, (data.x + 0.5f), (data.y - 0.5f))};
+        return shoot_ray(data, ray, rays, isect);
+    }
+    return shoot_ray(data, ray, isect);
+}
+
+MaterialSample
+shading_material(RenderData const& data, Intersection const& isect)
+{
+    MaterialSample mat = isect.material;
+	if (data.context.params.diffuse_white_mode) {
+		mat.k_a = glm::vec3(0.1f);
+		mat.k_d = glm::vec3(1.0f);
+		mat.k_s = glm::vec3(0.0f);
+		mat.k_r = glm::vec3(0.0f);
+		mat.k_t = glm::vec3(0.0f);
+	}
+	return mat;
+}
+
+/*
+ * The switches of trace_recursive and the functions it recurses through.
+ * RuntimeShading reads them from the parameters on every hit, as the
+ * renderer always did. StaticShading<FLAGS> fixes them at compile time, so
+ * that the branches they disable are compiled out of the specialized
+ * kernels, see shading_kernel.h.
+ */
+namespace {
+
+enum ShadingFlag
+{
+	AO             = 1 << 0,
+	NORMAL_MAPPING = 1 << 1,
+	REFLECTION     = 1 << 2,
+	TRANSMISSION   = 1 << 3,
+	FRESNEL        = 1 << 4,
+	DISPERSION     = 1 << 5,
+	NUM_KERNELS    = 1 << 6
+};
+
+struct RuntimeShading
+{
+	static bool ao(RenderData const& data)             { return data.context.params.ao; }
+	static bool normal_mapping(RenderData const& data) { return data.context.params.normal_mapping; }
+	static bool reflection(RenderData const& data)     { return data.context.params.reflection; }
+	static bool transmission(RenderData const& data)   { return data.context.params.transmission; }
+	static bool fresnel(RenderData const& data)        { return data.context.params.fresnel; }
+	static bool dispersion(RenderData const& data)     { return data.context.params.dispersion; }
+};
+
+template <unsigned FLAGS>
+struct StaticShading
+{
+	static bool ao(RenderData const&)             { return (FLAGS & AO) != 0; }
+	static bool normal_mapping(RenderData const&) { return (FLAGS & NORMAL_MAPPING) != 0; }
+	static bool reflection(RenderData const&)     { return (FLAGS & REFLECTION) != 0; }
+	static bool transmission(RenderData const&)   { return (FLAGS & TRANSMISSION) != 0; }
+	static bool fresnel(RenderData const&)        { return (FLAGS & FRESNEL) != 0; }
+	static bool dispersion(RenderData const&)     { return (FLAGS & DISPERSION) != 0; }
+};
+
+template <class Shading>
+glm::vec3 trace_recursive(RenderData & data, Ray const& ray, int depth);
+
+template <class Shading>
 glm::vec3 evaluate_reflection(
 	RenderData & data,
 	int depth,
@@ -302,9 +676,10 @@ glm::vec3 evaluate_reflection(
 	// TODO: calculate reflective contribution by contructing and shooting a reflection ray.
 	const glm::vec3 R = reflect(V, N);
 	Ray ray_reflection(P + data.context.params.ray_epsilon * R, R);
-	return trace_recursive(data, ray_reflection, depth + 1);
+	return trace_recursive<Shading>(data, ray_reflection, depth + 1);
 }
 
+template <class Shading>
 glm::vec3 evaluate_transmission(
 	RenderData & data,
 	int depth,          // recursion depth
@@ -319,11 +694,12 @@ glm::vec3 evaluate_transmission(
 	if (refract(V, N, eta, &T))
 	{
 		Ray ray_transmission(P + data.context.params.ray_epsilon * T, T);
-		contribution = trace_recursive(data, ray_transmission, depth + 1);
+		contribution = trace_recursive<Shading>(data, ray_transmission, depth + 1);
 	}
 	return contribution;
 }
 
+template <class Shading>
 glm::vec3 handle_transmissive_material_single_ior(
 	RenderData &data,			// class containing raytracing information
 	int depth,					// the current recursion depth
@@ -332,23 +708,23 @@ glm::vec3 handle_transmissive_material_single_ior(
 	glm::vec3 const& V,			// view vector (already normalized)
 	float eta)					// the relative refraction index
 {
-	if (data.context.params.fresnel) {
+	if (Shading::fresnel(data)) {
 		// TODO: implement fresnel handling here.
 		const float F = fresnel(V, N, eta);
 
 		cg_assert(F >= 0.f);
 		cg_assert(F <= 1.f);
 
-		return     	  F * evaluate_reflection(data, depth, P, N, V)
-			+ (1.f - F) * evaluate_transmission(data, depth, P, N, V, eta);
+		return     	  F * evaluate_reflection<Shading>(data, depth, P, N, V)
+			+ (1.f - F) * evaluate_transmission<Shading>(data, depth, P, N, V, eta);
 	}
 	else {
 		// just regular transmission
-		return evaluate_transmission(data, depth, P, N, V, eta);
+		return evaluate_transmission<Shading>(data, depth, P, N, V, eta);
 	}
 }
 
-
+template <class Shading>
 glm::vec3 handle_transmissive_material(
 	RenderData & data,
 	int depth,          // recursion depth
@@ -357,43 +733,23 @@ glm::vec3 handle_transmissive_material(
 	glm::vec3 const& V, // View vector (already normalized)
 	glm::vec3 const& eta_of_channel)
 {
-	if (data.context.params.dispersion && !(eta_of_channel[0] == eta_of_channel[1] && eta_of_channel[0] == eta_of_channel[2])) {
+	if (Shading::dispersion(data) && !(eta_of_channel[0] == eta_of_channel[1] && eta_of_channel[0] == eta_of_channel[2])) {
 		// TODO: split ray into 3 rays (one for each color channel) and implement dispersion here
 		glm::vec3 contribution(0.f);
 		for (int i = 0; i < 3; ++i) {
 			float eta = eta_of_channel[i];
-			contribution[i] += handle_transmissive_material_single_ior(data, depth, P, N, V, eta)[i];
+			contribution[i] += handle_transmissive_material_single_ior<Shading>(data, depth, P, N, V, eta)[i];
 		}
 		return contribution;
 	}
 	else {
 		const float eta = 1.f/3.f*(eta_of_channel[0]+eta_of_channel[1]+eta_of_channel[2]);
-		return handle_transmissive_material_single_ior(data, depth, P, N, V, eta);
+		return handle_transmissive_material_single_ior<Shading>(data, depth, P, N, V, eta);
 	}
 	return glm::vec3(0.f);
 }
 
-glm::vec3
-env_map_lookup(RenderData &data, const glm::vec3 &dir)
-{
-	cg_assert(std::fabs(glm::length(dir) - 1.f) < EPSILON);
-
-	auto &env_map = data.context.scene->env_map;
-
-	if(!env_map)
-		return glm::vec3(0.0f);
-
-	float x = (std::atan2(dir.z, dir.x) + static_cast<float>(M_PI)) / (2.0f * static_cast<float>(M_PI));
-	float y = (std::asin(dir.y) + static_cast<float>(M_PI)/2.0f) / static_cast<float>(M_PI);
-
-	switch(data.context.params.tex_filter_mode) {
-	case TextureFilterMode::NEAREST:
-		return glm::vec3(env_map->evaluate_nearest(0, glm::vec2(x, y)));
-	default:
-		return glm::vec3(env_map->evaluate_bilinear(0, glm::vec2(x, y)));
-	}
-}
-
+template <class Shading>
 glm::vec3 trace_recursive(RenderData & data, Ray const& ray, int depth)
 {
     if (depth > data.context.params.max_depth) {
@@ -403,42 +759,19 @@ glm::vec3 trace_recursive(RenderData & data, Ray const& ray, int depth)
     glm::vec3 contribution(0.f);
     Intersection isect;
 
-	bool found_intersection = false;
-    if ((   data.context.params.tex_filter_mode == TextureFilterMode::TRILINEAR
-	     || data.context.params.tex_filter_mode == TextureFilterMode::DEBUG_MIP)
-		&& depth == 0)
-	{
-        // shoot ray and compute pixel footprint with corner rays
-        Ray rays[] = { createPrimaryRay(data, (data.x - 0.5f), (data.y - 0.5f)),
-                       createPrimaryRay(data, (data.x + 0.5f), (data.y + 0.5f)),
-                       createPrimaryRay(data, (data.x - 0.5f), (data.y + 0.5f)),
-                       createPrimaryRay(data, (data.x + 0.5f), (data.y - 0.5f))};
-        found_intersection = shoot_ray(data, ray, rays, &isect);
-    }
-    else {
-        found_intersection = shoot_ray(data, ray, &isect);
-    }
-
-	if(!found_intersection) {
+	if(!shoot_ray_at_depth(data, ray, depth, &isect)) {
 		return env_map_lookup(data, ray.direction);
 	}
 
     if(depth == 0)
 		data.isect = isect;
 
-    MaterialSample mat = isect.material;
-	if (data.context.params.diffuse_white_mode) {
-		mat.k_a = glm::vec3(0.1f);
-		mat.k_d = glm::vec3(1.0f);
-		mat.k_s = glm::vec3(0.0f);
-		mat.k_r = glm::vec3(0.0f);
-		mat.k_t = glm::vec3(0.0f);
-	}
-    const glm::vec3 N = data.context.params.normal_mapping ? isect.shading_normal : isect.normal;
+    MaterialSample mat = shading_material(data, isect);
+    const glm::vec3 N = Shading::normal_mapping(data) ? isect.shading_normal : isect.normal;
     const glm::vec3 V = -ray.direction;
     const bool hit_backside = glm::dot(isect.geometric_normal, V) < 0.f;
 
-	if (data.context.params.ao) {
+	if (Shading::ao(data)) {
 		const float ao = evaluate_ambient_occlusion(data, isect.position, N);
 		return glm::vec3(ao);
 	}
@@ -458,13 +791,257 @@ glm::vec3 trace_recursive(RenderData & data, Ray const& ray, int depth)
     }
 
     // recursive tracing
-    if (!hit_backside && data.context.params.reflection && glm::length(mat.k_r) > 0.f) {
-		contribution += mat.k_r * evaluate_reflection(data, depth, isect.position, N, V);
+    if (!hit_backside && Shading::reflection(data) && glm::length(mat.k_r) > 0.f) {
+		contribution += mat.k_r * evaluate_reflection<Shading>(data, depth, isect.position, N, V);
     }
-    if (data.context.params.transmission && glm::length(mat.k_t) > 0.f) {
-		contribution += mat.k_t * handle_transmissive_material(data, depth, isect.position, N, V, mat.eta);
+    if (Shading::transmission(data) && glm::length(mat.k_t) > 0.f) {
+		contribution += mat.k_t * handle_transmissive_material<Shading>(data, depth, isect.position, N, V, mat.eta);
     }
 
     return contribution;
 }
 
+/*
+ * The kernels of all combinations of flags, indexed by them.
+ */
+template <unsigned N>
+struct KernelTable
+{
+	static void fill(ShadingKernel* table)
+	{
+		table[N - 1] = &trace_recursive<StaticShading<N - 1>>;
+		KernelTable<N - 1>::fill(table);
+	}
+};
+
+template <>
+struct KernelTable<0>
+{
+	static void fill(ShadingKernel*) {}
+};
+
+struct Kernels
+{
+	ShadingKernel table[NUM_KERNELS];
+	Kernels() { KernelTable<NUM_KERNELS>::fill(table); }
+};
+
+}
+
+glm::vec3 evaluate_reflection(
+	RenderData & data,
+	int depth,
+	glm::vec3 const& P,
+	glm::vec3 const& N,
+	glm::vec3 const& V)
+{
+	return evaluate_reflection<RuntimeShading>(data, depth, P, N, V);
+}
+
+glm::vec3 evaluate_transmission(
+	RenderData & data,
+	int depth,
+	glm::vec3 const& P,
+	glm::vec3 const& N,
+	glm::vec3 const& V,
+	float eta)
+{
+	return evaluate_transmission<RuntimeShading>(data, depth, P, N, V, eta);
+}
+
+glm::vec3 handle_transmissive_material_single_ior(
+	RenderData &data,
+	int depth,
+	glm::vec3 const& P,
+	glm::vec3 const& N,
+	glm::vec3 const& V,
+	float eta)
+{
+	return handle_transmissive_material_single_ior<RuntimeShading>(data, depth, P, N, V, eta);
+}
+
+glm::vec3 handle_transmissive_material(
+	RenderData & data,
+	int depth,
+	glm::vec3 const& P,
+	glm::vec3 const& N,
+	glm::vec3 const& V,
+	glm::vec3 const& eta_of_channel)
+{
+	return handle_transmissive_material<RuntimeShading>(data, depth, P, N, V, eta_of_channel);
+}
+
+glm::vec3 trace_recursive(RenderData & data, Ray const& ray, int depth)
+{
+	return trace_recursive<RuntimeShading>(data, ray, depth);
+}
+
+ShadingKernel
+select_shading_kernel(RaytracingParameters const& params)
+{
+	if (!params.specialize_shading)
+		return nullptr;
+
+	static const Kernels kernels;
+	unsigned flags = 0;
+	if (params.ao)             flags |= AO;
+	if (params.normal_mapping) flags |= NORMAL_MAPPING;
+	if (params.reflection)     flags |= REFLECTION;
+	if (params.transmission)   flags |= TRANSMISSION;
+	if (params.fresnel)        flags |= FRESNEL;
+	if (params.dispersion)     flags |= DISPERSION;
+	return kernels.table[flags];
+}
+
+/*
+ * Paths take this many bounces before Russian roulette may end them.
+ */
+static const int RUSSIAN_ROULETTE_DEPTH = 2;
+
+bool continue_path(
+	RenderData & data,
+	MaterialSample const& mat,
+	glm::vec3 const& P,
+	glm::vec3 const& N,
+	glm::vec3 const& V,
+	bool hit_backside,
+	int depth,
+	glm::vec3* throughput,
+	int* hero,
+	Ray* ray)
+{
+	cg_assert(throughput && hero && ray);
+	RaytracingParameters const& params = data.context.params;
+	const glm::vec3 luminance(0.2126f, 0.7152f, 0.0722f);
+
+	/* choose one of the rays trace_recursive would follow, in proportion
+	 * to the luminance of its weight */
+	float w_indirect = 0.f;
+	if (!hit_backside && params.indirect) {
+		if (params.diffuse)
+			w_indirect += glm::dot(mat.k_d, luminance);
+		if (params.specular)
+			w_indirect += glm::dot(mat.k_s, luminance);
+	}
+	const float w_reflect  = (!hit_backside && params.reflection) ? glm::dot(mat.k_r, luminance) : 0.f;
+	const float w_transmit = params.transmission ? glm::dot(mat.k_t, luminance) : 0.f;
+	const float w_sum = w_indirect + w_reflect + w_transmit;
+	if (!(w_sum > 0.f))
+		return false;
+
+	const float u = data.tld->rand() * w_sum;
+	const glm::vec2 s = data.tld->sample_set_2d(1)[0];
+	glm::vec3 dir;
+	if (u < w_indirect) {
+		float pdf = 1.f / (2.f * float(M_PI));
+		if (params.sampling != RaytracingParameters::SAMPLE_UNIFORM)
+			pdf = sample_phong_BRDF(data, mat, s, N, V, &dir);
+		else
+			dir = uniform_sample_hemisphere(s, N);
+		if (pdf <= 0.f || glm::dot(dir, N) <= 0.f)
+			return false;
+		*throughput *= evaluate_phong_BRDF(data, mat, dir, N, V) * (w_sum / (w_indirect * pdf));
+		*ray = Ray(P, dir);
+	}
+	else if (u < w_indirect + w_reflect) {
+		dir = reflect(V, N);
+		*throughput *= mat.k_r * (w_sum / w_reflect);
+		*ray = Ray(P + params.ray_epsilon * dir, dir);
+	}
+	else {
+		*throughput *= mat.k_t * (w_sum / w_transmit);
+
+		/* a dispersive refraction sends every channel elsewhere, so the
+		 * path keeps one of them, weighted by 1 / probability */
+		glm::vec3 const& eta_of_channel = mat.eta;
+		float eta = (eta_of_channel[0] + eta_of_channel[1] + eta_of_channel[2]) / 3.f;
+		if (params.dispersion && !(eta_of_channel[0] == eta_of_channel[1] && eta_of_channel[0] == eta_of_channel[2])) {
+			if (*hero < 0) {
+				*hero = std::min(int(data.tld->rand() * 3.f), 2);
+				glm::vec3 mask(0.f);
+				mask[*hero] = 3.f;
+				*throughput *= mask;
+			}
+			eta = eta_of_channel[*hero];
+		}
+
+		if (params.fresnel && s.x < fresnel(V, N, eta))
+			dir = reflect(V, N);
+		else if (!refract(V, N, eta, &dir))
+			return false;
+		*ray = Ray(P + params.ray_epsilon * dir, dir);
+	}
+
+	if (depth + 1 >= RUSSIAN_ROULETTE_DEPTH) {
+		const float q = std::min(glm::max(throughput->x, glm::max(throughput->y, throughput->z)), 0.95f);
+		if (!(data.tld->rand() < q))
+			return false;
+		*throughput /= q;
+	}
+	return true;
+}
+
+glm::vec3 trace_path(RenderData & data, Ray const& camera_ray)
+{
+	RaytracingParameters const& params = data.context.params;
+
+	glm::vec3 radiance(0.f);
+	glm::vec3 throughput(1.f);
+	int hero = -1; /* the color channel followed after dispersion */
+	Ray ray = camera_ray;
+
+	for (int depth = 0; depth <= params.max_depth; ++depth)
+	{
+		Intersection isect;
+		if (!shoot_ray_at_depth(data, ray, depth, &isect)) {
+			radiance += throughput * env_map_lookup(data, ray.direction);
+			break;
+		}
+
+		if (depth == 0)
+			data.isect = isect;
+
+		const MaterialSample mat = shading_material(data, isect);
+		const glm::vec3 P = isect.position;
+		const glm::vec3 N = params.normal_mapping ? isect.shading_normal : isect.normal;
+		const glm::vec3 V = -ray.direction;
+		const bool hit_backside = glm::dot(isect.geometric_normal, V) < 0.f;
+
+		if (params.ao) {
+			radiance += throughput * evaluate_ambient_occlusion(data, P, N);
+			break;
+		}
+
+		if (!hit_backside && !(params.disable_direct && depth == 0))
+			radiance += throughput * evaluate_direct_illumination(data, mat, P, N, V);
+
+		if (depth == params.max_depth
+		 || !continue_path(data, mat, P, N, V, hit_backside, depth, &throughput, &hero, &ray))
+			break;
+	}
+
+	return radiance;
+}
+
+glm::vec3 trace_camera_ray(RenderData & data, Ray const& ray, int depth)
+{
+	if (data.context.params.render_mode == RaytracingParameters::PATH_TRACE)
+		return trace_path(data, ray);
+	if (data.context.shading_kernel)
+		return data.context.shading_kernel(data, ray, depth);
+	return trace_recursive(data, ray, depth);
+}
+
+glm::vec3 trace_pixel_sample(RenderData & data, int x, int y, int sample)
+{
+	ThreadLocalData* tld = data.tld;
+	RaytracingParameters const& params = data.context.params;
+	const int spp = std::max(int(params.spp), 1);
+	const glm::vec2 offset = (spp == 1 && sample == 0)
+		? glm::vec2(0.5f)
+		: pixel_sample(sample, spp, params.stratified, tld);
+	data.x = float(x) + offset.x;
+	data.y = float(y) + offset.y;
+	tld->random.begin_sample(sample);
+	return trace_recursive_with_lens(data, createPrimaryRay(data, data.x, data.y), 0);
+}
@@ -0,0 +1,188 @@
+#include <cglib/rt/reprojection.h>
+
+#include <cglib/rt/intersection.h>
+#include <cglib/rt/object.h>
+#include <cglib/rt/ray.h>
+#include <cglib/rt/raytracing_context.h>
+#include <cglib/rt/render_data.h>
+#include <cglib/rt/renderer.h>
+#include <cglib/rt/scene.h>
+
+#include <cglib/core/assert.h>
+#include <cglib/core/camera.h>
+#include <cglib/core/thread_local_data.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/*
+ * How far a hit may lie from the tangent plane of a previous pixel,
+ * relative to its distance from the previous camera, for the pixel to
+ * still see the same surface.
+ */
+const float DEPTH_TOLERANCE = 0.02f;
+
+/*
+ * Where the view sees p, a point if p.w is 1 and a direction if it is 0,
+ * in pixels. Inverts createPrimaryRay.
+ */
+bool
+project(RaytracingParameters const& params, glm::mat4 const& view, glm::vec4 const& p, glm::vec2* pixel)
+{
+	const float height = float(params.image_height);
+	const float width  = float(params.image_width);
+	const float z = height/(std::tan(float(M_PI)/180.f*params.fovy));
+
+	const glm::vec4 p_view = view * p;
+	if (p_view.z >= 0.f)
+		return false;
+
+	const float x = width/2.f  + p_view.x * z / -p_view.z;
+	const float y = height/2.f + p_view.y * z / -p_view.z;
+	if (!(x >= 0.f && x < width && y >= 0.f && y < height))
+		return false;
+	*pixel = glm::vec2(x, y);
+	return true;
+}
+
+/*
+ * Did the pixel of the previous view see what the new one sees at position?
+ */
+bool
+is_valid(FrameHistory const& previous, HistoryPixel const& old, glm::vec3 const& position, bool hit)
+{
+	if (old.n == 0 || old.hit != hit)
+		return false;
+	if (!hit)
+		return true;
+	const float distance = std::abs(glm::dot(old.normal, position - old.position));
+	return distance <= DEPTH_TOLERANCE * glm::length(position - previous.eye);
+}
+
+}
+
+void
+FrameHistory::begin(RaytracingContext const& context, int width_, int height_)
+{
+	width  = width_;
+	height = height_;
+	view   = context.scene->camera->get_view_matrix(Camera::Mono);
+	eye    = context.scene->camera->get_position(Camera::Mono);
+	pixels.assign(width * height, HistoryPixel());
+}
+
+bool
+reprojection_supported(RaytracingParameters const& params)
+{
+	return !params.stereo && !(params.dof && params.dof_rays > 0);
+}
+
+void
+record_primary_hit(RenderData& data, HistoryPixel* pixel)
+{
+	cg_assert(pixel);
+
+	pixel->hit = data.isect.isValid();
+	if (pixel->hit)
+	{
+		pixel->position = data.isect.position;
+		pixel->normal   = data.isect.geometric_normal;
+	}
+	else
+		pixel->position = createPrimaryRay(data, data.x, data.y).direction;
+}
+
+bool
+reproject_tile(
+	RaytracingContext const& context,
+	ThreadLocalData* tld,
+	FrameHistory const& previous,
+	FrameHistory* current,
+	int x0, int y0,
+	int x1, int y1,
+	std::atomic<bool> const& terminate,
+	int* num_reused)
+{
+	cg_assert(tld);
+	cg_assert(current);
+	cg_assert(previous.width == current->width && previous.height == current->height);
+
+	RaytracingParameters const& params = context.params;
+	RenderData data(context, tld);
+	tld->sampler = &Sampler::get(params.sampler);
+
+	int reused = 0;
+	for (int y = y0; y < y1; ++y)
+	{
+		if (terminate.load())
+			return false;
+
+		for (int x = x0; x < x1; ++x)
+		{
+			/* what the center of the pixel sees now */
+			const Ray ray = createPrimaryRay(data, float(x) + 0.5f, float(y) + 0.5f);
+			const Ray ray_eps(ray.origin + params.ray_epsilon * ray.direction, ray.direction);
+			HitRecord hit;
+			Intersection isect;
+			const bool found = context.scene->tlas.intersect(ray_eps, &hit);
+			data.num_cast_rays++;
+			if (found)
+				hit.object->fill_intersection(ray_eps, hit, &isect);
+			const glm::vec3 position = found ? isect.position : ray.direction;
+
+			/* and the bilinear weights of the previous pixels that saw the
+			 * same, which are all four unless it was disoccluded */
+			glm::vec3 mean(0.f);
+			float weight = 0.f;
+			int n = REPROJECTION_MAX_HISTORY;
+			glm::vec2 p;
+			if (project(params, previous.view, glm::vec4(position, found ? 1.f : 0.f), &p))
+			{
+				const glm::vec2 q = p - glm::vec2(0.5f);
+				const int qx = int(std::floor(q.x));
+				const int qy = int(std::floor(q.y));
+				const glm::vec2 f = q - glm::vec2(float(qx), float(qy));
+				for (int i = 0; i < 4; ++i)
+				{
+					const int ox = std::min(std::max(qx + (i & 1), 0), previous.width - 1);
+					const int oy = std::min(std::max(qy + (i >> 1), 0), previous.height - 1);
+					HistoryPixel const& old = previous.pixels[oy * previous.width + ox];
+					if (!is_valid(previous, old, position, found))
+					{
+						weight = 0.f;
+						break;
+					}
+					const float w = ((i & 1) ? f.x : 1.f - f.x) * ((i >> 1) ? f.y : 1.f - f.y);
+					mean   += w * old.sum / float(old.n);
+					weight += w;
+					n = std::min(n, old.n);
+				}
+			}
+
+			HistoryPixel& pixel = current->pixels[y * current->width + x];
+			if (weight > 0.f)
+			{
+				pixel.sum      = mean / weight * float(n);
+				pixel.n        = n;
+				pixel.position = position;
+				pixel.normal   = isect.geometric_normal;
+				pixel.hit      = found;
+				reused++;
+			}
+			else
+			{
+				tld->random.begin_pixel(x, y);
+				data.isect = Intersection();
+				pixel.sum = trace_pixel_sample(data, x, y, current->first_sample);
+				pixel.n   = 1;
+				record_primary_hit(data, &pixel);
+			}
+		}
+	}
+
+	if (num_reused)
+		*num_reused += reused;
+	return true;
+}
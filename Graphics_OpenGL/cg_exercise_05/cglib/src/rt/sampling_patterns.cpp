@@ -2,6 +2,47 @@
 #include <glm/glm.hpp>
 #include <cglib/core/thread_local_data.h>
 
+#include <cmath>
+
+namespace {
+
+/*
+ * The width of the grid of spp cells that is closest to square.
+ */
+int
+pixel_grid_x(int spp)
+{
+	int grid_x = int(std::sqrt(float(spp)));
+	while (spp % grid_x != 0)
+		grid_x--;
+	return grid_x;
+}
+
+void
+random_samples(glm::vec2 *generated_samples, int grid_x, int grid_y, ThreadLocalData *tld)
+{
+	for(int y = 0; y < grid_y; y++) {
+		for(int x = 0; x < grid_x; x++) {
+			const int i = y * grid_x + x;
+			generated_samples[i] = glm::vec2(tld->random.get(i, 0), tld->random.get(i, 1));
+		}
+	}
+}
+
+void
+stratified_samples(glm::vec2 *generated_samples, int grid_x, int grid_y, ThreadLocalData *tld)
+{
+	for(int y = 0; y < grid_y; y++) {
+		for(int x = 0; x < grid_x; x++) {
+			const int i = y * grid_x + x;
+			generated_samples[i] = (glm::vec2(x, y) + glm::vec2(tld->random.get(i, 0), tld->random.get(i, 1)))
+				/ glm::vec2(grid_x, grid_y);
+		}
+	}
+}
+
+}
+
 void
 generate_random_samples(
 		std::vector<glm::vec2> *generated_samples,
@@ -10,13 +51,7 @@ generate_random_samples(
 		ThreadLocalData *tld)
 {
 	generated_samples->resize(grid_x * grid_y);
-
-	for(int y = 0; y < grid_y; y++) {
-		for(int x = 0; x < grid_x; x++) {
-			glm::vec2 &s = (*generated_samples)[y * grid_x + x];
-			s = (glm::vec2(tld->rand(), tld->rand()));
-		}
-	}
+	random_samples(generated_samples->data(), grid_x, grid_y, tld);
 }
 
 void
@@ -27,12 +62,53 @@ generate_stratified_samples(
 		ThreadLocalData *tld)
 {
 	generated_samples->resize(grid_x * grid_y);
+	stratified_samples(generated_samples->data(), grid_x, grid_y, tld);
+}
 
-	for(int y = 0; y < grid_y; y++) {
-		for(int x = 0; x < grid_x; x++) {
-			glm::vec2 &s = (*generated_samples)[y * grid_x + x];
-			s = (glm::vec2(x, y) + glm::vec2(tld->rand(), tld->rand()))
-				/ glm::vec2(grid_x, grid_y);
-		}
+void
+generate_pixel_samples(
+		std::vector<glm::vec2> *generated_samples,
+		int spp,
+		bool stratified,
+		ThreadLocalData *tld)
+{
+	generated_samples->resize(spp);
+	generate_pixel_samples(generated_samples->data(), spp, stratified, tld);
+}
+
+void
+generate_pixel_samples(
+		glm::vec2 *generated_samples,
+		int spp,
+		bool stratified,
+		ThreadLocalData *tld)
+{
+	if (tld->sampler->type() == Sampler::RANDOM) {
+		const int grid_x = pixel_grid_x(spp);
+		if (stratified)
+			stratified_samples(generated_samples, grid_x, spp / grid_x, tld);
+		else
+			random_samples(generated_samples, grid_x, spp / grid_x, tld);
+		return;
 	}
+
+	for (int i = 0; i < spp; i++)
+		generated_samples[i] = tld->sampler->get_2d(tld->random, 0, std::uint32_t(i));
+}
+
+glm::vec2
+pixel_sample(
+		int i,
+		int spp,
+		bool stratified,
+		ThreadLocalData *tld)
+{
+	if (tld->sampler->type() != Sampler::RANDOM)
+		return tld->sampler->get_2d(tld->random, 0, std::uint32_t(i));
+
+	const glm::vec2 u(tld->random.get(i, 0), tld->random.get(i, 1));
+	if (!stratified || i >= spp)
+		return u;
+	const int grid_x = pixel_grid_x(spp);
+	return (glm::vec2(i % grid_x, i / grid_x) + u) / glm::vec2(grid_x, spp / grid_x);
 }
@@ -11,9 +11,11 @@
 #include <cglib/rt/bvh.h>
 #include <cglib/rt/triangle_soup.h>
 
+#include <cglib/core/assert.h>
 #include <cglib/core/camera.h>
 #include <cglib/core/image.h>
 
+#include <algorithm>
 #include <sstream>
 #include <random>
 
@@ -28,6 +30,60 @@ set_active_camera()
 		camera->set_active();
 }
 
+void Scene::
+update_bvhs(RaytracingParameters const& params)
+{
+	/* the scenes edit materials at will, flatten them for this frame */
+	for (auto& soup : soups)
+		soup->update_materials();
+	for (auto& o : objects)
+		o->update_materials();
+
+	std::vector<Object*> rebuilt;
+	for (auto& o : objects) {
+		BVH *bvh = dynamic_cast<BVH *>(o.get());
+		if (!bvh)
+			continue;
+		if (bvh->requires_rebuild(params)) {
+			bvh->build(params.bvh_build_method, params.bvh_max_triangles_in_leaf, params.num_threads);
+			rebuilt.push_back(bvh);
+		}
+		if (bvh->traversal_width != BVH::resolve_traversal_width(params.bvh_width)) {
+			bvh->set_traversal_width(params.bvh_width);
+		}
+	}
+
+	/* marked objects may also be prototypes of instances, not in objects */
+	for (Object* o : changed_objects) {
+		BVH *bvh = dynamic_cast<BVH *>(o);
+		if (bvh && std::find(rebuilt.begin(), rebuilt.end(), o) == rebuilt.end())
+			bvh->update(params.num_threads);
+	}
+
+	/* world bounds depend on whether transformations are applied, and
+	 * rebuilt BVHs may have other bounds */
+	if (tlas_generation != generation
+	 || !rebuilt.empty()
+	 || !tlas.is_built_for(objects)
+	 || tlas_transform_objects != params.transform_objects) {
+		tlas.build(objects);
+		tlas_generation = generation;
+		tlas_transform_objects = params.transform_objects;
+	}
+	else if (!changed_objects.empty()) {
+		tlas.refit();
+	}
+	changed_objects.clear();
+}
+
+void Scene::
+mark_changed(Object* object)
+{
+	cg_assert(object);
+	if (std::find(changed_objects.begin(), changed_objects.end(), object) == changed_objects.end())
+		changed_objects.push_back(object);
+}
+
 PoolTableScene::PoolTableScene(RaytracingParameters & params)
 {
     init_camera(params);
@@ -38,6 +94,7 @@ PoolTableScene::PoolTableScene(RaytracingParameters & params)
 void PoolTableScene::init_scene(RaytracingParameters const& params)
 {
     objects.clear();
+    generation++;
     lights.clear();
     textures.clear();
     soups.clear();
@@ -160,6 +217,7 @@ GoBoardScene::GoBoardScene(RaytracingParameters & params)
 void GoBoardScene::init_scene(RaytracingParameters const& params)
 {
     objects.clear();
+    generation++;
     lights.clear();
     textures.clear();
 
@@ -317,22 +375,48 @@ std::shared_ptr<TriangleSoup> createTriangleSoup(int num_triangles)
 void TriangleScene::init_scene(RaytracingParameters const& params)
 {
     objects.clear();
+    generation++;
     lights.clear();
     textures.clear();
     soups.clear();
 
 	soups.emplace_back(createTriangleSoup(params.num_triangles));
-    objects.emplace_back(new BVH(*soups.back()));
+    objects.emplace_back(new BVH(*soups.back(), params));
+	rest_vertices = soups.back()->vertices;
     lights.emplace_back(new Light(glm::vec3(0.f, 200.f, 400.f), glm::vec3(15000.f)));
 }
 
 void TriangleScene::refresh_scene(RaytracingParameters const& params)
 {
+	/* other parameter changes must not regenerate and rebuild the soup */
+	if (!soups.empty() && soups.back()->num_triangles == params.num_triangles)
+		return;
+
     soups.clear();
     objects.clear();
+    generation++;
     
 	soups.emplace_back(createTriangleSoup(params.num_triangles));
-	objects.emplace_back(new BVH(*soups.back()));
+	objects.emplace_back(new BVH(*soups.back(), params));
+	rest_vertices = soups.back()->vertices;
+}
+
+bool TriangleScene::animate(float time)
+{
+	if (soups.empty() || objects.empty())
+		return false;
+
+	/* each triangle is a bit behind the one in front of it, so that their
+	 * bounds slide across each other */
+	TriangleSoup &soup = *soups.back();
+	for (int i = 0; i < soup.num_triangles; ++i) {
+		const float phase = time + 2.f * float(M_PI) * float(i) / float(soup.num_triangles);
+		const glm::vec3 offset(0.3f * std::cos(phase), 0.3f * std::sin(phase), 0.f);
+		for (int j = 0; j < 3; ++j)
+			soup.vertices[i * 3 + j] = rest_vertices[i * 3 + j] + offset;
+	}
+	mark_changed(objects.back().get());
+	return true;
 }
 
 void TriangleScene::init_camera(RaytracingParameters& params)
@@ -352,6 +436,7 @@ MonkeyScene::MonkeyScene(RaytracingParameters& params)
 void MonkeyScene::init_scene(RaytracingParameters const& params)
 {
     objects.clear();
+    generation++;
     lights.clear();
     textures.clear();
     soups.clear();
@@ -369,7 +454,7 @@ void MonkeyScene::init_scene(RaytracingParameters const& params)
 
     soups.push_back(std::make_shared<TriangleSoup>(
 		"assets/suzanne.obj", &this->textures));
-    objects.emplace_back(new BVH(*soups.back()));
+    objects.emplace_back(new BVH(*soups.back(), params));
 	objects.back()->set_transform_object_to_world(
 		glm::translate(glm::vec3(0.f, 2.f, 0.f)) * 
 		glm::scale(glm::vec3(3.f, 3.f, 3.f)));
@@ -423,6 +508,7 @@ SponzaScene::SponzaScene(RaytracingParameters& params)
 void SponzaScene::init_scene(RaytracingParameters const& params)
 {
 	objects.clear();
+	generation++;
 	lights.clear();
 	textures.clear();
 	soups.clear();
@@ -436,7 +522,7 @@ void SponzaScene::init_scene(RaytracingParameters const& params)
 
 	auto objTriangles = std::make_shared<TriangleSoup>("assets/crytek-sponza/sponza_subdiv3.obj", &this->textures);
 	soups.push_back(objTriangles);
-	objects.emplace_back(new BVH(*objTriangles));
+	objects.emplace_back(new BVH(*objTriangles, params));
 	objects.back()->set_transform_object_to_world(
 		glm::scale(glm::vec3(0.01f)));
 	//for (auto& m : objTriangles->materials)
@@ -0,0 +1,208 @@
+#include <cglib/rt/tile_scheduler.h>
+
+#include <cglib/core/allocation_counter.h>
+#include <cglib/core/assert.h>
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+
+namespace {
+
+/*
+ * A tile is split while it is predicted to cost more than
+ * 1/(JOBS_PER_THREAD * num_threads) of the frame, which bounds how long
+ * the last job keeps the others waiting.
+ */
+const int JOBS_PER_THREAD = 8;
+
+/* the smallest side of a split job, a multiple of all ray packet sizes */
+const int MIN_JOB_SIZE = 8;
+
+/*
+ * Where to split [begin, end), or begin if it is too small.
+ */
+inline int
+split_point(int begin, int end)
+{
+	if (end - begin < 2 * MIN_JOB_SIZE)
+		return begin;
+	return begin + ((end - begin) / 2) / MIN_JOB_SIZE * MIN_JOB_SIZE;
+}
+
+inline float
+milliseconds(std::chrono::steady_clock::duration d)
+{
+	return std::chrono::duration<float, std::milli>(d).count();
+}
+
+}
+
+void
+TileScheduler::plan(int width, int height, int tile_size,
+                    std::vector<glm::ivec2> const& tile_idx,
+                    int num_threads, bool cost_aware, bool split,
+                    bool verbose)
+{
+	cg_assert(tile_size > 0);
+
+	const int num_tiles_x = (width  + tile_size - 1) / tile_size;
+	const int num_tiles_y = (height + tile_size - 1) / tile_size;
+	const int num_tiles   = num_tiles_x * num_tiles_y;
+	cg_assert(int(tile_idx.size()) == num_tiles);
+
+	/* the cost of every tile whose jobs all finished in the last frame */
+	if (width != m_width || height != m_height || tile_size != m_tile_size)
+	{
+		m_tile_cost.assign(num_tiles, -1.f);
+	}
+	else
+	{
+		std::vector<float> cost(num_tiles, 0.f);
+		std::vector<bool> finished(num_tiles, true);
+		for (int i = 0; i < num_jobs(); ++i)
+		{
+			Record const& r = m_records[i];
+			if (r.done)
+				cost[m_jobs[i].tile] += milliseconds(r.end - r.begin);
+			else
+				finished[m_jobs[i].tile] = false;
+		}
+		for (int t = 0; t < num_tiles && !m_jobs.empty(); ++t)
+		{
+			if (finished[t])
+				m_tile_cost[t] = cost[t];
+		}
+	}
+	m_width       = width;
+	m_height      = height;
+	m_tile_size   = tile_size;
+	m_num_threads = std::max(num_threads, 1);
+	m_num_split   = 0;
+	m_verbose     = verbose;
+
+	bool known = cost_aware;
+	float total = 0.f;
+	for (float c : m_tile_cost)
+	{
+		known = known && c >= 0.f;
+		total += c;
+	}
+
+	m_jobs.clear();
+	for (glm::ivec2 const& idx : tile_idx)
+	{
+		Job job;
+		job.begin = idx * tile_size;
+		job.end   = glm::min(job.begin + glm::ivec2(tile_size), glm::ivec2(width, height));
+		job.tile  = idx.y * num_tiles_x + idx.x;
+		job.cost  = known ? m_tile_cost[job.tile] : 0.f;
+
+		if (!(known && split && m_num_threads > 1))
+		{
+			m_jobs.push_back(job);
+			continue;
+		}
+
+		/* split into quadrants, as far as needed, assuming the cost is
+		 * spread evenly over the tile */
+		const float max_cost = total / float(JOBS_PER_THREAD * m_num_threads);
+		const int first = int(m_jobs.size());
+		std::vector<Job> stack(1, job);
+		while (!stack.empty())
+		{
+			const Job j = stack.back();
+			stack.pop_back();
+			const glm::ivec2 mid(split_point(j.begin.x, j.end.x), split_point(j.begin.y, j.end.y));
+			if (j.cost <= max_cost || (mid.x == j.begin.x && mid.y == j.begin.y))
+			{
+				m_jobs.push_back(j);
+				continue;
+			}
+			const int xs[3] = { j.begin.x, mid.x == j.begin.x ? j.end.x : mid.x, j.end.x };
+			const int ys[3] = { j.begin.y, mid.y == j.begin.y ? j.end.y : mid.y, j.end.y };
+			const float area = float((j.end.x - j.begin.x) * (j.end.y - j.begin.y));
+			for (int q = 0; q < 4; ++q)
+			{
+				Job part = j;
+				part.begin = glm::ivec2(xs[q & 1],       ys[q >> 1]);
+				part.end   = glm::ivec2(xs[(q & 1) + 1], ys[(q >> 1) + 1]);
+				if (part.begin.x == part.end.x || part.begin.y == part.end.y)
+					continue;
+				part.cost = j.cost * float((part.end.x - part.begin.x) * (part.end.y - part.begin.y)) / area;
+				stack.push_back(part);
+			}
+		}
+		if (int(m_jobs.size()) > first + 1)
+			m_num_split++;
+	}
+
+	/* the most expensive first, the spiral order among equals */
+	if (known)
+	{
+		std::stable_sort(m_jobs.begin(), m_jobs.end(),
+			[](Job const& a, Job const& b) { return a.cost > b.cost; });
+	}
+
+	m_records.assign(m_jobs.size(), Record());
+	m_num_done = 0;
+}
+
+void
+TileScheduler::begin_job(int i)
+{
+	m_records[i].begin = Clock::now();
+}
+
+void
+TileScheduler::end_job(int i, void const* worker, int num_allocations)
+{
+	Record& r = m_records[i];
+	r.end    = Clock::now();
+	r.worker = worker;
+	r.num_allocations = num_allocations;
+	r.done   = true;
+	if (m_num_done.fetch_add(1) + 1 == num_jobs())
+		report();
+}
+
+void
+TileScheduler::report() const
+{
+	if (!m_verbose)
+		return;
+
+	Clock::time_point begin = m_records[0].begin;
+	Clock::time_point end   = m_records[0].end;
+	float busy = 0.f;
+	int num_allocations = 0;
+	/* the last job of every thread */
+	std::vector<std::pair<void const*, Clock::time_point>> last;
+	for (Record const& r : m_records)
+	{
+		begin = std::min(begin, r.begin);
+		end   = std::max(end, r.end);
+		busy += milliseconds(r.end - r.begin);
+		num_allocations += r.num_allocations;
+
+		auto it = std::find_if(last.begin(), last.end(),
+			[&](std::pair<void const*, Clock::time_point> const& l) { return l.first == r.worker; });
+		if (it == last.end())
+			last.emplace_back(r.worker, r.end);
+		else
+			it->second = std::max(it->second, r.end);
+	}
+
+	Clock::time_point first_idle = end;
+	for (auto const& l : last)
+		first_idle = std::min(first_idle, l.second);
+
+	const float frame = milliseconds(end - begin);
+	const float idle  = frame > 0.f ? 100.f * (1.f - busy / (frame * float(m_num_threads))) : 0.f;
+	std::cout << "[Tiles] " << m_records.size() << " jobs, " << m_num_split << " tiles split, frame "
+	          << frame << "ms, tail " << milliseconds(end - first_idle) << "ms, idle "
+	          << std::max(idle, 0.f) << "%";
+	if (counting_allocations())
+		std::cout << ", " << num_allocations << " heap allocations";
+	std::cout << std::endl;
+}
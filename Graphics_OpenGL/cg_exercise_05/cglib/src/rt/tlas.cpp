@@ -0,0 +1,212 @@
+#include <cglib/rt/tlas.h>
+
+#include <cglib/rt/intersection.h>
+#include <cglib/rt/object.h>
+
+#include <cglib/core/assert.h>
+
+#include <algorithm>
+
+namespace {
+
+enum { TLAS_STACK_SIZE = 64 };
+
+bool
+is_empty(AABB const& aabb)
+{
+	return aabb.min.x > aabb.max.x
+		|| aabb.min.y > aabb.max.y
+		|| aabb.min.z > aabb.max.z;
+}
+
+} // namespace
+
+void TLAS::
+build(std::vector<std::unique_ptr<Object>> const& objects_)
+{
+	objects.clear();
+	nodes.clear();
+	object_indices.clear();
+	unbounded.clear();
+
+	std::vector<AABB> bounds(objects_.size());
+	std::vector<glm::vec3> centroids(objects_.size());
+	for (size_t i = 0; i < objects_.size(); ++i) {
+		cg_assert(objects_[i]);
+		objects.push_back(objects_[i].get());
+		if (!objects_[i]->get_world_bounds(&bounds[i])) {
+			unbounded.push_back(int(i));
+		}
+		else if (!is_empty(bounds[i])) {
+			centroids[i] = 0.5f * (bounds[i].min + bounds[i].max);
+			object_indices.push_back(int(i));
+		}
+	}
+
+	if (!object_indices.empty())
+		build_recursive(bounds, centroids, 0, int(object_indices.size()));
+}
+
+bool TLAS::
+is_built_for(std::vector<std::unique_ptr<Object>> const& objects_) const
+{
+	if (objects.size() != objects_.size())
+		return false;
+	for (size_t i = 0; i < objects.size(); ++i)
+		if (objects[i] != objects_[i].get())
+			return false;
+	return true;
+}
+
+void TLAS::
+refit()
+{
+	/* children always have larger indices than their parent */
+	for (int i = int(nodes.size()) - 1; i >= 0; --i) {
+		Node &n = nodes[i];
+		n.aabb = AABB();
+		if (n.num_objects > 0) {
+			for (int j = n.offset; j < n.offset + n.num_objects; ++j) {
+				AABB bounds;
+				if (objects[object_indices[j]]->get_world_bounds(&bounds))
+					n.aabb.extend(bounds);
+			}
+		}
+		else {
+			n.aabb.extend(nodes[i + 1].aabb);
+			n.aabb.extend(nodes[n.offset].aabb);
+		}
+	}
+}
+
+void TLAS::
+build_recursive(std::vector<AABB> const& bounds, std::vector<glm::vec3> const& centroids,
+	int first, int num)
+{
+	const int node_idx = int(nodes.size());
+	nodes.push_back(Node());
+
+	AABB aabb, centroid_bounds;
+	for (int i = first; i < first + num; ++i) {
+		aabb.extend(bounds[object_indices[i]]);
+		centroid_bounds.extend(centroids[object_indices[i]]);
+	}
+	nodes[node_idx].aabb = aabb;
+
+	if (num <= MAX_OBJECTS_IN_LEAF) {
+		nodes[node_idx].offset      = first;
+		nodes[node_idx].num_objects = num;
+		nodes[node_idx].axis        = 0;
+		return;
+	}
+
+	const glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+	int axis = 0;
+	if (extent.y > extent[axis]) axis = 1;
+	if (extent.z > extent[axis]) axis = 2;
+
+	const int half = num / 2;
+	std::nth_element(
+		object_indices.begin() + first,
+		object_indices.begin() + first + half,
+		object_indices.begin() + first + num,
+		[&](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+
+	build_recursive(bounds, centroids, first, half);
+	const int right = int(nodes.size());
+	build_recursive(bounds, centroids, first + half, num - half);
+
+	nodes[node_idx].offset      = right;
+	nodes[node_idx].num_objects = 0;
+	nodes[node_idx].axis        = axis;
+}
+
+bool TLAS::
+intersect(Ray const& ray, HitRecord* hit) const
+{
+	cg_assert(hit);
+
+	bool found = false;
+	auto intersect_object = [&](int i) {
+		/* only hits in front of the closest one so far */
+		if (objects[i]->intersect_hit(ray, 0.f, hit->t, hit)) {
+			hit->object = objects[i];
+			found = true;
+		}
+	};
+
+	for (int i : unbounded)
+		intersect_object(i);
+
+	if (!nodes.empty()) {
+		const glm::vec3 div = 1.0f / ray.direction;
+		int stack[TLAS_STACK_SIZE];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			const int idx = stack[--top];
+			Node const& n = nodes[idx];
+			float t_min = 0.f;
+			float t_max = hit->t;
+			if (!n.aabb.intersect(ray, t_min, t_max, div))
+				continue;
+			if (n.num_objects > 0) {
+				for (int k = 0; k < n.num_objects; ++k)
+					intersect_object(object_indices[n.offset + k]);
+				continue;
+			}
+			cg_assert(top + 2 <= TLAS_STACK_SIZE);
+			/* visit the child on the near side first */
+			if (ray.direction[n.axis] < 0.f) {
+				stack[top++] = idx + 1;
+				stack[top++] = n.offset;
+			}
+			else {
+				stack[top++] = n.offset;
+				stack[top++] = idx + 1;
+			}
+		}
+	}
+
+	return found;
+}
+
+bool TLAS::
+occluded(Ray const& ray, float max_t) const
+{
+	auto occludes = [&](int i) {
+		return objects[i]->occluded(ray, max_t);
+	};
+
+	for (int i : unbounded) {
+		if (occludes(i))
+			return true;
+	}
+
+	if (nodes.empty())
+		return false;
+
+	const glm::vec3 div = 1.0f / ray.direction;
+	int stack[TLAS_STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const int idx = stack[--top];
+		Node const& n = nodes[idx];
+		float t_min = 0.f;
+		float t_max = max_t;
+		if (!n.aabb.intersect(ray, t_min, t_max, div))
+			continue;
+		if (n.num_objects > 0) {
+			for (int k = 0; k < n.num_objects; ++k) {
+				if (occludes(object_indices[n.offset + k]))
+					return true;
+			}
+			continue;
+		}
+		cg_assert(top + 2 <= TLAS_STACK_SIZE);
+		stack[top++] = n.offset;
+		stack[top++] = idx + 1;
+	}
+	return false;
+}
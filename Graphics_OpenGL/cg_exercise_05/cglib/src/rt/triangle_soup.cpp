@@ -156,3 +156,12 @@ fill_intersection(
 
     cg_assert(uint32_t(material_ids[triangle_id]) < materials.size());
 }
+
+void TriangleSoup::
+update_materials()
+{
+	flat_materials.clear();
+	flat_materials.reserve(materials.size());
+	for (Material const& m : materials)
+		flat_materials.emplace_back(m);
+}
@@ -0,0 +1,363 @@
+#include <cglib/rt/wavefront.h>
+
+#include <cglib/rt/intersection.h>
+#include <cglib/rt/object.h>
+#include <cglib/rt/ray.h>
+#include <cglib/rt/raytracing_context.h>
+#include <cglib/rt/render_data.h>
+#include <cglib/rt/renderer.h>
+#include <cglib/rt/sampling_patterns.h>
+#include <cglib/rt/scene.h>
+
+#include <cglib/core/assert.h>
+#include <cglib/core/thread_local_data.h>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+
+namespace {
+
+struct PathState
+{
+	std::uint64_t key;
+	Ray ray;
+	glm::vec3 throughput;
+	RandomStream random;
+	glm::vec2 film;  /* subpixel position of the camera ray */
+	int pixel;       /* index in the tile */
+	int depth;
+	int hero;
+	HitRecord hit;
+};
+
+/*
+ * A shadow ray adds its contribution if nothing is closer than max_t.
+ * An occlusion ray of ambient occlusion adds it scaled by the
+ * ambient_occlusion_falloff of the distance to the closest hit.
+ */
+struct ConnectRay
+{
+	Ray ray;         /* already offset by the ray epsilon */
+	float max_t;
+	glm::vec3 contribution;
+	int pixel;
+	bool occlusion;
+};
+
+struct ObjectOrder
+{
+	Object const* object;
+	std::uint32_t order;
+};
+
+/* the number of visibility rays traced at once */
+const int CONNECT_BATCH = 4096;
+
+/*
+ * The octant of the direction and a cell of a 16 x 16 grid over its
+ * octahedral projection, in the upper half, and the position in the queue
+ * in the lower half, so that sorting is deterministic.
+ */
+std::uint64_t
+direction_key(glm::vec3 const& d, std::size_t index)
+{
+	const std::uint32_t octant = (d.x < 0.f ? 1u : 0u) | (d.y < 0.f ? 2u : 0u) | (d.z < 0.f ? 4u : 0u);
+	const float s = std::fabs(d.x) + std::fabs(d.y) + std::fabs(d.z);
+	const std::uint32_t u = std::min(std::uint32_t(std::fabs(d.x) / s * 16.f), 15u);
+	const std::uint32_t v = std::min(std::uint32_t(std::fabs(d.y) / s * 16.f), 15u);
+	return (std::uint64_t((octant << 8) | (u << 4) | v) << 32) | std::uint64_t(index);
+}
+
+template<typename T>
+void
+sort_by_key(T* queue, int n)
+{
+	std::sort(queue, queue + n, [](T const& a, T const& b) { return a.key < b.key; });
+}
+
+/*
+ * The connect stage: takes the visibility rays of the estimators of the
+ * path being shaded, weighted by its throughput, and traces them once
+ * CONNECT_BATCH have been queued, or at the end of the shade stage.
+ */
+class ConnectQueue : public DeferredRays
+{
+public:
+	ConnectQueue(RenderData const& data, ConnectRay* rays, glm::vec3* color) :
+		m_data(data), m_rays(rays), m_color(color)
+	{}
+
+	/* the path the rays are queued for */
+	void begin_path(glm::vec3 const& throughput, int pixel)
+	{
+		m_throughput = throughput;
+		m_pixel      = pixel;
+	}
+
+	/* the same ray as visible(data, from, to) */
+	void shadow_ray(glm::vec3 const& from, glm::vec3 const& to,
+		glm::vec3 const& contribution) override
+	{
+		const float eps = m_data.context.params.ray_epsilon;
+		const glm::vec3 d = glm::normalize(to - from);
+		ConnectRay& r = push();
+		r.ray          = Ray(from + eps * d, d);
+		r.max_t        = glm::length(to - from) - 2.f * eps;
+		r.contribution = m_throughput * contribution;
+		r.occlusion    = false;
+	}
+
+	/* the same ray as max_unobstructed_distance(data, from, dir, max_distance) */
+	void occlusion_ray(glm::vec3 const& from, glm::vec3 const& dir,
+		float max_distance, float weight) override
+	{
+		ConnectRay& r = push();
+		r.ray          = Ray(from + m_data.context.params.ray_epsilon * dir, dir);
+		r.max_t        = max_distance;
+		r.contribution = m_throughput * weight;
+		r.occlusion    = true;
+	}
+
+	/*
+	 * Trace the queued rays in the order of the hit points: the rays of
+	 * one hit share their origin, which keeps traversal more coherent
+	 * than sorting by direction.
+	 */
+	void connect()
+	{
+		TLAS const& tlas = m_data.context.scene->tlas;
+		const float eps = m_data.context.params.ray_epsilon;
+		for (int i = 0; i < m_size; ++i)
+		{
+			ConnectRay const& r = m_rays[i];
+			if (!r.occlusion) {
+				if (!tlas.occluded(r.ray, r.max_t))
+					m_color[r.pixel] += r.contribution;
+				continue;
+			}
+
+			HitRecord hit;
+			hit.t = r.max_t;
+			const float dist = tlas.intersect(r.ray, &hit) ? hit.t + eps : FLT_MAX;
+			m_color[r.pixel] += r.contribution * ambient_occlusion_falloff(m_data, dist);
+		}
+		num_rays += m_size;
+		m_size = 0;
+	}
+
+	long long num_rays = 0;
+
+private:
+	ConnectRay& push()
+	{
+		if (m_size == CONNECT_BATCH)
+			connect();
+		ConnectRay& r = m_rays[m_size++];
+		r.pixel = m_pixel;
+		return r;
+	}
+
+	RenderData const& m_data;
+	ConnectRay* m_rays;
+	glm::vec3* m_color;
+	glm::vec3 m_throughput = glm::vec3(1.f);
+	int m_pixel = 0;
+	int m_size  = 0;
+};
+
+}
+
+bool
+wavefront_supported(RaytracingParameters const& params)
+{
+	const bool branches = params.max_depth > 0
+		&& (params.reflection || params.transmission || params.indirect);
+	return (params.render_mode == RaytracingParameters::PATH_TRACE
+	     || (params.render_mode == RaytracingParameters::RECURSIVE && !branches))
+		&& !params.stereo
+		&& !(params.dof && params.dof_rays > 0);
+}
+
+bool
+render_tile_wavefront(
+	RaytracingContext const& context,
+	ThreadLocalData* tld,
+	int x0, int y0,
+	int x1, int y1,
+	glm::vec3* color,
+	std::atomic<bool> const& terminate,
+	long long* num_rays)
+{
+	cg_assert(tld);
+	cg_assert(color);
+
+	RaytracingParameters const& params = context.params;
+	TLAS const& tlas = context.scene->tlas;
+	const float eps = params.ray_epsilon;
+	const int width  = x1 - x0;
+	const int height = y1 - y0;
+	const bool footprint = params.tex_filter_mode == TextureFilterMode::TRILINEAR
+	                    || params.tex_filter_mode == TextureFilterMode::DEBUG_MIP;
+
+	RenderData data(context, tld);
+	tld->sampler = &Sampler::get(params.sampler);
+	std::fill(color, color + width * height, glm::vec3(0.f));
+	long long rays = 0;
+
+	/* the queues live in the scratch arena, which keeps its memory from
+	 * tile to tile */
+	const int spp = std::max(int(params.spp), 1);
+	const int max_paths = width * height * spp;
+	ScratchArena::Scope scope(tld->scratch);
+	PathState* paths = tld->scratch.allocate<PathState>(max_paths);
+	PathState* next  = tld->scratch.allocate<PathState>(max_paths);
+	ConnectQueue connect(data, tld->scratch.allocate<ConnectRay>(CONNECT_BATCH), color);
+	data.deferred_rays = &connect;
+
+	/* shading order of the objects, sorted by address for the lookup */
+	const int num_objects = int(tlas.objects.size());
+	ObjectOrder* object_order = tld->scratch.allocate<ObjectOrder>(num_objects);
+	for (int i = 0; i < num_objects; ++i)
+		object_order[i] = ObjectOrder{ tlas.objects[i], std::uint32_t(i) };
+	const auto by_object = [](ObjectOrder const& a, ObjectOrder const& b) { return std::less<Object const*>()(a.object, b.object); };
+	std::sort(object_order, object_order + num_objects, by_object);
+
+	/* generate, with the pixel samples and random streams of render_pixel;
+	 * paths start with throughput 1 like there, for Russian roulette */
+	int num_paths = 0;
+	glm::vec2* samples = tld->scratch.allocate<glm::vec2>(spp);
+	for (int y = y0; y < y1; ++y)
+	{
+		for (int x = x0; x < x1; ++x)
+		{
+			tld->random.begin_pixel(x, y);
+			if (spp > 1)
+				generate_pixel_samples(samples, spp, params.stratified, tld);
+			else
+				samples[0] = glm::vec2(0.5f);
+
+			for (int s = 0; s < spp; ++s)
+			{
+				if (spp > 1)
+					tld->random.begin_sample(s);
+				PathState& path = paths[num_paths++];
+				path.film       = glm::vec2(float(x), float(y)) + samples[s];
+				path.ray        = createPrimaryRay(data, path.film.x, path.film.y);
+				path.throughput = glm::vec3(1.f);
+				path.random     = tld->random;
+				path.pixel      = (y - y0) * width + (x - x0);
+				path.depth      = 0;
+				path.hero       = -1;
+			}
+		}
+	}
+
+	while (num_paths > 0)
+	{
+		if (terminate.load())
+			return false;
+
+		/* extend */
+		for (int i = 0; i < num_paths; ++i)
+			paths[i].key = direction_key(paths[i].ray.direction, i);
+		sort_by_key(paths, num_paths);
+		for (int i = 0; i < num_paths; ++i)
+		{
+			PathState& path = paths[i];
+			path.hit = HitRecord();
+			tlas.intersect(Ray(path.ray.origin + eps * path.ray.direction, path.ray.direction), &path.hit);
+		}
+		rays += (long long)(num_paths);
+
+		/* shade, grouped by object */
+		for (int i = 0; i < num_paths; ++i)
+		{
+			std::uint32_t order = ~0u;
+			if (Object const* object = paths[i].hit.object) {
+				ObjectOrder const* o = std::lower_bound(object_order, object_order + num_objects,
+					ObjectOrder{ object, 0 }, by_object);
+				cg_assert(o != object_order + num_objects && o->object == object);
+				order = o->order;
+			}
+			paths[i].key = (std::uint64_t(order) << 32) | std::uint64_t(i);
+		}
+		sort_by_key(paths, num_paths);
+
+		/* the estimators of trace_path, with their visibility rays
+		 * deferred to the connect queue */
+		int num_next = 0;
+		for (int i = 0; i < num_paths; ++i)
+		{
+			PathState& path = paths[i];
+			if (!path.hit.object) {
+				color[path.pixel] += path.throughput * env_map_lookup(data, path.ray.direction);
+				continue;
+			}
+
+			/* the sampling code draws from tld->random */
+			std::swap(tld->random, path.random);
+
+			const Ray ray_eps(path.ray.origin + eps * path.ray.direction, path.ray.direction);
+			Intersection isect;
+			path.hit.object->fill_intersection(ray_eps, path.hit, &isect);
+			if (footprint && path.depth == 0) {
+				const float fx = path.film.x;
+				const float fy = path.film.y;
+				const Ray corner_rays[] = {
+					createPrimaryRay(data, fx - 0.5f, fy - 0.5f),
+					createPrimaryRay(data, fx + 0.5f, fy + 0.5f),
+					createPrimaryRay(data, fx - 0.5f, fy + 0.5f),
+					createPrimaryRay(data, fx + 0.5f, fy - 0.5f) };
+				path.hit.object->compute_shading_info(corner_rays, &isect);
+			}
+			else {
+				path.hit.object->compute_shading_info(&isect);
+			}
+
+			const MaterialSample mat = shading_material(data, isect);
+			const glm::vec3 P = isect.position;
+			const glm::vec3 N = params.normal_mapping ? isect.shading_normal : isect.normal;
+			const glm::vec3 V = -path.ray.direction;
+			const bool hit_backside = glm::dot(isect.geometric_normal, V) < 0.f;
+
+			connect.begin_path(path.throughput, path.pixel);
+			if (params.ao) {
+				color[path.pixel] += path.throughput * evaluate_ambient_occlusion(data, P, N);
+			}
+			else {
+				if (!hit_backside && !(params.disable_direct && path.depth == 0))
+					color[path.pixel] += path.throughput * evaluate_direct_illumination(data, mat, P, N, V);
+
+				if (path.depth < params.max_depth
+				 && continue_path(data, mat, P, N, V, hit_backside, path.depth, &path.throughput, &path.hero, &path.ray))
+				{
+					std::swap(tld->random, path.random);
+					path.depth++;
+					next[num_next++] = path;
+					continue;
+				}
+			}
+
+			std::swap(tld->random, path.random);
+		}
+
+		if (terminate.load())
+			return false;
+
+		/* connect what is left in the queue */
+		connect.connect();
+
+		std::swap(paths, next);
+		num_paths = num_next;
+	}
+
+	for (int i = 0; i < width * height; ++i)
+		color[i] /= float(spp);
+
+	if (num_rays)
+		*num_rays += rays + connect.num_rays;
+	return true;
+}